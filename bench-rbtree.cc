@@ -0,0 +1,882 @@
+// Benchmarks of `rbtree` against `std::set`, a sorted `std::vector` and,
+// if available, `boost::intrusive::set`, of the lookups of `frozen_index`,
+// `rbtree_image` and of an `rbtree` relaid out in van Emde Boas order, of
+// the bulk operations of `rbtree`, and of the thread scaling of
+// `concurrent_rbtree` against an `rbtree` behind a mutex, e.g.
+//
+//     bench-rbtree --benchmark_format=json --benchmark_out=bench.json
+//         --benchmark_perf_counters=CYCLES,CACHE-MISSES,BRANCH-MISSES
+//
+// Each benchmark reports the time per element as `time/op`. Perf counters
+// require a Google Benchmark built with libpfm and are reported per
+// iteration. The sizes range from 1e3 to `RBTREE_BENCH_MAX_SIZE` (1e6 by
+// default, up to 1e8).
+
+#include "concurrent-rbtree.h"
+#include "frozen-index.h"
+#include "rbtree-image.h"
+#include "rbtree-pool.h"
+#include "rbtree.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef RBTREE_BENCH_BOOST
+#include <boost/intrusive/set.hpp>
+#endif
+
+#ifndef RBTREE_BENCH_MAX_SIZE
+#define RBTREE_BENCH_MAX_SIZE 1000000
+#endif
+
+namespace {
+
+// -- keys -------------------------------------------------------------------
+
+// The order in which keys are inserted and looked up. Sequential keys are
+// inserted and looked up in increasing order, random keys in random order.
+// Zipfian lookups hit the keys with a Zipf distribution (s = 0.99) over
+// randomly inserted keys, s.t. few keys are hot.
+enum class distribution {
+    sequential,
+    random,
+    zipfian,
+};
+
+template <typename Key>
+Key make_key(size_t i);
+
+template <>
+int64_t make_key<int64_t>(size_t i)
+{
+    return int64_t(i);
+}
+
+// Strings with a common prefix, s.t. comparisons read beyond the first
+// cache line of a short string.
+template <>
+std::string make_key<std::string>(size_t i)
+{
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "key-%012zu", i);
+    return buf;
+}
+
+template <typename Key>
+struct key_set {
+    std::vector<Key> inserts;
+    std::vector<Key> lookups;
+};
+
+std::vector<size_t> zipfian_ranks(size_t n, size_t count, std::mt19937_64& rng)
+{
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+        cdf[i] = sum += 1 / std::pow(double(i + 1), 0.99);
+
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::vector<size_t> ranks(count);
+    for (size_t& rank : ranks) {
+        rank = size_t(
+            std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) -
+            cdf.begin());
+        rank = std::min(rank, n - 1);
+    }
+    return ranks;
+}
+
+template <typename Key>
+key_set<Key> make_keys(size_t n, distribution dist)
+{
+    std::mt19937_64 rng(n);
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), size_t(0));
+
+    key_set<Key> keys;
+    if (dist == distribution::sequential) {
+        for (size_t i : order)
+            keys.inserts.push_back(make_key<Key>(i));
+        keys.lookups = keys.inserts;
+        return keys;
+    }
+
+    std::shuffle(order.begin(), order.end(), rng);
+    for (size_t i : order)
+        keys.inserts.push_back(make_key<Key>(i));
+
+    if (dist == distribution::random) {
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t i : order)
+            keys.lookups.push_back(make_key<Key>(i));
+    } else {
+        // The hot keys are spread over the key space.
+        for (size_t rank : zipfian_ranks(n, n, rng))
+            keys.lookups.push_back(keys.inserts[rank]);
+    }
+    return keys;
+}
+
+// -- containers -------------------------------------------------------------
+
+template <typename Key>
+struct Node : rbtree_node<> {
+#ifdef RBTREE_BENCH_BOOST
+    boost::intrusive::set_member_hook<> boost_hook;
+#endif
+    Key key;
+};
+
+template <typename Key>
+struct get_key {
+    using key_type = Key;
+
+    const Key& operator()(const Node<Key>& node) const noexcept
+    {
+        return node.key;
+    }
+};
+
+template <typename Key>
+using tree_type = rbtree<Node<Key>, void, get_key<Key>, std::less<Key>>;
+
+template <typename Key>
+class rbtree_container {
+    std::vector<Node<Key>> nodes_;
+    tree_type<Key> tree_;
+
+public:
+    static constexpr const char* name = "rbtree";
+
+    explicit rbtree_container(const std::vector<Key>& keys)
+        : nodes_(keys.size())
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            nodes_[i].key = keys[i];
+    }
+
+    ~rbtree_container()
+    {
+        tree_.clear();
+    }
+
+    void insert_all()
+    {
+        for (Node<Key>& node : nodes_)
+            tree_.insert(node);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return tree_.contains(key);
+    }
+
+    const tree_type<Key>& tree() const
+    {
+        return tree_;
+    }
+
+    void erase(const Key& key)
+    {
+        tree_.erase(key);
+    }
+
+    void clear()
+    {
+        tree_.clear();
+    }
+};
+
+template <typename Key>
+class std_set_container {
+    const std::vector<Key>& keys_;
+    std::set<Key> set_;
+
+public:
+    static constexpr const char* name = "std::set";
+
+    explicit std_set_container(const std::vector<Key>& keys) : keys_(keys) {}
+
+    void insert_all()
+    {
+        for (const Key& key : keys_)
+            set_.insert(key);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return set_.find(key) != set_.end();
+    }
+
+    void erase(const Key& key)
+    {
+        set_.erase(key);
+    }
+
+    void clear()
+    {
+        set_.clear();
+    }
+};
+
+// Inserts by appending all keys and sorting them once, which is how a
+// sorted vector is built in practice. Erasing is O(n) per key.
+template <typename Key>
+class sorted_vector_container {
+    const std::vector<Key>& keys_;
+    std::vector<Key> vector_;
+
+public:
+    static constexpr const char* name = "sorted vector";
+
+    explicit sorted_vector_container(const std::vector<Key>& keys)
+        : keys_(keys)
+    {}
+
+    void insert_all()
+    {
+        vector_.assign(keys_.begin(), keys_.end());
+        std::sort(vector_.begin(), vector_.end());
+    }
+
+    bool contains(const Key& key) const
+    {
+        return std::binary_search(vector_.begin(), vector_.end(), key);
+    }
+
+    void erase(const Key& key)
+    {
+        auto it = std::lower_bound(vector_.begin(), vector_.end(), key);
+        vector_.erase(it);
+    }
+
+    void clear()
+    {
+        vector_.clear();
+    }
+};
+
+#ifdef RBTREE_BENCH_BOOST
+template <typename Key>
+class boost_set_container {
+    struct key_of {
+        using type = Key;
+
+        const Key& operator()(const Node<Key>& node) const noexcept
+        {
+            return node.key;
+        }
+    };
+
+    using set_type = boost::intrusive::set<
+        Node<Key>,
+        boost::intrusive::member_hook<
+            Node<Key>, boost::intrusive::set_member_hook<>,
+            &Node<Key>::boost_hook>,
+        boost::intrusive::key_of_value<key_of>>;
+
+    std::vector<Node<Key>> nodes_;
+    set_type set_;
+
+public:
+    static constexpr const char* name = "boost::intrusive::set";
+
+    explicit boost_set_container(const std::vector<Key>& keys)
+        : nodes_(keys.size())
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            nodes_[i].key = keys[i];
+    }
+
+    ~boost_set_container()
+    {
+        set_.clear();
+    }
+
+    void insert_all()
+    {
+        for (Node<Key>& node : nodes_)
+            set_.insert(node);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return set_.find(key) != set_.end();
+    }
+
+    void erase(const Key& key)
+    {
+        set_.erase(key);
+    }
+
+    void clear()
+    {
+        set_.clear();
+    }
+};
+#endif
+
+// A `frozen_index` built from an `rbtree`, which only serves lookups.
+template <typename Key>
+class frozen_index_container {
+    std::vector<Node<Key>> nodes_;
+    rbtree<Node<Key>, void, get_key<Key>, std::less<Key>> tree_;
+    frozen_index<Node<Key>, get_key<Key>, std::less<Key>> index_;
+
+public:
+    static constexpr const char* name = "frozen_index";
+
+    explicit frozen_index_container(const std::vector<Key>& keys)
+        : nodes_(keys.size())
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            nodes_[i].key = keys[i];
+    }
+
+    ~frozen_index_container()
+    {
+        tree_.clear();
+    }
+
+    void insert_all()
+    {
+        for (Node<Key>& node : nodes_)
+            tree_.insert(node);
+        index_ = frozen_index<Node<Key>, get_key<Key>, std::less<Key>>(tree_);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return index_.contains(key);
+    }
+};
+
+// An `rbtree` whose nodes are moved into consecutive slots of a pool in
+// van Emde Boas order (see `rbtree_compact`), which only serves lookups.
+template <typename Key>
+class rbtree_veb_container {
+    const std::vector<Key>& keys_;
+    rbtree_node_pool<Node<Key>> pool_;
+    tree_type<Key> tree_;
+
+public:
+    static constexpr const char* name = "rbtree (van Emde Boas)";
+
+    explicit rbtree_veb_container(const std::vector<Key>& keys) : keys_(keys)
+    {}
+
+    ~rbtree_veb_container()
+    {
+        tree_.clear_and_dispose(pool_.disposer());
+    }
+
+    void insert_all()
+    {
+        for (const Key& key : keys_) {
+            Node<Key>* node = pool_.create();
+            node->key = key;
+            tree_.insert(*node);
+        }
+        rbtree_compact(tree_, pool_);
+    }
+
+    bool contains(const Key& key) const
+    {
+        return tree_.contains(key);
+    }
+};
+
+// An `rbtree_image` in van Emde Boas order, which only serves lookups.
+// Requires trivially copyable keys.
+template <typename Key>
+class rbtree_image_container {
+    std::vector<Node<Key>> nodes_;
+    std::vector<std::max_align_t> storage_;
+    rbtree_image<Key> image_;
+
+public:
+    static constexpr const char* name = "rbtree_image";
+
+    explicit rbtree_image_container(const std::vector<Key>& keys)
+        : nodes_(keys.size())
+    {
+        for (size_t i = 0; i < keys.size(); ++i)
+            nodes_[i].key = keys[i];
+    }
+
+    void insert_all()
+    {
+        tree_type<Key> tree;
+        for (Node<Key>& node : nodes_)
+            tree.insert(node);
+
+        std::ostringstream out;
+        write_rbtree_image(out, tree, [](const Node<Key>& node) {
+            return node.key;
+        });
+        tree.clear();
+
+        std::string bytes = out.str();
+        storage_.resize(bytes.size() / sizeof(std::max_align_t) + 1);
+        std::memcpy(storage_.data(), bytes.data(), bytes.size());
+        image_ = rbtree_image<Key>(storage_.data(), bytes.size());
+    }
+
+    bool contains(const Key& key) const
+    {
+        return image_.contains(key);
+    }
+};
+
+// -- benchmarks -------------------------------------------------------------
+
+// Reports the time per element, in seconds in machine-readable output.
+void set_time_per_op(benchmark::State& state, size_t ops_per_iteration)
+{
+    state.SetItemsProcessed(int64_t(state.iterations() * ops_per_iteration));
+    state.counters["time/op"] = benchmark::Counter(
+        double(state.iterations() * ops_per_iteration),
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+template <template <typename> class Container, typename Key>
+void bench_insert(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    Container<Key> container(keys.inserts);
+
+    for (auto _ : state) {
+        container.insert_all();
+
+        state.PauseTiming();
+        container.clear();
+        state.ResumeTiming();
+    }
+    set_time_per_op(state, keys.inserts.size());
+}
+
+template <template <typename> class Container, typename Key>
+void bench_find(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    Container<Key> container(keys.inserts);
+    container.insert_all();
+
+    for (auto _ : state) {
+        size_t found = 0;
+        for (const Key& key : keys.lookups)
+            found += container.contains(key);
+        benchmark::DoNotOptimize(found);
+    }
+    set_time_per_op(state, keys.lookups.size());
+}
+
+// Erases all keys in the order of the lookups, which must not repeat
+// keys, i.e., the distribution must not be Zipfian.
+template <template <typename> class Container, typename Key>
+void bench_erase(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    Container<Key> container(keys.inserts);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        container.insert_all();
+        state.ResumeTiming();
+
+        for (const Key& key : keys.lookups)
+            container.erase(key);
+    }
+    set_time_per_op(state, keys.lookups.size());
+}
+
+template <typename Key>
+std::vector<Node<Key>> sorted_nodes(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    std::sort(keys.inserts.begin(), keys.inserts.end());
+
+    std::vector<Node<Key>> nodes(keys.inserts.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+        nodes[i].key = keys.inserts[i];
+    return nodes;
+}
+
+// Inserts all keys, sorted, by one `insert_batch_sorted`.
+template <typename Key>
+void bench_insert_batch_sorted(benchmark::State& state, distribution dist)
+{
+    std::vector<Node<Key>> nodes = sorted_nodes<Key>(state, dist);
+    tree_type<Key> tree;
+
+    for (auto _ : state) {
+        tree.insert_batch_sorted(nodes.begin(), nodes.end());
+
+        state.PauseTiming();
+        tree.clear();
+        state.ResumeTiming();
+    }
+    set_time_per_op(state, nodes.size());
+}
+
+// Builds the tree from all keys, sorted, by `assign_sorted`.
+template <typename Key>
+void bench_assign_sorted(benchmark::State& state, distribution dist)
+{
+    std::vector<Node<Key>> nodes = sorted_nodes<Key>(state, dist);
+    tree_type<Key> tree;
+
+    for (auto _ : state) {
+        tree.assign_sorted(nodes.begin(), nodes.end());
+        benchmark::ClobberMemory();
+    }
+    tree.clear();
+    set_time_per_op(state, nodes.size());
+}
+
+// Looks up all keys by one `find_many`.
+template <typename Key>
+void bench_find_many(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    rbtree_container<Key> container(keys.inserts);
+    container.insert_all();
+    const tree_type<Key>& tree = container.tree();
+    std::vector<typename tree_type<Key>::const_iterator> found(
+        keys.lookups.size(), tree.end());
+
+    for (auto _ : state) {
+        tree.find_many(keys.lookups.begin(), keys.lookups.end(), found.begin());
+        benchmark::DoNotOptimize(found.data());
+        benchmark::ClobberMemory();
+    }
+    set_time_per_op(state, keys.lookups.size());
+}
+
+// Moves all nodes into consecutive slots of a pool in van Emde Boas order
+// by `rbtree_compact`.
+template <typename Key>
+void bench_relayout(benchmark::State& state, distribution dist)
+{
+    key_set<Key> keys = make_keys<Key>(size_t(state.range(0)), dist);
+    rbtree_node_pool<Node<Key>> pool;
+    tree_type<Key> tree;
+    for (const Key& key : keys.inserts) {
+        Node<Key>* node = pool.create();
+        node->key = key;
+        tree.insert(*node);
+    }
+
+    for (auto _ : state)
+        rbtree_compact(tree, pool);
+    tree.clear_and_dispose(pool.disposer());
+    set_time_per_op(state, keys.inserts.size());
+}
+
+const char* distribution_name(distribution dist)
+{
+    switch (dist) {
+    case distribution::sequential:
+        return "sequential";
+    case distribution::random:
+        return "random";
+    case distribution::zipfian:
+        return "zipfian";
+    }
+    return "";
+}
+
+void sizes(benchmark::internal::Benchmark* b, int64_t max)
+{
+    b->RangeMultiplier(10)->Range(1000, max);
+    b->Unit(benchmark::kMillisecond);
+}
+
+// Registers the benchmarks of `Container` as "<op>/<container>/<keys>/<n>".
+// Zipfian keys are only looked up, and the O(n) erase of the sorted vector
+// is limited to 1e4 elements.
+template <template <typename> class Container, typename Key>
+void register_container(const char* key_name)
+{
+    for (distribution dist :
+        {distribution::sequential, distribution::random, distribution::zipfian})
+    {
+        std::string suffix = std::string("/") + Container<Key>::name + "/"
+            + key_name + "/" + distribution_name(dist);
+
+        int64_t max = RBTREE_BENCH_MAX_SIZE;
+        if (dist != distribution::zipfian) {
+            sizes(benchmark::RegisterBenchmark(("insert" + suffix).c_str(),
+                bench_insert<Container, Key>, dist), max);
+        }
+        sizes(benchmark::RegisterBenchmark(("find" + suffix).c_str(),
+            bench_find<Container, Key>, dist), max);
+
+        if (dist != distribution::zipfian) {
+            if (std::string(Container<Key>::name) == "sorted vector")
+                max = std::min<int64_t>(max, 10000);
+            sizes(benchmark::RegisterBenchmark(("erase" + suffix).c_str(),
+                bench_erase<Container, Key>, dist), max);
+        }
+    }
+}
+
+// Registers the lookups of the read-only `Container` as
+// "find/<container>/<keys>/<n>".
+template <template <typename> class Container, typename Key>
+void register_lookups(const char* key_name)
+{
+    for (distribution dist :
+        {distribution::sequential, distribution::random, distribution::zipfian})
+    {
+        std::string name = std::string("find/") + Container<Key>::name + "/"
+            + key_name + "/" + distribution_name(dist);
+        sizes(benchmark::RegisterBenchmark(name.c_str(),
+            bench_find<Container, Key>, dist), RBTREE_BENCH_MAX_SIZE);
+    }
+}
+
+template <typename Key>
+void register_all(const char* key_name)
+{
+    register_container<rbtree_container, Key>(key_name);
+    register_container<std_set_container, Key>(key_name);
+    register_container<sorted_vector_container, Key>(key_name);
+#ifdef RBTREE_BENCH_BOOST
+    register_container<boost_set_container, Key>(key_name);
+#endif
+    register_lookups<frozen_index_container, Key>(key_name);
+    register_lookups<rbtree_veb_container, Key>(key_name);
+    if constexpr (std::is_trivially_copyable_v<Key>)
+        register_lookups<rbtree_image_container, Key>(key_name);
+
+    // The bulk operations of `rbtree`, as "<op>/rbtree/<keys>/<n>". The
+    // batches are sorted, i.e., compare to "insert/.../sequential".
+    int64_t max = RBTREE_BENCH_MAX_SIZE;
+    std::string suffix = std::string("/rbtree/") + key_name;
+    sizes(benchmark::RegisterBenchmark(
+        ("insert_batch_sorted" + suffix + "/sequential").c_str(),
+        bench_insert_batch_sorted<Key>, distribution::sequential), max);
+    sizes(benchmark::RegisterBenchmark(
+        ("assign_sorted" + suffix + "/sequential").c_str(),
+        bench_assign_sorted<Key>, distribution::sequential), max);
+    sizes(benchmark::RegisterBenchmark(
+        ("relayout" + suffix + "/random").c_str(),
+        bench_relayout<Key>, distribution::random), max);
+    for (distribution dist :
+        {distribution::sequential, distribution::random, distribution::zipfian})
+    {
+        sizes(benchmark::RegisterBenchmark(
+            ("find_many" + suffix + "/" + distribution_name(dist)).c_str(),
+            bench_find_many<Key>, dist), max);
+    }
+}
+
+// -- thread scaling ---------------------------------------------------------
+
+struct ConcurrentNode : rbtree_node<> {
+    int64_t key = 0;
+
+    // Only accessed by the thread which mutates the key.
+    bool linked = false;
+
+    // Whether the node may be inserted again, i.e., no reader observes it.
+    std::atomic<bool> reclaimed{true};
+};
+
+struct get_concurrent_key {
+    using key_type = int64_t;
+
+    const int64_t& operator()(const ConcurrentNode& node) const noexcept
+    {
+        return node.key;
+    }
+};
+
+// `rbtree` behind a single mutex, the baseline of `concurrent_rbtree`.
+struct locked_tree {
+    struct context {};
+
+    static constexpr const char* name = "locked rbtree";
+
+    std::mutex mutex;
+    rbtree<ConcurrentNode, void, get_concurrent_key, std::less<int64_t>> tree;
+
+    context make_context() { return {}; }
+
+    bool contains(context&, int64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tree.contains(key);
+    }
+
+    void insert(ConcurrentNode& node)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        node.reclaimed = false;
+        tree.insert(node);
+    }
+
+    void erase(int64_t key)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tree.erase(key)->reclaimed = true;
+    }
+
+    void reclaim() {}
+
+    void clear()
+    {
+        tree.clear();
+    }
+};
+
+struct optimistic_tree {
+    using context = concurrent_rbtree<
+        ConcurrentNode, void, get_concurrent_key, std::less<int64_t>>::reader;
+
+    static constexpr const char* name = "concurrent_rbtree";
+
+    concurrent_rbtree<
+        ConcurrentNode, void, get_concurrent_key, std::less<int64_t>> tree;
+
+    context make_context() { return tree.make_reader(); }
+
+    bool contains(context& reader, int64_t key)
+    {
+        return reader.lock().contains(key);
+    }
+
+    void insert(ConcurrentNode& node)
+    {
+        node.reclaimed = false;
+        tree.insert(node);
+    }
+
+    void erase(int64_t key)
+    {
+        tree.erase(key);
+    }
+
+    void reclaim()
+    {
+        tree.reclaim([](ConcurrentNode* node) { node->reclaimed = true; });
+    }
+
+    void clear()
+    {
+        reclaim();
+        tree.unsafe_tree().clear();
+    }
+};
+
+// Read-only lookups, or half lookups and half inserts/erases.
+enum class workload {
+    read,
+    mixed,
+};
+
+constexpr size_t thread_key_count = 1 << 16;
+constexpr size_t ops_per_thread = 20000;
+
+// Runs `workload` from `thread_count` threads, each mutating its own share
+// of the keys.
+template <typename Tree>
+void run_workload(
+    Tree& tree, std::vector<ConcurrentNode>& nodes, size_t thread_count,
+    workload work)
+{
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            auto context = tree.make_context();
+            std::mt19937_64 rng(t + 1);
+            size_t found = 0;
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                size_t key = rng() % (nodes.size() / thread_count);
+                ConcurrentNode& node = nodes[key * thread_count + t];
+                if (work == workload::read || rng() % 2) {
+                    found += tree.contains(context, node.key);
+                } else if (node.linked) {
+                    tree.erase(node.key);
+                    node.linked = false;
+                } else if (node.reclaimed) {
+                    tree.insert(node);
+                    node.linked = true;
+                }
+                if (i % 256 == 0 && work == workload::mixed)
+                    tree.reclaim();
+            }
+            benchmark::DoNotOptimize(found);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// Measures the wall-clock time per operation of `state.range(0)` threads.
+// For read-only workloads, the tree holds all keys.
+template <typename Tree>
+void bench_threads(benchmark::State& state, workload work)
+{
+    size_t thread_count = size_t(state.range(0));
+    std::vector<ConcurrentNode> nodes(thread_key_count);
+    Tree tree;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].key = int64_t(i);
+        if (work == workload::read) {
+            tree.insert(nodes[i]);
+            nodes[i].linked = true;
+        }
+    }
+
+    for (auto _ : state)
+        run_workload(tree, nodes, thread_count, work);
+    set_time_per_op(state, thread_count * ops_per_thread);
+    tree.clear();
+}
+
+// Registers the workloads of `Tree` as "<workload>/<tree>/threads:<n>".
+template <typename Tree>
+void register_threads()
+{
+    for (workload work : {workload::read, workload::mixed}) {
+        std::string name = work == workload::read ? "read/" : "mixed/";
+        name += Tree::name;
+        benchmark::RegisterBenchmark(name.c_str(), bench_threads<Tree>, work)
+            ->ArgName("threads")->Arg(1)->Arg(2)->Arg(4)->Arg(8)
+            ->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    register_all<int64_t>("int");
+    register_all<std::string>("string");
+    register_threads<locked_tree>();
+    register_threads<optimistic_tree>();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
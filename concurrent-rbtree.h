@@ -0,0 +1,1048 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -- epoch-based reclamation ------------------------------------------------
+
+// Tracks which readers may still observe nodes that were removed from a
+// concurrently read structure. A reader pins the current epoch for the
+// duration of a read section. A node retired in epoch e is only handed back
+// to the user once no reader is pinned at an epoch <= e anymore.
+//
+// Each reader owns one slot for its lifetime. Slots live on separate cache
+// lines, s.t. entering and leaving a read section never writes a cache line
+// shared with other readers.
+class rbtree_epoch_domain {
+    struct alignas(64) slot {
+        // The pinned epoch, or 0 if the reader is outside a read section.
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<bool> used{false};
+    };
+
+    std::atomic<uint64_t> epoch_{1};
+    std::unique_ptr<slot[]> slots_;
+    size_t slot_count_;
+
+public:
+    explicit rbtree_epoch_domain(size_t max_readers)
+        : slots_(new slot[max_readers])
+        , slot_count_(max_readers)
+    {}
+
+    rbtree_epoch_domain(const rbtree_epoch_domain&) = delete;
+    rbtree_epoch_domain& operator=(const rbtree_epoch_domain&) = delete;
+
+    // Claims a free slot and returns its index. Requires fewer than
+    // `max_readers` slots to be in use. The search starts at a slot which
+    // depends on the calling thread, s.t. threads which claim slots
+    // repeatedly (e.g. writers) rarely contend on the same slot.
+    size_t acquire_slot() noexcept
+    {
+        size_t start = std::hash<std::thread::id>()(
+            std::this_thread::get_id()) % slot_count_;
+        for (;;) {
+            for (size_t k = 0; k < slot_count_; ++k) {
+                size_t i = (start + k) % slot_count_;
+                bool expected = false;
+                if (slots_[i].used.compare_exchange_strong(
+                        expected, true, std::memory_order_acquire))
+                    return i;
+            }
+            assert(false && "too many concurrent readers");
+            std::this_thread::yield();
+        }
+    }
+
+    void release_slot(size_t index) noexcept
+    {
+        assert(slots_[index].epoch.load(std::memory_order_relaxed) == 0);
+        slots_[index].used.store(false, std::memory_order_release);
+    }
+
+    void pin(size_t index) noexcept
+    {
+        slots_[index].epoch.store(
+            epoch_.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        // Orders the announcement before any read of the structure. Pairs
+        // with the fence in `min_pinned()`.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void unpin(size_t index) noexcept
+    {
+        slots_[index].epoch.store(0, std::memory_order_release);
+    }
+
+    uint64_t current() const noexcept
+    {
+        return epoch_.load(std::memory_order_relaxed);
+    }
+
+    // Returns the oldest epoch pinned by any reader, or UINT64_MAX if no
+    // reader is inside a read section, and starts a new epoch.
+    uint64_t min_pinned() noexcept
+    {
+        // Orders the preceding unlinks before the scan of the slots.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint64_t min = UINT64_MAX;
+        for (size_t i = 0; i < slot_count_; ++i) {
+            uint64_t e = slots_[i].epoch.load(std::memory_order_acquire);
+            if (e != 0 && e < min)
+                min = e;
+        }
+        epoch_.fetch_add(1, std::memory_order_relaxed);
+        return min;
+    }
+};
+
+// -- concurrent red-black tree ----------------------------------------------
+
+// An `rbtree` which supports lock-free lookups and forward iteration from
+// many threads while writers mutate the tree.
+//
+// Writers are serialized by a mutex and bracket each mutation with a
+// sequence counter (a seqlock). Readers never write shared memory: they
+// descend optimistically, loading the links atomically, and retry if the
+// sequence changed meanwhile. `rbtree` stores the links atomically when it
+// links, unlinks and rotates nodes, and publishes a new node only once its
+// links are initialized. Apart from that, the rebalancing code does not
+// need to publish its link updates in any particular order; a reader which
+// observed a half-done rotation simply discards its result.
+//
+// Nodes unlinked by a writer may still be visited by a reader, hence they
+// must be passed to `retire()` instead of being reused or freed directly.
+// `reclaim()` later hands those nodes to a disposer once no reader can
+// reach them anymore. Keys of linked or retired nodes must not change.
+//
+// Requires nodes with pointer links, i.e., `rbtree_node<Tag>` or
+// `rbtree_node<rbtree_counted<Tag>>`.
+template <
+    typename T, typename Tag = void,
+    typename GetKeyForValue = get_key_for_value<T>,
+    typename Compare = std::less<T>,
+    typename Augment = rbtree_no_augment>
+class concurrent_rbtree {
+public:
+    using tree_type = rbtree<T, Tag, GetKeyForValue, Compare, Augment>;
+    using value_type = T;
+    using key_type = typename tree_type::key_type;
+    using node_type = typename tree_type::node_type;
+
+private:
+    static_assert(
+        rbtree_access::has_pointer_links<node_type>,
+        "`concurrent_rbtree` requires nodes with pointer links.");
+
+    // A red-black tree of n nodes has a height of at most 2 log2(n + 1),
+    // hence any longer walk observed a tree in the middle of a mutation.
+    static constexpr size_t max_steps = 2 * 64;
+
+    tree_type tree_;
+    alignas(64) std::atomic<uint64_t> seq_{0};
+    alignas(64) std::mutex write_mutex_;
+    rbtree_epoch_domain epochs_;
+    std::vector<std::pair<uint64_t, value_type*>> retired_;
+
+    static void cpu_relax() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return static_cast<const Compare&>(tree_)(key0, key1);
+    }
+
+    const key_type& to_key(const node_type* node) const noexcept
+    {
+        return static_cast<const GetKeyForValue&>(tree_)(
+            static_cast<const value_type&>(*node));
+    }
+
+    const node_type* head() const noexcept
+    {
+        return rbtree_access::head(tree_);
+    }
+
+    // Runs `fn(ok)` until it completes without a concurrent mutation. `fn`
+    // clears `ok` if it observed an inconsistent tree. `seq` receives the
+    // sequence of the state the result was computed for. Yields once a
+    // write takes long, e.g. since the writer was preempted.
+    template <typename Fn>
+    auto read_validated(Fn fn, uint64_t& seq) const noexcept
+    {
+        for (size_t spins = 0; ; ) {
+            seq = seq_.load(std::memory_order_acquire);
+            if (seq & 1) {
+                if (++spins % 64 == 0)
+                    std::this_thread::yield();
+                else
+                    cpu_relax();
+                continue;
+            }
+
+            bool ok = true;
+            auto result = fn(ok);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (ok && seq_.load(std::memory_order_relaxed) == seq)
+                return result;
+        }
+    }
+
+    template <typename Fn>
+    auto read_validated(Fn fn) const noexcept
+    {
+        uint64_t seq;
+        return read_validated(fn, seq);
+    }
+
+    // Same as `write` but requires `write_mutex_` to be held.
+    template <typename Fn>
+    decltype(auto) write_locked(Fn&& fn)
+    {
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        struct end_write {
+            std::atomic<uint64_t>& seq_;
+            uint64_t seq;
+            ~end_write() { seq_.store(seq + 2, std::memory_order_release); }
+        } end{seq_, seq};
+
+        return std::forward<Fn>(fn)(tree_);
+    }
+
+    template <typename Key>
+    const node_type* find_node(const Key& key, bool& ok) const noexcept
+    {
+        const node_type* x = lower_bound_node(key, ok);
+        if (x && is_less_than(key, to_key(x)))
+            return nullptr;
+        return x;
+    }
+
+    struct insert_position {
+        const node_type* parent;
+        const node_type* existing;
+    };
+
+    template <typename Key>
+    insert_position find_insert_position(
+        const Key& key, bool& ok) const noexcept
+    {
+        const node_type* x = rbtree_access::load_parent(head());
+        const node_type* y = nullptr;
+
+        for (size_t steps = 0; x; ++steps) {
+            if (steps == max_steps) {
+                ok = false;
+                break;
+            }
+            y = x;
+            if (is_less_than(key, to_key(x)))
+                x = rbtree_access::load_left(x);
+            else if (is_less_than(to_key(x), key))
+                x = rbtree_access::load_right(x);
+            else
+                return { x, x };
+        }
+        return { y, nullptr };
+    }
+
+    template <typename Key>
+    const node_type* lower_bound_node(const Key& key, bool& ok) const noexcept
+    {
+        const node_type* x = rbtree_access::load_parent(head());
+        const node_type* y = nullptr;
+
+        for (size_t steps = 0; x; ++steps) {
+            if (steps == max_steps) {
+                ok = false;
+                return nullptr;
+            }
+            if (!is_less_than(to_key(x), key)) {
+                y = x;
+                x = rbtree_access::load_left(x);
+            } else {
+                x = rbtree_access::load_right(x);
+            }
+        }
+        return y;
+    }
+
+    template <typename Key>
+    const node_type* upper_bound_node(const Key& key, bool& ok) const noexcept
+    {
+        const node_type* x = rbtree_access::load_parent(head());
+        const node_type* y = nullptr;
+
+        for (size_t steps = 0; x; ++steps) {
+            if (steps == max_steps) {
+                ok = false;
+                return nullptr;
+            }
+            if (is_less_than(key, to_key(x))) {
+                y = x;
+                x = rbtree_access::load_left(x);
+            } else {
+                x = rbtree_access::load_right(x);
+            }
+        }
+        return y;
+    }
+
+    // Returns the in-order successor of the linked node `x`, or null.
+    const node_type* next_node(const node_type* x, bool& ok) const noexcept
+    {
+        if (const node_type* r = rbtree_access::load_right(x)) {
+            for (size_t steps = 0; ; ++steps) {
+                const node_type* l = rbtree_access::load_left(r);
+                if (!l)
+                    return r;
+                if (steps == max_steps) {
+                    ok = false;
+                    return nullptr;
+                }
+                r = l;
+            }
+        }
+
+        for (size_t steps = 0; ; ++steps) {
+            const node_type* p = rbtree_access::load_parent(x);
+            if (!p || steps == max_steps) {
+                ok = false;
+                return nullptr;
+            }
+            if (p == head())
+                return nullptr;
+            if (rbtree_access::load_left(p) == x)
+                return p;
+            x = p;
+        }
+    }
+
+    static const value_type* to_value(const node_type* node) noexcept
+    {
+        return static_cast<const value_type*>(node);
+    }
+
+    // Returns true if `key` can still be linked below `parent`, found by
+    // `find_insert_position` before the writer lock was taken: `parent` is
+    // linked, its child on the side of `key` is null, and `key` lies
+    // strictly between the neighbors of that slot. Requires `write_mutex_`.
+    template <typename Key>
+    bool is_insert_position(const node_type* parent, const Key& key) const
+    {
+        if (!parent)
+            return tree_.empty();
+        if (!rbtree_access::parent(parent))
+            return false;
+
+        auto it = tree_.iterator_to(*to_value(parent));
+        if (is_less_than(key, to_key(parent))) {
+            if (rbtree_access::left(parent))
+                return false;
+            return it == tree_.begin()
+                || is_less_than(to_key(&*std::prev(it)), key);
+        }
+        if (!is_less_than(to_key(parent), key) || rbtree_access::right(parent))
+            return false;
+        ++it;
+        return it == tree_.end() || is_less_than(key, to_key(&*it));
+    }
+
+public:
+    // A reader registered with the tree. Each thread reading the tree needs
+    // its own reader; `max_readers` of the tree bounds how many may exist
+    // at the same time.
+    class reader;
+
+    // A read section. Pointers obtained through it stay valid until it
+    // ends, even if the elements are erased meanwhile.
+    class read_guard {
+        friend class concurrent_rbtree;
+        friend class reader;
+
+        const concurrent_rbtree* tree_;
+        size_t slot_;
+
+        read_guard(const concurrent_rbtree* tree, size_t slot) noexcept
+            : tree_(tree), slot_(slot)
+        {
+            const_cast<concurrent_rbtree*>(tree_)->epochs_.pin(slot_);
+        }
+
+    public:
+        read_guard(const read_guard&) = delete;
+        read_guard& operator=(const read_guard&) = delete;
+
+        ~read_guard()
+        {
+            const_cast<concurrent_rbtree*>(tree_)->epochs_.unpin(slot_);
+        }
+
+        template <typename Key>
+        const value_type* lower_bound(const Key& key) const noexcept
+        {
+            return to_value(tree_->read_validated([&](bool& ok) {
+                return tree_->lower_bound_node(key, ok);
+            }));
+        }
+
+        template <typename Key>
+        const value_type* upper_bound(const Key& key) const noexcept
+        {
+            return to_value(tree_->read_validated([&](bool& ok) {
+                return tree_->upper_bound_node(key, ok);
+            }));
+        }
+
+        template <typename Key>
+        const value_type* find(const Key& key) const noexcept
+        {
+            return to_value(tree_->read_validated([&](bool& ok) {
+                return tree_->find_node(key, ok);
+            }));
+        }
+
+        template <typename Key>
+        bool contains(const Key& key) const noexcept
+        {
+            return find(key) != nullptr;
+        }
+
+        // Returns the smallest element, or null if the tree is empty.
+        const value_type* first() const noexcept
+        {
+            return to_value(tree_->read_validated([&](bool& ok) {
+                const node_type* x = rbtree_access::load_parent(
+                    tree_->head());
+                for (size_t steps = 0; x; ++steps) {
+                    const node_type* l = rbtree_access::load_left(x);
+                    if (!l)
+                        break;
+                    if (steps == max_steps) {
+                        ok = false;
+                        break;
+                    }
+                    x = l;
+                }
+                return x;
+            }));
+        }
+
+        // Returns the smallest element greater than `value`, or null. Note,
+        // `value` need not be part of the tree anymore; the iteration then
+        // continues after its key.
+        const value_type* next(const value_type* value) const noexcept
+        {
+            const node_type* x = static_cast<const node_type*>(value);
+            return to_value(tree_->read_validated([&](bool& ok) {
+                // Unlinked by a writer, continue from its key instead.
+                if (!rbtree_access::load_parent(x))
+                    return tree_->upper_bound_node(tree_->to_key(x), ok);
+                return tree_->next_node(x, ok);
+            }));
+        }
+
+        // Invokes `fn` on all elements not less than `key` in order, as long
+        // as `fn` returns true. Each step observes a consistent tree, but
+        // elements inserted or erased during the iteration may or may not
+        // be visited.
+        template <typename Key, typename Fn>
+        void for_each_from(const Key& key, Fn&& fn) const
+        {
+            for (const value_type* x = lower_bound(key); x; x = next(x))
+                if (!fn(*x))
+                    return;
+        }
+    };
+
+    class reader {
+        friend class concurrent_rbtree;
+
+        const concurrent_rbtree* tree_;
+        size_t slot_;
+
+        explicit reader(const concurrent_rbtree* tree) noexcept
+            : tree_(tree)
+            , slot_(const_cast<concurrent_rbtree*>(tree)->epochs_
+                        .acquire_slot())
+        {}
+
+    public:
+        reader(reader&& other) noexcept
+            : tree_(other.tree_), slot_(other.slot_)
+        {
+            other.tree_ = nullptr;
+        }
+
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+        reader& operator=(reader&&) = delete;
+
+        ~reader()
+        {
+            if (tree_)
+                const_cast<concurrent_rbtree*>(tree_)->epochs_
+                    .release_slot(slot_);
+        }
+
+        read_guard lock() const noexcept
+        {
+            return read_guard(tree_, slot_);
+        }
+    };
+
+    explicit concurrent_rbtree(
+        size_t max_readers = 128,
+        const GetKeyForValue& get_key = GetKeyForValue(),
+        const Compare& compare = Compare(),
+        const Augment& augment = Augment())
+        : tree_(get_key, compare, augment)
+        , epochs_(max_readers)
+    {}
+
+    concurrent_rbtree(const concurrent_rbtree&) = delete;
+    concurrent_rbtree& operator=(const concurrent_rbtree&) = delete;
+
+    // Note, retired elements not yet reclaimed are not disposed of.
+    ~concurrent_rbtree()
+    {
+        assert(retired_.empty());
+    }
+
+    reader make_reader() const noexcept
+    {
+        return reader(this);
+    }
+
+    // -- writers ------------------------------------------------------------
+
+    // Invokes `fn(tree)` with exclusive write access to the underlying
+    // `rbtree`. Elements unlinked by `fn` must be retired. Note, only the
+    // operations which insert or erase single elements store the links
+    // atomically, i.e., `fn` must not call bulk operations (e.g. `clear`,
+    // `assign_sorted` or `split`) while there are readers.
+    template <typename Fn>
+    decltype(auto) write(Fn&& fn)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return write_locked(std::forward<Fn>(fn));
+    }
+
+    // Note, `insert` and `erase` may be called by many threads at once.
+    // Both search the tree optimistically before taking the writer lock:
+    // inserting an existing key or erasing a missing one does not lock at
+    // all. Under the lock, `insert` checks in O(1) amortized that the
+    // position found is still valid (even if other writers intervened) and
+    // `erase` that the element found is still linked; only otherwise they
+    // search again. This way writers mostly serialize on linking and
+    // rebalancing. The optimistic search runs in a read section, s.t.
+    // `reclaim` does not dispose of the nodes it visits. Without a
+    // `read_guard` of the caller, `insert` and `erase` claim a reader slot
+    // of their own for the duration of the call.
+
+    // Inserts `value` unless its key exists. Returns the element with the
+    // key and whether `value` was inserted. Note, if the key exists, the
+    // element returned may be erased and reclaimed concurrently, i.e., it
+    // may only be accessed within a read section, see below.
+    std::pair<value_type*, bool> insert(value_type& value)
+    {
+        return insert(make_reader().lock(), value);
+    }
+
+    // Same as `insert(value)` within the read section `guard`, which keeps
+    // an existing element returned valid until it ends.
+    std::pair<value_type*, bool> insert(
+        const read_guard& guard, value_type& value)
+    {
+        assert(guard.tree_ == this);
+        (void)guard;
+
+        node_type* z = static_cast<node_type*>(&value);
+        uint64_t seq;
+        insert_position pos = read_validated([&](bool& ok) {
+            return find_insert_position(to_key(z), ok);
+        }, seq);
+        if (pos.existing)
+            return { const_cast<value_type*>(to_value(pos.existing)), false };
+
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        bool valid = seq_.load(std::memory_order_relaxed) == seq
+            || is_insert_position(pos.parent, to_key(z));
+        return write_locked([&](tree_type& tree) {
+            auto [it, inserted] = valid ?
+                tree.insert_parent(const_cast<node_type*>(pos.parent), z) :
+                tree.insert(value);
+            return std::make_pair(&*it, inserted);
+        });
+    }
+
+    // Unlinks and retires the element with key `key`. Returns the element,
+    // or null if there is none.
+    template <typename Key>
+    value_type* erase(const Key& key)
+    {
+        return erase(make_reader().lock(), key);
+    }
+
+    template <typename Key>
+    value_type* erase(const read_guard& guard, const Key& key)
+    {
+        assert(guard.tree_ == this);
+        (void)guard;
+
+        const node_type* x = read_validated([&](bool& ok) {
+            return find_node(key, ok);
+        });
+        if (!x)
+            return nullptr;
+
+        // An element found stays linked unless another writer erased it,
+        // since keys of linked elements do not change and erased elements
+        // are not reused before the read section ends.
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        value_type* value = write_locked([&](tree_type& tree) {
+            if (!rbtree_access::parent(x))
+                return tree.erase(key);
+            value_type* found = const_cast<value_type*>(to_value(x));
+            tree.erase(tree.iterator_to(*found));
+            return found;
+        });
+        if (value)
+            retired_.emplace_back(epochs_.current(), value);
+        return value;
+    }
+
+    // Defers handing `value`, which must no longer be linked, to the
+    // disposer of `reclaim()` until no reader may observe it anymore.
+    void retire(value_type& value)
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        retired_.emplace_back(epochs_.current(), &value);
+    }
+
+    // Invokes `disposer` on all retired elements no reader can observe
+    // anymore. Returns the number of elements still pending.
+    template <typename Disposer>
+    size_t reclaim(Disposer&& disposer)
+    {
+        std::vector<value_type*> reclaimed;
+        size_t pending;
+        {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            uint64_t min = epochs_.min_pinned();
+
+            auto it = std::stable_partition(
+                retired_.begin(), retired_.end(),
+                [&](const auto& retired) { return retired.first >= min; });
+            for (auto jt = it; jt != retired_.end(); ++jt)
+                reclaimed.push_back(jt->second);
+            retired_.erase(it, retired_.end());
+            pending = retired_.size();
+        }
+
+        for (value_type* value : reclaimed)
+            disposer(value);
+        return pending;
+    }
+
+    // Note, the following may only be called by writers or while there are
+    // no concurrent writers.
+
+    tree_type& unsafe_tree() noexcept
+    {
+        return tree_;
+    }
+
+    const tree_type& unsafe_tree() const noexcept
+    {
+        return tree_;
+    }
+};
+
+// -- sharded red-black tree -------------------------------------------------
+
+// `N` independent `rbtree`s partitioned by key range, each guarded by its own
+// lock on its own cache line. Shard i holds the keys in [`splitters[i - 1]`,
+// `splitters[i]`), s.t. operations on unrelated keys rarely contend, and
+// iterating the shards in order visits all keys in order.
+//
+// Operations are routed by a binary search over the splitters, which is
+// done without a lock and validated once the shard is locked. `rebalance`
+// moves the splitters online (by means of `join` and `split`) while
+// holding the locks of all shards. The splitters are read while they may be
+// written, hence they are kept in atomics and versioned by a sequence
+// counter, s.t. a search observes one consistent set of splitters. This
+// requires trivially copyable keys.
+template <
+    typename T, typename Tag = void,
+    typename GetKeyForValue = get_key_for_value<T>,
+    typename Compare = std::less<T>,
+    size_t N = 16>
+class sharded_rbtree : public GetKeyForValue, public Compare {
+public:
+    using tree_type = rbtree<T, Tag, GetKeyForValue, Compare>;
+    using value_type = T;
+    using key_type = typename tree_type::key_type;
+
+private:
+    static_assert(N >= 1, "`sharded_rbtree` requires at least one shard.");
+    static_assert(
+        std::is_trivially_copyable_v<key_type>,
+        "`sharded_rbtree` requires trivially copyable keys.");
+
+    struct alignas(64) shard {
+        mutable std::mutex mutex;
+        std::atomic<size_t> size{0};
+        tree_type tree;
+    };
+
+    // Odd while `rebalance` writes the splitters.
+    alignas(64) std::atomic<uint64_t> version_{0};
+    std::array<std::atomic<key_type>, N - 1> splitters_;
+    std::array<shard, N> shards_;
+
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return (*static_cast<const Compare*>(this))(key0, key1);
+    }
+
+    const key_type& to_key(const value_type& value) const noexcept
+    {
+        return (*static_cast<const GetKeyForValue*>(this))(value);
+    }
+
+    template <typename Elem>
+    static auto& sorted_value(Elem&& elem) noexcept
+    {
+        if constexpr (std::is_pointer_v<std::decay_t<Elem>>)
+            return *elem;
+        else
+            return elem;
+    }
+
+    key_type splitter(size_t i) const noexcept
+    {
+        return splitters_[i].load(std::memory_order_relaxed);
+    }
+
+    // Returns the shard for `key` and the version of the splitters it was
+    // found with.
+    template <typename Key>
+    std::pair<size_t, uint64_t> shard_for(const Key& key) const noexcept
+    {
+        for (;;) {
+            uint64_t version = version_.load(std::memory_order_acquire);
+            if (version & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            size_t low = 0;
+            size_t high = N - 1;
+            while (low < high) {
+                size_t mid = low + (high - low) / 2;
+                if (is_less_than(key, splitter(mid)))
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version_.load(std::memory_order_relaxed) == version)
+                return { low, version };
+        }
+    }
+
+    // Requires the lock of shard `i` to be held, which keeps the
+    // splitters.
+    template <typename Key>
+    bool is_in_shard(size_t i, const Key& key) const noexcept
+    {
+        return (i == 0 || !is_less_than(key, splitter(i - 1)))
+            && (i == N - 1 || is_less_than(key, splitter(i)));
+    }
+
+    // Invokes `fn(shard)` with the shard for `key` locked.
+    template <typename Self, typename Key, typename Fn>
+    static decltype(auto) with_shard_for(Self* self, const Key& key, Fn fn)
+    {
+        for (;;) {
+            auto [i, version] = self->shard_for(key);
+            std::lock_guard<std::mutex> lock(self->shards_[i].mutex);
+            // Otherwise, a concurrent `rebalance` moved the splitters.
+            if (self->version_.load(std::memory_order_relaxed) == version)
+                return fn(self->shards_[i]);
+        }
+    }
+
+    // Invokes `fn(shard, first, mid)` on the consecutive runs of the sorted
+    // range [`first`, `last`) that belong to the same shard, where
+    // `key_of(*it)` returns the key of an entry of the range.
+    template <typename ForwardIt, typename KeyOf, typename Fn>
+    void for_each_run(ForwardIt first, ForwardIt last, KeyOf key_of, Fn fn)
+    {
+        if (first == last)
+            return;
+
+        // The shard found is only a hint, the runs are checked against the
+        // splitters with the shard locked.
+        size_t i = shard_for(key_of(*first)).first;
+        while (first != last) {
+            std::lock_guard<std::mutex> lock(shards_[i].mutex);
+            if (i > 0 && is_less_than(key_of(*first), splitter(i - 1))) {
+                --i;
+                continue;
+            }
+
+            ForwardIt mid = first;
+            while (mid != last && is_in_shard(i, key_of(*mid)))
+                ++mid;
+
+            fn(shards_[i], first, mid);
+            first = mid;
+            ++i;
+        }
+    }
+
+public:
+    // Creates a tree with all splitters set to `key_type()`. Call
+    // `rebalance` once the tree is populated.
+    explicit sharded_rbtree(
+        const GetKeyForValue& get_key = GetKeyForValue(),
+        const Compare& compare = Compare())
+        : GetKeyForValue(get_key)
+        , Compare(compare)
+    {
+        for (auto& splitter : splitters_)
+            splitter.store(key_type(), std::memory_order_relaxed);
+        for (shard& s : shards_)
+            s.tree = tree_type(get_key, compare);
+    }
+
+    // Creates a tree with the `N - 1` sorted splitters in [`first`,
+    // `last`).
+    template <typename InputIt>
+    sharded_rbtree(
+        InputIt first, InputIt last,
+        const GetKeyForValue& get_key = GetKeyForValue(),
+        const Compare& compare = Compare())
+        : sharded_rbtree(get_key, compare)
+    {
+        size_t i = 0;
+        for (; first != last; ++first, ++i) {
+            assert(i < N - 1);
+            assert(i == 0 || !is_less_than(*first, splitter(i - 1)));
+            splitters_[i].store(*first, std::memory_order_relaxed);
+        }
+        assert(i == N - 1);
+    }
+
+    sharded_rbtree(const sharded_rbtree&) = delete;
+    sharded_rbtree& operator=(const sharded_rbtree&) = delete;
+
+    static constexpr size_t shard_count() noexcept
+    {
+        return N;
+    }
+
+    // Returns the number of elements. Note, the result is only exact if
+    // there are no concurrent modifications.
+    size_t size() const noexcept
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < N; ++i)
+            n += shards_[i].size.load(std::memory_order_relaxed);
+        return n;
+    }
+
+    size_t shard_size(size_t i) const noexcept
+    {
+        assert(i < N);
+        return shards_[i].size.load(std::memory_order_relaxed);
+    }
+
+    template <typename Key>
+    bool contains(const Key& key) const
+    {
+        return with_shard_for(this, key, [&](const shard& s) {
+            return s.tree.contains(key);
+        });
+    }
+
+    // Note, the returned element may only be accessed as long as it is not
+    // erased concurrently.
+    template <typename Key>
+    value_type* find(const Key& key) const
+    {
+        return with_shard_for(this, key, [&](const shard& s) -> value_type* {
+            auto it = s.tree.find(key);
+            return it == s.tree.end() ? nullptr : const_cast<value_type*>(&*it);
+        });
+    }
+
+    std::pair<value_type*, bool> insert(value_type& value)
+    {
+        return with_shard_for(this, to_key(value), [&](shard& s) {
+            auto [it, inserted] = s.tree.insert(value);
+            if (inserted)
+                s.size.fetch_add(1, std::memory_order_relaxed);
+            return std::make_pair(&*it, inserted);
+        });
+    }
+
+    template <typename Key>
+    value_type* erase(const Key& key)
+    {
+        return with_shard_for(this, key, [&](shard& s) {
+            value_type* value = s.tree.erase(key);
+            if (value)
+                s.size.fetch_sub(1, std::memory_order_relaxed);
+            return value;
+        });
+    }
+
+    // Same as `rbtree::insert_batch_sorted`. Each shard is locked once for
+    // its share of the range.
+    template <typename ForwardIt>
+    size_t insert_batch_sorted(ForwardIt first, ForwardIt last)
+    {
+        auto key_of = [&](auto&& elem) -> const key_type& {
+            return to_key(sorted_value(elem));
+        };
+
+        size_t count = 0;
+        for_each_run(first, last, key_of, [&](
+                shard& s, ForwardIt f, ForwardIt l) {
+            size_t n = s.tree.insert_batch_sorted(f, l);
+            s.size.fetch_add(n, std::memory_order_relaxed);
+            count += n;
+        });
+        return count;
+    }
+
+    // Same as `rbtree::erase_batch_sorted`. Each shard is locked once for
+    // its share of the range.
+    template <typename ForwardIt, typename Disposer>
+    size_t erase_batch_sorted(
+        ForwardIt first, ForwardIt last, Disposer disposer)
+    {
+        auto key_of = [](const auto& key) -> const auto& { return key; };
+
+        size_t count = 0;
+        for_each_run(first, last, key_of, [&](
+                shard& s, ForwardIt f, ForwardIt l) {
+            size_t n = s.tree.erase_batch_sorted(f, l, disposer);
+            s.size.fetch_sub(n, std::memory_order_relaxed);
+            count += n;
+        });
+        return count;
+    }
+
+    template <typename ForwardIt>
+    size_t erase_batch_sorted(ForwardIt first, ForwardIt last)
+    {
+        return erase_batch_sorted(first, last, [](value_type*) {});
+    }
+
+    // Invokes `fn(tree)` on the tree of shard `i` with its lock held. `fn`
+    // must not move elements out of the key range of the shard and must
+    // not change the number of elements.
+    template <typename Fn>
+    decltype(auto) with_shard(size_t i, Fn&& fn)
+    {
+        assert(i < N);
+        std::lock_guard<std::mutex> lock(shards_[i].mutex);
+        return std::forward<Fn>(fn)(shards_[i].tree);
+    }
+
+    // Invokes `fn` on the elements in order as long as `fn` returns true.
+    // Only one shard is locked at a time. Hence, elements inserted, erased
+    // or moved by `rebalance` during the iteration may or may not be
+    // visited.
+    template <typename Fn>
+    void for_each(Fn&& fn) const
+    {
+        for (size_t i = 0; i < N; ++i) {
+            std::lock_guard<std::mutex> lock(shards_[i].mutex);
+            for (const value_type& value : shards_[i].tree)
+                if (!fn(value))
+                    return;
+        }
+    }
+
+    // Moves the splitters, s.t. all shards hold (about) the same number of
+    // elements. Runs in O(n) to find the new splitters, plus O(N log n) to
+    // join all shards and split them up again.
+    void rebalance()
+    {
+        std::array<std::unique_lock<std::mutex>, N> locks;
+        for (size_t i = 0; i < N; ++i)
+            locks[i] = std::unique_lock<std::mutex>(shards_[i].mutex);
+
+        size_t total = size();
+        if (total == 0)
+            return;
+
+        // Shard b + 1 starts with the element at position total * (b + 1)
+        // / N.
+        auto quantile = [&](size_t b) { return total * b / N; };
+        std::array<key_type, N - 1> splitters;
+        size_t index = 0;
+        size_t b = 0;
+        for (size_t i = 0; i < N && b < N - 1; ++i) {
+            for (const value_type& value : shards_[i].tree) {
+                while (b < N - 1 && index == quantile(b + 1))
+                    splitters[b++] = to_key(value);
+                if (b == N - 1)
+                    break;
+                ++index;
+            }
+        }
+
+        uint64_t version = version_.load(std::memory_order_relaxed);
+        version_.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < N - 1; ++i)
+            splitters_[i].store(splitters[i], std::memory_order_relaxed);
+        version_.store(version + 2, std::memory_order_release);
+
+        tree_type all = std::move(shards_[0].tree);
+        for (size_t i = 1; i < N; ++i)
+            all = tree_type::join(std::move(all), std::move(shards_[i].tree));
+
+        for (size_t i = N - 1; i > 0; --i) {
+            const key_type& splitter = splitters[i - 1];
+            tree_type high = all.split(splitter);
+            if (value_type* value = all.erase(splitter))
+                high.insert(*value);
+            shards_[i].tree = std::move(high);
+            shards_[i].size = quantile(i + 1) - quantile(i);
+        }
+        shards_[0].tree = std::move(all);
+        shards_[0].size = quantile(1);
+    }
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// -- frozen index -----------------------------------------------------------
+
+// A read-only index over the elements of an `rbtree`, built in O(n) by one
+// in-order pass. The keys are copied into an array in a cache-friendly
+// order, next to pointers back to the (intrusive) elements, s.t. a lookup
+// touches about one cache line per level and no element until it found
+// its position. The elements must outlive the index, and their keys must
+// not change while it is used.
+//
+// Arithmetic keys compared by `std::less` are kept in a static B-tree of
+// cache-line sized blocks, which is searched by counting the keys in a
+// block that precede the searched key. This loop has no branches and is
+// vectorized by the compiler. All other keys are kept in Eytzinger order
+// (i.e., the breadth-first order of a complete binary tree), which is
+// searched without branches while prefetching the levels below.
+//
+// If the key is the element itself, only the pointers are kept, i.e.,
+// each level touches an element. `T` may be const-qualified to build an
+// index from a const tree.
+template <
+    typename T,
+    typename GetKeyForValue = get_key_for_value<std::remove_const_t<T>>,
+    typename Compare = std::less<std::remove_const_t<T>>>
+class frozen_index : public GetKeyForValue, public Compare {
+public:
+    using value_type = T;
+    using key_type = typename GetKeyForValue::key_type;
+
+private:
+    static constexpr bool is_blocked = std::is_arithmetic_v<key_type>
+        && (std::is_same_v<Compare, std::less<key_type>>
+            || std::is_same_v<Compare, std::less<>>);
+
+    static constexpr bool stores_keys =
+        !std::is_same_v<key_type, std::remove_const_t<T>>;
+
+    static constexpr size_t block_size =
+        64 / sizeof(key_type) > 1 ? 64 / sizeof(key_type) : 2;
+
+    struct alignas(64) block {
+        key_type keys[block_size];
+    };
+
+    // The keys in Eytzinger order, where the children of the `k`-th key
+    // (1-based) are the `2k`-th and `2k + 1`-th key. Empty unless
+    // `stores_keys`.
+    std::vector<key_type> keys_;
+
+    // The keys in blocks, where the children of the `k`-th block (0-based)
+    // are the blocks `k * (block_size + 1) + i + 1` for i in [0,
+    // `block_size`]. The last block is padded with the greatest key.
+    std::vector<block> blocks_;
+
+    // The elements, in the same order as the keys.
+    std::vector<value_type*> values_;
+
+    size_t size_ = 0;
+
+private:
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return (*static_cast<const Compare*>(this))(key0, key1);
+    }
+
+    const key_type& to_key(const value_type& value) const noexcept
+    {
+        return (*static_cast<const GetKeyForValue*>(this))(value);
+    }
+
+    template <typename It>
+    void build_eytzinger(size_t k, It& it)
+    {
+        if (k > size_)
+            return;
+        build_eytzinger(2 * k, it);
+        values_[k - 1] = &*it;
+        ++it;
+        build_eytzinger(2 * k + 1, it);
+    }
+
+    template <typename It>
+    void build_blocked(size_t k, It& it, size_t& i, value_type* last)
+    {
+        if (k >= blocks_.size())
+            return;
+        for (size_t j = 0; j < block_size; ++j) {
+            build_blocked(k * (block_size + 1) + j + 1, it, i, last);
+
+            value_type* x = i++ < size_ ? &*it++ : last;
+            blocks_[k].keys[j] = to_key(*x);
+            values_[k * block_size + j] = x;
+        }
+        build_blocked(k * (block_size + 1) + block_size + 1, it, i, last);
+    }
+
+    // Returns the `k`-th key (1-based) in Eytzinger order.
+    const key_type& eytzinger_key(size_t k) const noexcept
+    {
+        if constexpr (stores_keys)
+            return keys_[k - 1];
+        else
+            return to_key(*values_[k - 1]);
+    }
+
+    // Returns the first element for which `precedes(key)` is false, or
+    // null, where `precedes` must be true for a prefix of the elements.
+    template <typename Precedes>
+    value_type* partition_point(Precedes&& precedes) const noexcept
+    {
+        if constexpr (is_blocked) {
+            size_t found = values_.size();
+            for (size_t k = 0; k < blocks_.size();) {
+                const key_type* keys = blocks_[k].keys;
+                size_t i = 0;
+                for (size_t j = 0; j < block_size; ++j)
+                    i += precedes(keys[j]);
+                if (i < block_size)
+                    found = k * block_size + i;
+                k = k * (block_size + 1) + i + 1;
+            }
+            return found < values_.size() ? values_[found] : nullptr;
+        } else {
+            // The keys 4 levels below `k` are 16 consecutive keys starting
+            // at the `16k`-th key.
+            size_t k = 1;
+            while (k <= size_) {
+                if (16 * k <= size_) {
+                    if constexpr (stores_keys)
+                        rbtree_prefetch(&keys_[16 * k - 1]);
+                    else
+                        rbtree_prefetch(&values_[16 * k - 1]);
+                }
+                k = 2 * k + precedes(eytzinger_key(k));
+            }
+
+            // Undo the right turns after the last left turn, which leads
+            // back to the key where the descent last went left.
+            while (k & 1)
+                k >>= 1;
+            k >>= 1;
+            return k ? values_[k - 1] : nullptr;
+        }
+    }
+
+public:
+    frozen_index() noexcept = default;
+
+    // Builds the index from the elements of `tree`, which must be ordered
+    // by `get_key` and `compare`.
+    template <typename Tree>
+    explicit frozen_index(
+        Tree& tree, GetKeyForValue get_key = GetKeyForValue(),
+        Compare compare = Compare())
+        : GetKeyForValue(std::move(get_key)), Compare(std::move(compare))
+        , size_(size_t(std::distance(tree.begin(), tree.end())))
+    {
+        if (size_ == 0)
+            return;
+
+        auto it = tree.begin();
+        if constexpr (is_blocked) {
+            size_t count = (size_ + block_size - 1) / block_size;
+            blocks_.resize(count);
+            values_.resize(count * block_size);
+
+            size_t i = 0;
+            value_type* last = &*std::prev(tree.end());
+            build_blocked(0, it, i, last);
+        } else {
+            values_.resize(size_);
+            build_eytzinger(1, it);
+            if constexpr (stores_keys) {
+                keys_.reserve(size_);
+                for (value_type* x : values_)
+                    keys_.push_back(to_key(*x));
+            }
+        }
+        assert(it == tree.end());
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // -- lookup -------------------------------------------------------------
+
+    // Returns the first element whose key is not less than `key`, or null.
+    // As for `rbtree`, keys of other types than `key_type` require a
+    // transparent `Compare`.
+    value_type* lower_bound(const key_type& key) const noexcept
+    {
+        return lower_bound_helper(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    value_type* lower_bound(const Key& key) const noexcept
+    {
+        return lower_bound_helper(key);
+    }
+
+    // Returns the first element whose key is greater than `key`, or null.
+    value_type* upper_bound(const key_type& key) const noexcept
+    {
+        return upper_bound_helper(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    value_type* upper_bound(const Key& key) const noexcept
+    {
+        return upper_bound_helper(key);
+    }
+
+    value_type* find(const key_type& key) const noexcept
+    {
+        return find_helper(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    value_type* find(const Key& key) const noexcept
+    {
+        return find_helper(key);
+    }
+
+    bool contains(const key_type& key) const noexcept
+    {
+        return find_helper(key) != nullptr;
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    bool contains(const Key& key) const noexcept
+    {
+        return find_helper(key) != nullptr;
+    }
+
+private:
+    template <typename Key>
+    value_type* lower_bound_helper(const Key& key) const noexcept
+    {
+        return partition_point([&](const key_type& x) {
+            return is_less_than(x, key);
+        });
+    }
+
+    template <typename Key>
+    value_type* upper_bound_helper(const Key& key) const noexcept
+    {
+        return partition_point([&](const key_type& x) {
+            return !is_less_than(key, x);
+        });
+    }
+
+    template <typename Key>
+    value_type* find_helper(const Key& key) const noexcept
+    {
+        value_type* x = lower_bound_helper(key);
+        if (!x || is_less_than(key, to_key(*x)))
+            return nullptr;
+        return x;
+    }
+};
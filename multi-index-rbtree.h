@@ -0,0 +1,209 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <tuple>
+#include <utility>
+
+// -- multi-index red-black tree ---------------------------------------------
+
+// Describes one index of a `multi_index_rbtree`, i.e., an
+// `rbtree<T, Tag, GetKeyForValue, Compare, Augment>` linking the elements
+// by their `rbtree_node<Tag>` base.
+template <
+    typename Tag, typename GetKeyForValue,
+    typename Compare = std::less<typename GetKeyForValue::key_type>,
+    typename Augment = rbtree_no_augment>
+struct rbtree_index {
+    template <typename T>
+    using tree_type = rbtree<T, Tag, GetKeyForValue, Compare, Augment>;
+};
+
+// Keeps the elements in several trees at once, one per index, e.g.
+//
+//     struct Job : rbtree_node<by_id>, rbtree_node<by_time> { ... };
+//     multi_index_rbtree<Job,
+//         rbtree_index<by_id, get_id>,
+//         rbtree_index<by_time, get_time>> jobs;
+//
+// An element is either part of all trees or of none. Each modification
+// first searches all trees, which only reads the key of the element, and
+// then links resp. unlinks the element in all trees in a row, s.t. its
+// hooks are brought into the cache once. Since nothing is modified before
+// all searches succeeded, an insertion which is rejected by one of the
+// trees leaves all trees unchanged.
+//
+// The trees are accessible by `get<I>()` for lookups; elements must only be
+// inserted or erased through the facade.
+template <typename T, typename... Indexes>
+class multi_index_rbtree {
+    static_assert(sizeof...(Indexes) > 0, "At least one index is required.");
+
+    static constexpr size_t index_count = sizeof...(Indexes);
+
+    using trees_type = std::tuple<typename Indexes::template tree_type<T>...>;
+
+    using indices = std::index_sequence_for<Indexes...>;
+
+    trees_type trees_;
+
+private:
+    template <size_t I>
+    auto find_insert_position(T& value, bool search) noexcept
+    {
+        using position_type = decltype(
+            rbtree_access::find_insert_position(std::get<I>(trees_), value));
+        if (!search)
+            return position_type();
+        return rbtree_access::find_insert_position(std::get<I>(trees_), value);
+    }
+
+    // Links `value` into the trees with `relink[I]` set, or returns false
+    // without modifying any tree if one of them contains an equal key.
+    template <size_t... I>
+    bool link_all(
+        T& value, const std::array<bool, index_count>& relink,
+        std::index_sequence<I...>) noexcept
+    {
+        auto positions = std::make_tuple(
+            find_insert_position<I>(value, relink[I])...);
+        if (((relink[I] && std::get<I>(positions).existing) || ...))
+            return false;
+
+        ((relink[I] ? rbtree_access::link(std::get<I>(trees_),
+            std::get<I>(positions), value) : void()), ...);
+        return true;
+    }
+
+    template <size_t... I>
+    void unlink_all(
+        T& value, const std::array<bool, index_count>& unlink,
+        std::index_sequence<I...>) noexcept
+    {
+        ((unlink[I] ? rbtree_access::unlink(std::get<I>(trees_), value)
+            : void()), ...);
+    }
+
+    template <size_t... I>
+    std::array<bool, index_count> out_of_order(
+        T& value, std::index_sequence<I...>) noexcept
+    {
+        return { !rbtree_access::is_in_order(std::get<I>(trees_), value)... };
+    }
+
+    static std::array<bool, index_count> all() noexcept
+    {
+        std::array<bool, index_count> rv;
+        rv.fill(true);
+        return rv;
+    }
+
+    template <typename Fn, typename Rollback>
+    bool modify_helper(T& value, Fn& fn, Rollback* rollback) noexcept
+    {
+        fn(value);
+
+        // Only the trees in which `value` is out of order for its new keys
+        // are modified.
+        std::array<bool, index_count> relink = out_of_order(value, indices());
+        unlink_all(value, relink, indices());
+        if (link_all(value, relink, indices()))
+            return true;
+
+        std::array<bool, index_count> linked;
+        for (size_t i = 0; i < index_count; ++i)
+            linked[i] = !relink[i];
+
+        // The trees which still link `value` did not need to move it, hence
+        // its previous keys are in order there, too.
+        if (rollback) {
+            (*rollback)(value);
+            [[maybe_unused]] bool ok = link_all(value, relink, indices());
+            assert(ok && "`rollback` must restore a unique key.");
+        } else {
+            unlink_all(value, linked, indices());
+        }
+        return false;
+    }
+
+public:
+    using value_type = T;
+
+    template <size_t I>
+    using tree_type = std::tuple_element_t<I, trees_type>;
+
+    multi_index_rbtree() = default;
+
+    template <size_t I>
+    tree_type<I>& get() noexcept
+    {
+        return std::get<I>(trees_);
+    }
+
+    template <size_t I>
+    const tree_type<I>& get() const noexcept
+    {
+        return std::get<I>(trees_);
+    }
+
+    bool empty() const noexcept
+    {
+        return std::get<0>(trees_).empty();
+    }
+
+    // Inserts `value` into all trees and returns true, or returns false if
+    // one of them contains an element with an equal key, in which case no
+    // tree is modified.
+    bool insert(T& value) noexcept
+    {
+        rbtree_prefetch(&value);
+        return link_all(value, all(), indices());
+    }
+
+    // Erases `value`, which must be part of the trees, from all trees.
+    void erase(T& value) noexcept
+    {
+        unlink_all(value, all(), indices());
+    }
+
+    // Modifies the keys of `value` by `fn(value)` and moves `value` to its
+    // new position in each tree whose order changed. Trees in which
+    // `value` is still between its neighbors are not modified. If one of
+    // the trees contains an element with an equal key, `rollback(value)` is
+    // invoked, which must restore the previous keys, and `value` is put
+    // back into all trees. Returns true if the modification succeeded.
+    // Neither `fn` nor `rollback` may throw.
+    template <typename Fn, typename Rollback>
+    bool modify(T& value, Fn fn, Rollback rollback) noexcept
+    {
+        return modify_helper(value, fn, &rollback);
+    }
+
+    // Same as above, but `value` is erased from all trees if the
+    // modification fails.
+    template <typename Fn>
+    bool modify(T& value, Fn fn) noexcept
+    {
+        return modify_helper(value, fn, static_cast<Fn*>(nullptr));
+    }
+
+    // Unlinks all elements as by `rbtree::clear()`.
+    void clear() noexcept
+    {
+        std::apply([](auto&... trees) { (trees.clear(), ...); }, trees_);
+    }
+
+    // Unlinks all elements and invokes `disposer` on each of them.
+    template <typename Disposer>
+    void clear_and_dispose(Disposer disposer)
+    {
+        std::apply([&](auto& first, auto&... rest) {
+            (rest.clear(), ...);
+            first.clear_and_dispose(disposer);
+        }, trees_);
+    }
+};
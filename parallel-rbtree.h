@@ -0,0 +1,345 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// -- executors --------------------------------------------------------------
+
+// The parallel algorithms below hand tasks to an executor, i.e., a callable
+// invoked as `executor(task)`, which runs the nullary `task` on some thread
+// (possibly the calling one). The algorithms wait for their tasks
+// themselves.
+
+// Runs the tasks on a pool of up to `max_threads` threads, which are
+// started on demand, reused by later tasks and joined once the executor is
+// destroyed. Hence, an executor kept across several algorithms starts its
+// threads only once.
+class rbtree_thread_executor {
+    struct pool {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::deque<std::function<void()>> tasks;
+        std::vector<std::thread> threads;
+        size_t max_threads;
+        size_t idle = 0;
+        bool stop = false;
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;) {
+                ++idle;
+                wake.wait(lock, [&] { return stop || !tasks.empty(); });
+                --idle;
+                if (tasks.empty())
+                    return;
+
+                std::function<void()> task = std::move(tasks.front());
+                tasks.pop_front();
+                lock.unlock();
+                task();
+                lock.lock();
+            }
+        }
+    };
+
+    std::unique_ptr<pool> pool_;
+
+public:
+    rbtree_thread_executor()
+        : rbtree_thread_executor(std::thread::hardware_concurrency())
+    {}
+
+    explicit rbtree_thread_executor(size_t max_threads)
+        : pool_(std::make_unique<pool>())
+    {
+        pool_->max_threads = max_threads ? max_threads : 1;
+    }
+
+    rbtree_thread_executor(rbtree_thread_executor&&) noexcept = default;
+
+    ~rbtree_thread_executor()
+    {
+        if (!pool_)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(pool_->mutex);
+            pool_->stop = true;
+        }
+        pool_->wake.notify_all();
+        for (std::thread& thread : pool_->threads)
+            thread.join();
+    }
+
+    // Note, an exception escaping `task` terminates the program. (The tasks
+    // of the algorithms below catch their exceptions.)
+    template <typename Task>
+    void operator()(Task&& task)
+    {
+        std::lock_guard<std::mutex> lock(pool_->mutex);
+        // Starts a thread first, s.t. the task is not queued if that fails.
+        if (pool_->idle <= pool_->tasks.size()
+            && pool_->threads.size() < pool_->max_threads)
+        {
+            pool_->threads.emplace_back([p = pool_.get()] { p->run(); });
+        }
+        pool_->tasks.emplace_back(std::forward<Task>(task));
+        pool_->wake.notify_one();
+    }
+};
+
+// Runs each task on the calling thread.
+struct rbtree_inline_executor {
+    template <typename Task>
+    void operator()(Task&& task) const
+    {
+        std::forward<Task>(task)();
+    }
+};
+
+inline size_t rbtree_default_concurrency() noexcept
+{
+    size_t n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+namespace rbtree_parallel_detail {
+
+// Each worker gets this many chunks on average, s.t. workers which finish
+// early take over the chunks of slower ones.
+constexpr size_t chunks_per_worker = 4;
+
+// Collects the nodes of the top `depth` levels below `x` in order.
+template <typename Node>
+void collect_top(Node* x, size_t depth, std::vector<Node*>& out)
+{
+    if (!x || depth == 0)
+        return;
+    collect_top(rbtree_access::left(x), depth - 1, out);
+    out.push_back(x);
+    collect_top(rbtree_access::right(x), depth - 1, out);
+}
+
+// Splits `tree` into about `chunks` consecutive ranges. Returns their
+// boundaries in order, starting with `tree.begin()` and ending with
+// `tree.end()`. With counted nodes, the ranges hold the same number of
+// elements (+/- 1). Otherwise, the tree is cut at the nodes of its top
+// levels, i.e., each range holds a subtree below those levels.
+template <typename Tree>
+auto split_points(Tree& tree, size_t chunks)
+{
+    using iterator = decltype(tree.begin());
+    std::vector<iterator> points;
+    points.push_back(tree.begin());
+
+    if constexpr (rbtree_access::is_counted<Tree>) {
+        size_t n = tree.size();
+        chunks = std::min(chunks, n);
+        for (size_t i = 1; i < chunks; ++i)
+            points.push_back(tree.nth(n * i / chunks));
+    } else {
+        size_t depth = 0;
+        while ((size_t(1) << depth) < chunks)
+            ++depth;
+
+        using node_pointer = decltype(rbtree_access::root(tree));
+        std::vector<node_pointer> top;
+        collect_top(rbtree_access::root(tree), depth, top);
+        for (node_pointer x : top)
+            points.push_back(iterator(x));
+    }
+
+    points.push_back(tree.end());
+    return points;
+}
+
+// Invokes `fn(i)` for all i in [0, `count`) on up to `concurrency` workers,
+// one of which is the calling thread. Returns once all calls are done and
+// rethrows the first exception thrown by `fn` (or by `executor`). No task
+// handed to `executor` outlives the call.
+template <typename Fn, typename Executor>
+void run_chunks(size_t count, Fn& fn, Executor& executor, size_t concurrency)
+{
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t running = 0;
+    std::exception_ptr error;
+
+    auto work = [&] {
+        try {
+            size_t i;
+            while ((i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+                fn(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            next.store(count, std::memory_order_relaxed);
+        }
+    };
+
+    auto wait = [&] {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return running == 0; });
+    };
+
+    size_t workers = std::min(concurrency, count);
+    try {
+        for (size_t w = 1; w < workers; ++w) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running++;
+            }
+            try {
+                executor([&] {
+                    work();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (--running == 0)
+                        done.notify_one();
+                });
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                running--;
+                throw;
+            }
+        }
+    } catch (...) {
+        // Stops the tasks already started and waits for them, as they
+        // refer to the state above.
+        next.store(count, std::memory_order_relaxed);
+        wait();
+        throw;
+    }
+
+    work();
+
+    wait();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+}
+
+// -- parallel algorithms ----------------------------------------------------
+
+// Invokes `fn` on all elements of `tree`, where disjoint ranges of the tree
+// are processed concurrently by the tasks handed to `executor`. Within a
+// range, `fn` is invoked in order. The tree must not be modified meanwhile.
+template <
+    typename Tree, typename Fn,
+    typename Executor = rbtree_thread_executor>
+void parallel_for_each(
+    Tree& tree, Fn fn, Executor&& executor = Executor(),
+    size_t concurrency = rbtree_default_concurrency())
+{
+    using namespace rbtree_parallel_detail;
+
+    auto points = split_points(tree, concurrency * chunks_per_worker);
+    auto chunk = [&](size_t i) {
+        for (auto it = points[i]; it != points[i + 1]; ++it)
+            fn(*it);
+    };
+    run_chunks(points.size() - 1, chunk, executor, concurrency);
+}
+
+// Reduces the elements of `tree` in key order. Consecutive ranges of the
+// tree are folded concurrently, each as `acc = fold(std::move(acc), value)`
+// starting from `init` (hence, `init` should be neutral). The results of
+// the ranges are then combined in key order as `combine(std::move(lhs),
+// std::move(rhs))`. Given an associative `combine`, the result does not
+// depend on how the tree is split up.
+template <
+    typename Tree, typename Result, typename Fold, typename Combine,
+    typename Executor = rbtree_thread_executor>
+Result parallel_reduce(
+    Tree& tree, Result init, Fold fold, Combine combine,
+    Executor&& executor = Executor(),
+    size_t concurrency = rbtree_default_concurrency())
+{
+    using namespace rbtree_parallel_detail;
+
+    auto points = split_points(tree, concurrency * chunks_per_worker);
+    std::vector<Result> results(points.size() - 1, init);
+    auto chunk = [&](size_t i) {
+        Result acc = std::move(results[i]);
+        for (auto it = points[i]; it != points[i + 1]; ++it)
+            acc = fold(std::move(acc), *it);
+        results[i] = std::move(acc);
+    };
+    run_chunks(results.size(), chunk, executor, concurrency);
+
+    Result rv = std::move(results[0]);
+    for (size_t i = 1; i < results.size(); ++i)
+        rv = combine(std::move(rv), std::move(results[i]));
+    return rv;
+}
+
+namespace rbtree_parallel_detail {
+
+// Returns the number of top levels to split a tree at, s.t. there are
+// enough subtrees below them for `concurrency` workers.
+inline size_t split_depth(size_t concurrency) noexcept
+{
+    size_t depth = 0;
+    while ((size_t(1) << depth) < concurrency * chunks_per_worker)
+        ++depth;
+    return depth;
+}
+
+}
+
+// Same as `tree.clone(cloner, disposer)`, but the subtrees below the top
+// levels of the tree are cloned concurrently by the tasks handed to
+// `executor` and then linked below the copies of the top levels. Hence,
+// `cloner` must be safe to call concurrently. The tree must not be modified
+// meanwhile.
+template <
+    typename Tree, typename Cloner, typename Disposer,
+    typename Executor = rbtree_thread_executor>
+auto parallel_clone(
+    const Tree& tree, Cloner cloner, Disposer disposer,
+    Executor&& executor = Executor(),
+    size_t concurrency = rbtree_default_concurrency())
+{
+    using namespace rbtree_parallel_detail;
+
+    auto run = [&](size_t count, auto& fn) {
+        run_chunks(count, fn, executor, concurrency);
+    };
+    return rbtree_access::clone(
+        tree, cloner, disposer, split_depth(concurrency), run);
+}
+
+// Same as `tree.clear_and_dispose(disposer)`, but the subtrees below the
+// top levels of the tree are disposed of concurrently by the tasks handed
+// to `executor`. Hence, `disposer` must be safe to call concurrently.
+template <
+    typename Tree, typename Disposer,
+    typename Executor = rbtree_thread_executor>
+void parallel_clear_and_dispose(
+    Tree& tree, Disposer disposer, Executor&& executor = Executor(),
+    size_t concurrency = rbtree_default_concurrency())
+{
+    using namespace rbtree_parallel_detail;
+
+    auto run = [&](size_t count, auto& fn) {
+        run_chunks(count, fn, executor, concurrency);
+    };
+    rbtree_access::clear_and_dispose(
+        tree, disposer, split_depth(concurrency), run);
+}
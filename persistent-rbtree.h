@@ -0,0 +1,501 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+// -- persistent red-black tree ----------------------------------------------
+
+// A red-black tree with O(1) snapshots. Nodes are shared between versions
+// and reference counted. A mutation copies only the nodes it modifies,
+// i.e., its root-to-leaf path plus the siblings recolored or rotated by the
+// rebalancing, while all other nodes stay shared. Nodes reachable from more
+// than one version are immutable, hence a snapshot can be read from any
+// thread without synchronizing with the writer of the live version, and is
+// kept alive until it is released (i.e., destructed).
+//
+// As a node may belong to several versions, it can not point to a parent.
+// Unlike `rbtree`, this tree therefore owns copies of its values and keeps
+// the path from the root in a stack while rebalancing. Each version must
+// only be used by one thread at a time, but distinct versions may be used
+// (and released) concurrently.
+template <
+    typename T,
+    typename GetKeyForValue = get_key_for_value<T>,
+    typename Compare = std::less<T>>
+class persistent_rbtree : public GetKeyForValue, public Compare {
+public:
+    using value_type = T;
+    using key_type = typename GetKeyForValue::key_type;
+
+private:
+    struct node {
+        std::atomic<size_t> refs{1};
+        node* left = nullptr;
+        node* right = nullptr;
+        bool red = true;
+        value_type value;
+
+        template <typename... Args>
+        explicit node(Args&&... args) : value(std::forward<Args>(args)...)
+        {}
+    };
+
+    // A red-black tree of n nodes has a height of at most 2 log2(n + 1).
+    static constexpr size_t max_height = 2 * 64;
+
+    node* root_ = nullptr;
+    size_t size_ = 0;
+
+private:
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return (*static_cast<const Compare*>(this))(key0, key1);
+    }
+
+    const key_type& to_key(const node* x) const noexcept
+    {
+        return (*static_cast<const GetKeyForValue*>(this))(x->value);
+    }
+
+    static bool is_red(const node* x) noexcept
+    {
+        return x && x->red;
+    }
+
+    static node* retain(node* x) noexcept
+    {
+        if (x)
+            x->refs.fetch_add(1, std::memory_order_relaxed);
+        return x;
+    }
+
+    static void release(node* x) noexcept
+    {
+        if (x && x->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            release(x->left);
+            release(x->right);
+            delete x;
+        }
+    }
+
+    // Returns the node `link` points to, after replacing it by a copy if
+    // it is shared with another version. The owner of `link` must be
+    // exclusive to this version.
+    static node* make_unique(node*& link)
+    {
+        node* x = link;
+        if (x->refs.load(std::memory_order_acquire) == 1)
+            return x;
+
+        node* copy = new node(x->value);
+        copy->left = retain(x->left);
+        copy->right = retain(x->right);
+        copy->red = x->red;
+        link = copy;
+        release(x);
+        return copy;
+    }
+
+    // The path from the root to the node being rebalanced. All nodes on
+    // it are exclusive to this version.
+    struct path {
+        node* nodes[max_height + 1];
+        size_t size = 0;
+    };
+
+    // Returns the link pointing to the `i`-th node of `p`.
+    node*& link(path& p, size_t i) noexcept
+    {
+        if (i == 0)
+            return root_;
+        node* parent = p.nodes[i - 1];
+        return parent->left == p.nodes[i] ? parent->left : parent->right;
+    }
+
+    // Rotates `x` and its right child (which must be exclusive to this
+    // version) to the left and returns the new root of the subtree.
+    static node* rotate_left(node* x) noexcept
+    {
+        node* y = x->right;
+        x->right = y->left;
+        y->left = x;
+        return y;
+    }
+
+    static node* rotate_right(node* x) noexcept
+    {
+        node* y = x->left;
+        x->left = y->right;
+        y->right = x;
+        return y;
+    }
+
+    // Replaces the node at `p.nodes[i]`, which is linked to its parent, by
+    // the result of `rotate(p.nodes[i])`.
+    template <typename Rotate>
+    node* rotate_at(path& p, size_t i, Rotate rotate) noexcept
+    {
+        node*& l = link(p, i);
+        l = rotate(p.nodes[i]);
+        return l;
+    }
+
+    // Descends to `key` without copying any node. `p` receives the path up
+    // to (and including) the node with `key`, or up to the parent of the
+    // position of `key` if there is no such node.
+    template <typename Key>
+    bool descend(const Key& key, path& p) const
+    {
+        node* x = root_;
+        while (x) {
+            p.nodes[p.size++] = x;
+            if (is_less_than(key, to_key(x)))
+                x = x->left;
+            else if (is_less_than(to_key(x), key))
+                x = x->right;
+            else
+                return true;
+        }
+        return false;
+    }
+
+    // Replaces the nodes of `p` shared with other versions by copies, top
+    // down, s.t. each parent is exclusive before its link is rewritten.
+    void make_unique(path& p)
+    {
+        for (size_t i = 0; i < p.size; ++i)
+            p.nodes[i] = make_unique(link(p, i));
+    }
+
+    void insert_fixup(path& p)
+    {
+        size_t i = p.size - 1;
+
+        while (i >= 2 && p.nodes[i - 1]->red) {
+            node* parent = p.nodes[i - 1];
+            node* grandparent = p.nodes[i - 2];
+
+            if (parent == grandparent->left) {
+                if (is_red(grandparent->right)) {
+                    node* uncle = make_unique(grandparent->right);
+                    parent->red = false;
+                    uncle->red = false;
+                    grandparent->red = true;
+                    i -= 2;
+                    continue;
+                }
+
+                if (p.nodes[i] == parent->right) {
+                    rotate_at(p, i - 1, rotate_left);
+                    std::swap(p.nodes[i - 1], p.nodes[i]);
+                    parent = p.nodes[i - 1];
+                }
+
+                parent->red = false;
+                grandparent->red = true;
+                rotate_at(p, i - 2, rotate_right);
+            } else {
+                if (is_red(grandparent->left)) {
+                    node* uncle = make_unique(grandparent->left);
+                    parent->red = false;
+                    uncle->red = false;
+                    grandparent->red = true;
+                    i -= 2;
+                    continue;
+                }
+
+                if (p.nodes[i] == parent->left) {
+                    rotate_at(p, i - 1, rotate_right);
+                    std::swap(p.nodes[i - 1], p.nodes[i]);
+                    parent = p.nodes[i - 1];
+                }
+
+                parent->red = false;
+                grandparent->red = true;
+                rotate_at(p, i - 2, rotate_left);
+            }
+            break;
+        }
+
+        // The root is exclusive to this version, as it is either on the
+        // path or was rotated up from it.
+        root_->red = false;
+    }
+
+    // Restores the black-height after a black node was removed from below
+    // `p.nodes[i - 1]`, where `x` took its place (and may be null).
+    void erase_fixup(path& p, size_t i, node* x)
+    {
+        while (i > 0 && !is_red(x)) {
+            node* parent = p.nodes[i - 1];
+
+            if (x == parent->left) {
+                node* w = make_unique(parent->right);
+                if (w->red) {
+                    w->red = false;
+                    parent->red = true;
+                    rotate_at(p, i - 1, rotate_left);
+                    // `w` took the place of `parent` on the path.
+                    p.nodes[i - 1] = w;
+                    p.nodes[i] = parent;
+                    p.nodes[++i] = x;
+                    w = make_unique(parent->right);
+                }
+
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->red = true;
+                    x = parent;
+                    --i;
+                    continue;
+                }
+
+                if (!is_red(w->right)) {
+                    make_unique(w->left)->red = false;
+                    w->red = true;
+                    w = parent->right = rotate_right(w);
+                }
+
+                w->red = parent->red;
+                parent->red = false;
+                make_unique(w->right)->red = false;
+                rotate_at(p, i - 1, rotate_left);
+            } else {
+                node* w = make_unique(parent->left);
+                if (w->red) {
+                    w->red = false;
+                    parent->red = true;
+                    rotate_at(p, i - 1, rotate_right);
+                    p.nodes[i - 1] = w;
+                    p.nodes[i] = parent;
+                    p.nodes[++i] = x;
+                    w = make_unique(parent->left);
+                }
+
+                if (!is_red(w->left) && !is_red(w->right)) {
+                    w->red = true;
+                    x = parent;
+                    --i;
+                    continue;
+                }
+
+                if (!is_red(w->left)) {
+                    make_unique(w->right)->red = false;
+                    w->red = true;
+                    w = parent->left = rotate_left(w);
+                }
+
+                w->red = parent->red;
+                parent->red = false;
+                make_unique(w->left)->red = false;
+                rotate_at(p, i - 1, rotate_right);
+            }
+            x = root_;
+            break;
+        }
+
+        // `x` is on the path, or the (exclusive) child of the erased node.
+        if (x)
+            x->red = false;
+    }
+
+    template <typename Key>
+    const node* lower_bound_node(const Key& key) const noexcept
+    {
+        const node* x = root_;
+        const node* y = nullptr;
+        while (x) {
+            if (!is_less_than(to_key(x), key)) {
+                y = x;
+                x = x->left;
+            } else {
+                x = x->right;
+            }
+        }
+        return y;
+    }
+
+    template <typename Fn>
+    static bool for_each_helper(const node* x, Fn& fn)
+    {
+        while (x) {
+            if (!for_each_helper(x->left, fn) || !fn(x->value))
+                return false;
+            x = x->right;
+        }
+        return true;
+    }
+
+public:
+    explicit persistent_rbtree(
+        const GetKeyForValue& get_key = GetKeyForValue(),
+        const Compare& compare = Compare())
+        : GetKeyForValue(get_key), Compare(compare)
+    {}
+
+    // Creates a snapshot of `other` in O(1).
+    persistent_rbtree(const persistent_rbtree& other) noexcept
+        : GetKeyForValue(other), Compare(other)
+        , root_(retain(other.root_)), size_(other.size_)
+    {}
+
+    persistent_rbtree(persistent_rbtree&& other) noexcept
+        : GetKeyForValue(other), Compare(other)
+        , root_(std::exchange(other.root_, nullptr))
+        , size_(std::exchange(other.size_, 0))
+    {}
+
+    persistent_rbtree& operator=(persistent_rbtree other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~persistent_rbtree() noexcept
+    {
+        release(root_);
+    }
+
+    void swap(persistent_rbtree& other) noexcept
+    {
+        using std::swap;
+        swap(static_cast<GetKeyForValue&>(*this),
+            static_cast<GetKeyForValue&>(other));
+        swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+        swap(root_, other.root_);
+        swap(size_, other.size_);
+    }
+
+    // Returns a version which keeps the current content of this tree in
+    // O(1). Later modifications of either version do not affect the other.
+    persistent_rbtree snapshot() const noexcept
+    {
+        return *this;
+    }
+
+    bool empty() const noexcept
+    {
+        return root_ == nullptr;
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    // -- lookup -------------------------------------------------------------
+
+    template <typename Key>
+    const value_type* lower_bound(const Key& key) const noexcept
+    {
+        const node* x = lower_bound_node(key);
+        return x ? &x->value : nullptr;
+    }
+
+    template <typename Key>
+    const value_type* find(const Key& key) const noexcept
+    {
+        const node* x = lower_bound_node(key);
+        if (!x || is_less_than(key, to_key(x)))
+            return nullptr;
+        return &x->value;
+    }
+
+    template <typename Key>
+    bool contains(const Key& key) const noexcept
+    {
+        return find(key) != nullptr;
+    }
+
+    // Invokes `fn` on the elements in order as long as `fn` returns true.
+    template <typename Fn>
+    void for_each(Fn&& fn) const
+    {
+        for_each_helper(root_, fn);
+    }
+
+    // -- modifiers ----------------------------------------------------------
+
+    // Inserts `value` unless its key is already part of the tree. Copies
+    // O(log n) nodes shared with other versions.
+    bool insert(const value_type& value)
+    {
+        path p;
+        if (descend(to_key_of(value), p))
+            return false;
+        make_unique(p);
+
+        node* z = new node(value);
+        if (p.size == 0) {
+            root_ = z;
+        } else {
+            node* parent = p.nodes[p.size - 1];
+            if (is_less_than(to_key(z), to_key(parent)))
+                parent->left = z;
+            else
+                parent->right = z;
+        }
+        p.nodes[p.size++] = z;
+
+        insert_fixup(p);
+        size_++;
+        return true;
+    }
+
+    // Erases the element with key `key`, if any. Copies O(log n) nodes
+    // shared with other versions.
+    template <typename Key>
+    bool erase(const Key& key)
+    {
+        path p;
+        if (!descend(key, p))
+            return false;
+        make_unique(p);
+        node* z = p.nodes[p.size - 1];
+
+        // Remove the successor instead and move its value into `z`.
+        if (z->left && z->right) {
+            node** l = &z->right;
+            while (*l) {
+                node* y = make_unique(*l);
+                p.nodes[p.size++] = y;
+                l = &y->left;
+            }
+            z->value = std::move(p.nodes[p.size - 1]->value);
+        }
+
+        size_t i = p.size - 1;
+        node* y = p.nodes[i];
+        node*& l = link(p, i);
+        l = y->left ? y->left : y->right;
+        node* x = l ? make_unique(l) : nullptr;
+
+        bool was_black = !y->red;
+        y->left = nullptr;
+        y->right = nullptr;
+        release(y);
+        p.nodes[i] = x;
+
+        if (was_black)
+            erase_fixup(p, i, x);
+        size_--;
+        return true;
+    }
+
+    void clear() noexcept
+    {
+        release(std::exchange(root_, nullptr));
+        size_ = 0;
+    }
+
+private:
+    const key_type& to_key_of(const value_type& value) const noexcept
+    {
+        return (*static_cast<const GetKeyForValue*>(this))(value);
+    }
+};
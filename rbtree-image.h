@@ -0,0 +1,453 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// -- flat image -------------------------------------------------------------
+
+// Orders in which `write_rbtree_image` places the nodes (see
+// `rbtree_layout`). In in-order order, the records can be read in order
+// by a linear scan.
+enum class rbtree_image_order : uint32_t {
+    in_order,
+    van_emde_boas,
+};
+
+// An image consists of this header followed by `count` nodes of type
+// `rbtree_image_node<Record>`, starting at `rbtree_image_nodes_offset`.
+// All fields are in native byte order, i.e., an image written on a host
+// of different endianness fails the magic check.
+struct rbtree_image_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t order;
+    uint32_t node_size;
+    uint32_t node_alignment;
+    uint64_t count;
+    uint64_t root;
+};
+
+constexpr uint64_t rbtree_image_magic = 0x31474d4945455254; // "TREEIMG1"
+constexpr uint32_t rbtree_image_version = 1;
+constexpr size_t rbtree_image_nodes_offset = 64;
+
+// A node of an image, which keeps the shape of the tree it was written
+// from. The links are distances to the children in nodes, where 0 encodes
+// a null link, s.t. the image does not depend on where it is mapped. The
+// color of the node is kept in the lowest bit of `left_`.
+template <typename Record>
+struct rbtree_image_node {
+    Record record;
+    int32_t left_;
+    int32_t right_;
+
+    const rbtree_image_node* left() const noexcept
+    {
+        return left_ >> 1 ? this + (left_ >> 1) : nullptr;
+    }
+
+    const rbtree_image_node* right() const noexcept
+    {
+        return right_ ? this + right_ : nullptr;
+    }
+
+    bool is_red() const noexcept
+    {
+        return (left_ & 1) != 0;
+    }
+};
+
+namespace rbtree_image_detail {
+
+// Writes the nodes of a tree into `nodes` while keeping the shape of the
+// tree. `to_record(value)` returns the record of an element.
+template <typename Node, typename T, typename ToRecord, typename ImageNode>
+struct writer {
+    ToRecord& to_record;
+    std::vector<ImageNode>& nodes;
+    size_t next = 0;
+
+    static int32_t distance(size_t from, size_t to) noexcept
+    {
+        return int32_t(ptrdiff_t(to) - ptrdiff_t(from));
+    }
+
+    size_t place(const Node* x)
+    {
+        size_t i = next++;
+        ImageNode& y = nodes[i];
+        y.record = to_record(*static_cast<const T*>(x));
+        y.left_ = rbtree_access::is_red(x) ? 1 : 0;
+        y.right_ = 0;
+        return i;
+    }
+
+    void link(size_t parent, bool left, size_t child) noexcept
+    {
+        if (left)
+            nodes[parent].left_ |= distance(parent, child) * 2;
+        else
+            nodes[parent].right_ = distance(parent, child);
+    }
+
+    size_t in_order(const Node* x)
+    {
+        const Node* l = rbtree_access::left(x);
+        const Node* r = rbtree_access::right(x);
+        size_t li = l ? in_order(l) : 0;
+        size_t i = place(x);
+        if (l)
+            link(i, true, li);
+        if (r)
+            link(i, false, in_order(r));
+        return i;
+    }
+
+    // Places the top `height` levels of the subtree `x` in van Emde Boas
+    // order, as `rbtree::relocate_van_emde_boas`. The index of a placed
+    // node is only known to its parent, i.e., the descents to the bottom
+    // trees follow the links already written to `nodes`.
+    size_t van_emde_boas(const Node* x, size_t height)
+    {
+        if (height == 1)
+            return place(x);
+
+        size_t top = height / 2;
+        size_t i = van_emde_boas(x, top);
+        level(x, i, top, height - top);
+        return i;
+    }
+
+    void level(const Node* x, size_t i, size_t depth, size_t height)
+    {
+        const Node* l = rbtree_access::left(x);
+        const Node* r = rbtree_access::right(x);
+        if (depth == 1) {
+            if (l)
+                link(i, true, van_emde_boas(l, height));
+            if (r)
+                link(i, false, van_emde_boas(r, height));
+        } else {
+            if (l)
+                level(l, i + size_t(nodes[i].left_ >> 1), depth - 1, height);
+            if (r)
+                level(r, i + size_t(nodes[i].right_), depth - 1, height);
+        }
+    }
+};
+
+template <typename Node>
+size_t height(const Node* x) noexcept
+{
+    if (!x)
+        return 0;
+    return 1 + std::max(
+        height(rbtree_access::left(x)), height(rbtree_access::right(x)));
+}
+
+} // namespace rbtree_image_detail
+
+// Writes an image of `tree` to `out`, where each element is stored as the
+// trivially copyable record returned by `to_record(value)`. The image can
+// be mapped and searched in place by `rbtree_image`, or be turned back
+// into a tree by `rbtree_image::rehydrate`. Takes O(n) time and memory.
+// Throws `std::length_error` for trees of 2^30 or more elements.
+template <typename Tree, typename ToRecord>
+void write_rbtree_image(
+    std::ostream& out, const Tree& tree, ToRecord to_record,
+    rbtree_image_order order = rbtree_image_order::van_emde_boas)
+{
+    using value_type = typename Tree::value_type;
+    using record_type = std::decay_t<
+        std::invoke_result_t<ToRecord&, const value_type&>>;
+    using image_node = rbtree_image_node<record_type>;
+    using node_type = std::remove_pointer_t<
+        decltype(rbtree_access::root(tree))>;
+
+    static_assert(std::is_trivially_copyable_v<record_type>,
+        "The records must be trivially copyable.");
+    static_assert(alignof(image_node) <= rbtree_image_nodes_offset);
+
+    size_t count = size_t(std::distance(tree.begin(), tree.end()));
+    if (count >= (size_t(1) << 30))
+        throw std::length_error("rbtree image too large");
+
+    std::vector<image_node> nodes(count);
+    rbtree_image_detail::writer<node_type, value_type, ToRecord, image_node>
+        writer{to_record, nodes};
+
+    size_t root = 0;
+    if (const node_type* x = rbtree_access::root(tree)) {
+        if (order == rbtree_image_order::in_order)
+            root = writer.in_order(x);
+        else
+            root = writer.van_emde_boas(x, rbtree_image_detail::height(x));
+    }
+    assert(writer.next == count);
+
+    char header[rbtree_image_nodes_offset] = {};
+    rbtree_image_header h = {
+        rbtree_image_magic, rbtree_image_version, uint32_t(order),
+        uint32_t(sizeof(image_node)), uint32_t(alignof(image_node)),
+        count, root,
+    };
+    std::memcpy(header, &h, sizeof(h));
+
+    out.write(header, sizeof(header));
+    out.write(
+        reinterpret_cast<const char*>(nodes.data()),
+        std::streamsize(count * sizeof(image_node)));
+}
+
+// A read-only tree over an image written by `write_rbtree_image`, e.g.,
+// a mapped file. The image is used in place, i.e., it must outlive the
+// view and be aligned for its nodes (as mapped files are). The key of a
+// record is given by `GetKeyForValue`, and `Compare` must order the
+// records as the tree the image was written from. The constructor checks
+// that the links of the image stay within it, but not the order of the
+// records, i.e., lookups in a corrupt image are safe but may fail.
+template <
+    typename Record,
+    typename GetKeyForValue = get_key_for_value<Record>,
+    typename Compare = std::less<typename GetKeyForValue::key_type>>
+class rbtree_image : public GetKeyForValue, public Compare {
+public:
+    using value_type = Record;
+    using key_type = typename GetKeyForValue::key_type;
+    using node_type = rbtree_image_node<Record>;
+
+private:
+    const node_type* nodes_ = nullptr;
+    const node_type* root_ = nullptr;
+    size_t size_ = 0;
+    rbtree_image_order order_ = rbtree_image_order::in_order;
+
+    // The height of a red-black tree with less than 2^30 nodes is below 60.
+    static constexpr size_t max_height = 64;
+
+private:
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return (*static_cast<const Compare*>(this))(key0, key1);
+    }
+
+    const key_type& to_key(const value_type& value) const noexcept
+    {
+        return (*static_cast<const GetKeyForValue*>(this))(value);
+    }
+
+    // Returns the first record for which `precedes(key)` is false, or null,
+    // where `precedes` must be true for a prefix of the records.
+    template <typename Precedes>
+    const value_type* partition_point(Precedes&& precedes) const noexcept
+    {
+        const node_type* found = nullptr;
+        for (const node_type* x = root_; x;) {
+            if (precedes(to_key(x->record))) {
+                x = x->right();
+            } else {
+                found = x;
+                x = x->left();
+            }
+        }
+        return found ? &found->record : nullptr;
+    }
+
+    [[noreturn]] static void throw_corrupt()
+    {
+        throw std::invalid_argument("rbtree image corrupt");
+    }
+
+    // Returns the node at `distance` nodes from `x`, or null if `distance`
+    // is 0. Throws if the node lies outside of the image.
+    const node_type* checked_link(const node_type* x, int32_t distance) const
+    {
+        if (distance == 0)
+            return nullptr;
+        ptrdiff_t i = (x - nodes_) + distance;
+        if (i < 0 || size_t(i) >= size_)
+            throw_corrupt();
+        return nodes_ + i;
+    }
+
+    // Walks the nodes in order as `for_each` does, and throws unless all
+    // links stay within the image, the height is at most `max_height` and
+    // the walk visits `size_` nodes, i.e., every search terminates within
+    // the image.
+    void validate() const
+    {
+        const node_type* stack[max_height];
+        size_t depth = 0;
+        size_t visited = 0;
+        for (const node_type* x = root_; x || depth > 0;) {
+            if (x) {
+                if (depth == max_height)
+                    throw_corrupt();
+                stack[depth++] = x;
+                x = checked_link(x, x->left_ >> 1);
+            } else {
+                x = stack[--depth];
+                if (++visited > size_)
+                    throw_corrupt();
+                x = checked_link(x, x->right_);
+            }
+        }
+        if (visited != size_)
+            throw_corrupt();
+    }
+
+public:
+    rbtree_image() noexcept = default;
+
+    // Throws `std::invalid_argument` if [`data`, `data + size`) does not
+    // hold an image of `Record`s, or if its links leave the image or nest
+    // deeper than 64 levels. Reads every node once, i.e., takes O(n).
+    rbtree_image(
+        const void* data, size_t size,
+        GetKeyForValue get_key = GetKeyForValue(),
+        Compare compare = Compare())
+        : GetKeyForValue(std::move(get_key)), Compare(std::move(compare))
+    {
+        static_assert(std::is_trivially_copyable_v<Record>);
+
+        rbtree_image_header h;
+        if (size < rbtree_image_nodes_offset)
+            throw std::invalid_argument("rbtree image truncated");
+        std::memcpy(&h, data, sizeof(h));
+
+        if (h.magic != rbtree_image_magic
+            || h.version != rbtree_image_version
+            || h.node_size != sizeof(node_type)
+            || h.node_alignment != alignof(node_type)
+            || h.order > uint32_t(rbtree_image_order::van_emde_boas))
+            throw std::invalid_argument("rbtree image mismatch");
+        if (h.count > (size - rbtree_image_nodes_offset) / sizeof(node_type)
+            || (h.count > 0 && h.root >= h.count))
+            throw std::invalid_argument("rbtree image truncated");
+        if (reinterpret_cast<uintptr_t>(data) % alignof(node_type) != 0)
+            throw std::invalid_argument("rbtree image misaligned");
+
+        nodes_ = reinterpret_cast<const node_type*>(
+            static_cast<const char*>(data) + rbtree_image_nodes_offset);
+        size_ = size_t(h.count);
+        root_ = size_ ? nodes_ + h.root : nullptr;
+        order_ = rbtree_image_order(h.order);
+        validate();
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    rbtree_image_order order() const noexcept
+    {
+        return order_;
+    }
+
+    // The root of the image, s.t. it can be walked as a tree, or null.
+    const node_type* root() const noexcept
+    {
+        return root_;
+    }
+
+    // Invokes `fn(record)` on all records in order. Reads the nodes
+    // sequentially if the image is in in-order order.
+    template <typename Fn>
+    void for_each(Fn fn) const
+    {
+        if (order_ == rbtree_image_order::in_order) {
+            for (size_t i = 0; i < size_; ++i)
+                fn(nodes_[i].record);
+            return;
+        }
+
+        const node_type* stack[max_height];
+        size_t depth = 0;
+        for (const node_type* x = root_; x || depth > 0;) {
+            if (x) {
+                if (depth == max_height)
+                    throw_corrupt();
+                stack[depth++] = x;
+                x = x->left();
+            } else {
+                x = stack[--depth];
+                fn(x->record);
+                x = x->right();
+            }
+        }
+    }
+
+    // Replaces the content of `tree` by the elements returned by
+    // `make(record)` for all records in O(n) (see `rbtree::assign_sorted`).
+    // If `make` throws, the elements made so far are linked into `tree`
+    // before the exception is rethrown, s.t. they can be disposed.
+    template <typename Tree, typename Make>
+    void rehydrate(Tree& tree, Make make) const
+    {
+        std::vector<typename Tree::value_type*> values;
+        values.reserve(size_);
+        try {
+            for_each([&](const value_type& record) {
+                values.push_back(make(record));
+            });
+        } catch (...) {
+            tree.assign_sorted(values.begin(), values.end());
+            throw;
+        }
+        tree.assign_sorted(values.begin(), values.end());
+    }
+
+    // -- lookup -------------------------------------------------------------
+
+    // Returns the first record whose key is not less than `key`, or null.
+    template <typename Key>
+    const value_type* lower_bound(const Key& key) const noexcept
+    {
+        return partition_point([&](const key_type& x) {
+            return is_less_than(x, key);
+        });
+    }
+
+    // Returns the first record whose key is greater than `key`, or null.
+    template <typename Key>
+    const value_type* upper_bound(const Key& key) const noexcept
+    {
+        return partition_point([&](const key_type& x) {
+            return !is_less_than(key, x);
+        });
+    }
+
+    template <typename Key>
+    const value_type* find(const Key& key) const noexcept
+    {
+        const value_type* x = lower_bound(key);
+        if (!x || is_less_than(key, to_key(*x)))
+            return nullptr;
+        return x;
+    }
+
+    template <typename Key>
+    bool contains(const Key& key) const noexcept
+    {
+        return find(key) != nullptr;
+    }
+};
@@ -0,0 +1,322 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// -- node pool --------------------------------------------------------------
+
+// Allocates storage for nodes of type `T` from slabs of `SlabSize` bytes,
+// which are aligned to their size, s.t. the slab of a node is found from
+// its address. Combined with `insert_for_key(key, fn)`, whose `fn` may be
+// passed the parent of the new node, `allocate_near` places new nodes in
+// the slab of their parent, i.e., a descent stays within few pages. The
+// pool hands out raw storage via `allocate` or constructed nodes via
+// `create`, and `disposer()` recycles nodes from `clear_and_dispose`,
+// `erase_equal` etc.
+//
+// A pool is owned by one thread, i.e., is meant to be used per thread,
+// e.g., as `thread_local`. Only `deallocate_remote`, `destroy_remote` and
+// `remote_disposer()` may be called from other threads: they hand the slot
+// back to the owner, which reuses it once its slabs run full. Since slabs
+// are first touched by their owner, the default first-touch policy of the
+// OS places them on the NUMA node of the owner if it is pinned. Each pool
+// serves a single node type, i.e., a single size class.
+template <typename T, size_t SlabSize = 64 * 1024>
+class rbtree_node_pool {
+    static_assert((SlabSize & (SlabSize - 1)) == 0,
+        "The slab size must be a power of two.");
+
+    struct free_slot {
+        free_slot* next;
+    };
+
+    struct slab {
+        rbtree_node_pool* owner = nullptr;
+        slab* next = nullptr;
+        slab* next_partial = nullptr;
+        free_slot* free = nullptr;
+        size_t bump = 0;
+        size_t used = 0;
+        bool partial = false;
+    };
+
+    static constexpr size_t round_up(size_t n, size_t alignment) noexcept
+    {
+        return (n + alignment - 1) / alignment * alignment;
+    }
+
+    static constexpr size_t slot_alignment =
+        std::max(alignof(T), alignof(free_slot));
+
+    static constexpr size_t slot_size =
+        round_up(std::max(sizeof(T), sizeof(free_slot)), slot_alignment);
+
+    static constexpr size_t first_slot =
+        round_up(sizeof(slab), slot_alignment);
+
+public:
+    static constexpr size_t slots_per_slab =
+        SlabSize > first_slot ? (SlabSize - first_slot) / slot_size : 0;
+
+    static_assert(slots_per_slab > 0, "The slab size is too small.");
+
+    rbtree_node_pool() noexcept = default;
+
+    rbtree_node_pool(const rbtree_node_pool&) = delete;
+    rbtree_node_pool& operator=(const rbtree_node_pool&) = delete;
+
+    // Releases all slabs. All nodes must have been destroyed.
+    ~rbtree_node_pool() noexcept
+    {
+        collect();
+        while (slabs_) {
+            slab* s = slabs_;
+            slabs_ = s->next;
+            release_slab(s);
+        }
+    }
+
+    // Returns storage for a node from the current slab, a slab with free
+    // slots or a new slab, in this order.
+    void* allocate()
+    {
+        if (!current_ || !has_room(current_)) {
+            current_ = nullptr;
+            collect();
+            while (partial_ && !current_) {
+                slab* s = partial_;
+                partial_ = s->next_partial;
+                s->partial = false;
+                if (has_room(s))
+                    current_ = s;
+            }
+            if (!current_)
+                current_ = new_slab();
+        }
+        return take(current_);
+    }
+
+    // Returns storage in the slab of `hint` if this pool owns it and it has
+    // room, or as `allocate()` otherwise. `hint` must be null or a node
+    // allocated by some `rbtree_node_pool<T, SlabSize>`.
+    void* allocate_near(const void* hint)
+    {
+        if (hint) {
+            slab* s = slab_of(hint);
+            if (s->owner == this && has_room(s))
+                return take(s);
+        }
+        return allocate();
+    }
+
+    // Returns the slot following the one returned by the previous call
+    // (unless another allocation took it in between) and never reuses freed
+    // slots. Used to lay out nodes consecutively (see `rbtree_compact`).
+    void* allocate_fresh()
+    {
+        if (!fresh_ || fresh_->bump == slots_per_slab)
+            fresh_ = new_slab();
+        ++fresh_->used;
+        return slot(fresh_, fresh_->bump++);
+    }
+
+    void deallocate(void* p) noexcept
+    {
+        assert(p);
+        slab* s = slab_of(p);
+        assert(s->used > 0);
+
+        free_slot* f = static_cast<free_slot*>(p);
+        f->next = s->free;
+        s->free = f;
+        --s->used;
+
+        if (!s->partial && s != current_) {
+            s->partial = true;
+            s->next_partial = partial_;
+            partial_ = s;
+        }
+    }
+
+    // Returns the storage of a node allocated by this pool from any thread.
+    // Takes effect once the owner collects it (see `collect`).
+    void deallocate_remote(void* p) noexcept
+    {
+        assert(p);
+        rbtree_node_pool* owner = slab_of(p)->owner;
+        free_slot* f = static_cast<free_slot*>(p);
+        f->next = owner->remote_.load(std::memory_order_relaxed);
+        while (!owner->remote_.compare_exchange_weak(
+            f->next, f, std::memory_order_release, std::memory_order_relaxed))
+        {}
+    }
+
+    // Takes back the storage returned via `deallocate_remote`. Called by
+    // `allocate` before it looks for another slab.
+    void collect() noexcept
+    {
+        if (!remote_.load(std::memory_order_relaxed))
+            return;
+        free_slot* f = remote_.exchange(nullptr, std::memory_order_acquire);
+        while (f) {
+            free_slot* next = f->next;
+            deallocate(f);
+            f = next;
+        }
+    }
+
+    // Constructs a node from `args` in storage from `allocate()`.
+    template <typename... Args>
+    T* create(Args&&... args)
+    {
+        void* p = allocate();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    void destroy(T* node) noexcept
+    {
+        node->~T();
+        deallocate(node);
+    }
+
+    // Like `destroy`, but may be called from any thread.
+    void destroy_remote(T* node) noexcept
+    {
+        node->~T();
+        deallocate_remote(node);
+    }
+
+    // Returns a disposer which destroys nodes via `destroy` resp.
+    // `destroy_remote`.
+    auto disposer() noexcept
+    {
+        return [this](T* node) noexcept { destroy(node); };
+    }
+
+    auto remote_disposer() noexcept
+    {
+        return [this](T* node) noexcept { destroy_remote(node); };
+    }
+
+    // Releases the slabs without any nodes.
+    void shrink() noexcept
+    {
+        collect();
+        slab** link = &slabs_;
+        partial_ = nullptr;
+        while (slab* s = *link) {
+            if (s->used == 0) {
+                *link = s->next;
+                if (s == current_)
+                    current_ = nullptr;
+                if (s == fresh_)
+                    fresh_ = nullptr;
+                release_slab(s);
+                continue;
+            }
+
+            s->partial = s != current_ && has_room(s);
+            if (s->partial) {
+                s->next_partial = partial_;
+                partial_ = s;
+            }
+            link = &s->next;
+        }
+    }
+
+    // Returns the number of slabs held by the pool.
+    size_t slab_count() const noexcept
+    {
+        size_t n = 0;
+        for (const slab* s = slabs_; s; s = s->next)
+            ++n;
+        return n;
+    }
+
+    // Returns true if `p` and `q` were allocated from the same slab.
+    static bool same_slab(const void* p, const void* q) noexcept
+    {
+        return slab_of(p) == slab_of(q);
+    }
+
+private:
+    static slab* slab_of(const void* p) noexcept
+    {
+        return reinterpret_cast<slab*>(
+            reinterpret_cast<uintptr_t>(p) & ~uintptr_t(SlabSize - 1));
+    }
+
+    static void* slot(slab* s, size_t i) noexcept
+    {
+        return reinterpret_cast<char*>(s) + first_slot + i * slot_size;
+    }
+
+    static bool has_room(const slab* s) noexcept
+    {
+        return s->free || s->bump < slots_per_slab;
+    }
+
+    static void* take(slab* s) noexcept
+    {
+        ++s->used;
+        if (free_slot* f = s->free) {
+            s->free = f->next;
+            return f;
+        }
+        return slot(s, s->bump++);
+    }
+
+    slab* new_slab()
+    {
+        void* p = ::operator new(SlabSize, std::align_val_t(SlabSize));
+        slab* s = new (p) slab;
+        s->owner = this;
+        s->next = slabs_;
+        slabs_ = s;
+        return s;
+    }
+
+    static void release_slab(slab* s) noexcept
+    {
+        s->~slab();
+        ::operator delete(s, std::align_val_t(SlabSize));
+    }
+
+    slab* slabs_ = nullptr;
+    slab* partial_ = nullptr;
+    slab* current_ = nullptr;
+    slab* fresh_ = nullptr;
+    std::atomic<free_slot*> remote_{nullptr};
+};
+
+// -- compaction -------------------------------------------------------------
+
+// Moves all elements of `tree`, which must have been allocated from
+// `pool`, into consecutive slots in the given `layout` order and releases
+// the slabs that become empty. Requires `T` to be move-constructible.
+template <typename Tree, typename T, size_t SlabSize>
+void rbtree_compact(
+    Tree& tree, rbtree_node_pool<T, SlabSize>& pool,
+    rbtree_layout layout = rbtree_layout::van_emde_boas)
+{
+    static_assert(std::is_same_v<typename Tree::value_type, T>);
+
+    tree.relayout([&](T* value) {
+        T* moved = new (pool.allocate_fresh()) T(std::move(*value));
+        pool.destroy(value);
+        return moved;
+    }, layout);
+    pool.shrink();
+}
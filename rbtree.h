@@ -1,9 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <utility>
 #include <type_traits>
 #include <iterator>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
 
 template <typename T>
 struct get_key_for_value {
@@ -16,51 +23,215 @@ struct get_key_for_value {
     }
 };
 
+// Hints the CPU to fetch the cache line at `ptr` ahead of its use.
+inline void rbtree_prefetch(const void* ptr) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(ptr);
+#else
+    (void)ptr;
+#endif
+}
+
+// Reads `ref` with a single (relaxed) atomic load, s.t. it can not tear
+// when `ref` is written concurrently. Compiles to a plain load.
+template <typename T>
+T rbtree_load_relaxed(const T& ref) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(&ref, __ATOMIC_RELAXED);
+#else
+    return *static_cast<const volatile T*>(&ref);
+#endif
+}
+
+// Writes `ref` with a single (relaxed) atomic store, s.t. concurrent
+// `rbtree_load_relaxed`s of `ref` do not race with it. Compiles to a plain
+// store.
+template <typename T>
+void rbtree_store_relaxed(T& ref, T value) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(&ref, value, __ATOMIC_RELAXED);
+#else
+    *static_cast<volatile T*>(&ref) = value;
+#endif
+}
+
+// Adapts a three-way comparison `compare3(a, b)`, which returns a negative
+// value, zero or a positive value if `a` is less than, equal to or greater
+// than `b`, to a `Compare` policy. The descents of the tree then need one
+// comparison per level instead of two. Heterogeneous lookups are enabled
+// iff `Compare3::is_transparent` exists, which is inherited from `Compare3`.
+template <typename Compare3>
+struct rbtree_three_way : Compare3 {
+    rbtree_three_way() = default;
+
+    explicit rbtree_three_way(Compare3 compare3)
+        : Compare3(std::move(compare3))
+    {}
+
+    template <typename Key0, typename Key1>
+    bool operator()(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return compare3(key0, key1) < 0;
+    }
+
+    template <typename Key0, typename Key1>
+    int compare3(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return static_cast<const Compare3&>(*this)(key0, key1);
+    }
+};
+
+template <typename Compare, typename Key0, typename Key1, typename = void>
+struct rbtree_has_compare3 : std::false_type {};
+
+template <typename Compare, typename Key0, typename Key1>
+struct rbtree_has_compare3<Compare, Key0, Key1, std::void_t<decltype(
+    std::declval<const Compare&>().compare3(
+        std::declval<const Key0&>(), std::declval<const Key1&>()))>>
+    : std::true_type {};
+
+// Default augmentation of a tree, which does not maintain any data.
+struct rbtree_no_augment {
+    template <typename T>
+    void operator()(T&, const T*, const T*) const noexcept {}
+};
+
+// Default statistics of a tree, which records nothing, s.t. the hooks
+// compile away.
+struct rbtree_no_stats {
+    void on_find(size_t) const noexcept {}
+    void on_insert_descent(size_t) noexcept {}
+    void on_rotation() noexcept {}
+    void on_insert_fixup(size_t) noexcept {}
+    void on_erase_fixup(size_t) noexcept {}
+};
+
+// Statistics of the hot paths of a tree, e.g.
+//
+//     rbtree<Foo, void, get_key_for_value<Foo>, std::less<Foo>,
+//         rbtree_no_augment, rbtree_stats> tree;
+//     ...
+//     tree.stats().find_comparisons[k]; // finds with k comparisons
+//
+// The histograms count the descents (resp. fixups) by their number of
+// comparisons (resp. loop iterations), where the last bucket also counts
+// all greater numbers. Finds update the stats of a const tree, i.e., a
+// tree with stats must not be searched concurrently.
+struct rbtree_stats {
+    static constexpr size_t histogram_size = 64;
+    using histogram = std::array<uint64_t, histogram_size>;
+
+    mutable histogram find_comparisons{};
+    histogram insert_comparisons{};
+    histogram insert_fixup_iterations{};
+    histogram erase_fixup_iterations{};
+    uint64_t rotations = 0;
+
+    static size_t bucket(size_t n) noexcept
+    {
+        return n < histogram_size ? n : histogram_size - 1;
+    }
+
+    void on_find(size_t comparisons) const noexcept
+    {
+        ++find_comparisons[bucket(comparisons)];
+    }
+
+    void on_insert_descent(size_t comparisons) noexcept
+    {
+        ++insert_comparisons[bucket(comparisons)];
+    }
+
+    void on_rotation() noexcept
+    {
+        ++rotations;
+    }
+
+    void on_insert_fixup(size_t iterations) noexcept
+    {
+        ++insert_fixup_iterations[bucket(iterations)];
+    }
+
+    void on_erase_fixup(size_t iterations) noexcept
+    {
+        ++erase_fixup_iterations[bucket(iterations)];
+    }
+};
+
+// Orders in which `rbtree::relayout` visits the nodes. In breadth-first
+// order, the nodes of each level are adjacent. In van Emde Boas order, the
+// tree is recursively split at half its height into a top tree and the
+// bottom trees below it, each of which is laid out contiguously, s.t. a
+// descent touches O(log n / log B) blocks of B nodes for any block size.
+enum class rbtree_layout {
+    breadth_first,
+    van_emde_boas,
+};
+
 // -- red-black tree node ----------------------------------------------------
 
 template <
     typename T, typename Tag = void,
     typename GetKeyForValue = get_key_for_value<T>,
-    typename Compare = std::less<T>>
+    typename Compare = std::less<T>,
+    typename Augment = rbtree_no_augment,
+    typename Stats = rbtree_no_stats>
 class rbtree;
 
+struct rbtree_access;
+
 template <typename T, typename Tag, bool Const>
 class rbtree_iterator;
 
-// Note, we could check in the destructor of this class whether or not the
-// node is still part of an rbtree to notify the user when a node is
-// wrongly destructed. However, we decide against it for now, s.t. classes
-// inheriting this node may have trivial destructors.
-template <typename Tag = void>
-struct rbtree_node {
-    //B3_NO_COPY_AND_MOVE(rbtree_node);
-  
-    template<typename T, typename Tag_, typename GetKeyForValue, typename Compare>
+// The hook of the nodes with pointer links (`rbtree_node<Tag>` and its
+// counted and prefixed variants), where `Node` is the node type itself.
+//
+// The color of the node is kept in the lowest bit of the parent pointer,
+// which is always zero due to the alignment of the node. This keeps the
+// hook at three pointers (24 bytes on 64-bit platforms).
+template <typename Node>
+struct rbtree_pointer_node {
+    template<
+        typename T, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
     friend class rbtree;
 
     template<typename T, typename Tag_, bool Const_>
     friend class rbtree_iterator;
 
+    friend struct rbtree_access;
+
 protected:
-    rbtree_node() noexcept = default;
+    rbtree_pointer_node() noexcept = default;
   
-    void set_red() noexcept { is_red_ = true; }
-    void set_black() noexcept { is_red_ = false; }
-    bool is_red() const noexcept { return is_red_; }
+    // The links are written atomically, s.t. readers of a
+    // `concurrent_rbtree` may load them while the tree is modified.
+    void set_red() noexcept { store_parent(parent_ | red_bit); }
+    void set_black() noexcept { store_parent(parent_ & ~red_bit); }
+    bool is_red() const noexcept { return (parent_ & red_bit) != 0; }
 
-    void set_parent(rbtree_node* parent)
-    { 
-        parent_ = parent;
+    void set_parent(Node* parent) noexcept
+    {
+        store_parent(
+            reinterpret_cast<uintptr_t>(parent) | (parent_ & red_bit));
+    }
+
+    void store_parent(uintptr_t parent) noexcept
+    {
+        rbtree_store_relaxed(parent_, parent);
     }
     
-    rbtree_node* parent() noexcept
+    Node* parent() noexcept
     { 
-        return parent_; 
+        return reinterpret_cast<Node*>(parent_ & ~red_bit); 
     }
     
-    const rbtree_node* parent() const noexcept
+    const Node* parent() const noexcept
     { 
-        return parent_;
+        return reinterpret_cast<const Node*>(parent_ & ~red_bit);
     }
   
     bool unlinked() const noexcept
@@ -83,16 +254,320 @@ protected:
     {
         left = nullptr;
         right = nullptr;
-        is_red_ = false;
-        parent_ = nullptr;
+        parent_ = 0;
+    }
+
+    Node* left = nullptr;
+    Node* right = nullptr;
+
+private:
+    static constexpr uintptr_t red_bit = 1;
+
+    uintptr_t parent_ = 0;
+};
+
+// Note, we could check in the destructor of this class whether or not the
+// node is still part of an rbtree to notify the user when a node is
+// wrongly destructed. However, we decide against it for now, s.t. classes
+// inheriting this node may have trivial destructors.
+template <typename Tag = void>
+struct rbtree_node : rbtree_pointer_node<rbtree_node<Tag>> {
+    //B3_NO_COPY_AND_MOVE(rbtree_node);
+
+    template<
+        typename T, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
+    friend class rbtree;
+
+protected:
+    rbtree_node() noexcept = default;
+};
+
+static_assert(
+    alignof(rbtree_node<>) > 1, "The color bit requires an aligned node.");
+
+// -- offset-based red-black tree node ---------------------------------------
+
+// Selects nodes which store their links as 32-bit offsets relative to
+// `Arena::base()` instead of full pointers, e.g.
+//
+//     struct arena { static char* base() noexcept; };
+//     struct Foo : rbtree_node<rbtree_offset<arena>> { ... };
+//     rbtree<Foo, rbtree_offset<arena>> tree;
+//
+// All nodes *and* the tree itself (which holds the head node) must be
+// placed within the first 4 GiB following `Arena::base()`. The offset 0
+// encodes a null link, i.e., no node may start at `Arena::base()`. Since
+// the links do not depend on where the arena is mapped, the tree can be
+// relocated (or mmapped) as a whole without fixing up the nodes.
+template <typename Arena, typename Tag = void>
+struct rbtree_offset {};
+
+// A link to a node stored as offset relative to `Arena::base()`. The link
+// behaves like a `Node*`, s.t. the tree algorithms work unchanged on it.
+template <typename Node, typename Arena>
+class rbtree_offset_link {
+    uint32_t offset_ = 0;
+
+public:
+    static uint32_t encode(const Node* node) noexcept
+    {
+        if (node == nullptr)
+            return 0;
+
+        auto offset = reinterpret_cast<const char*>(node) - Arena::base();
+        assert(offset > 0 && uint64_t(offset) <= UINT32_MAX);
+        return uint32_t(offset);
+    }
+
+    static Node* decode(uint32_t offset) noexcept
+    {
+        if (offset == 0)
+            return nullptr;
+        return reinterpret_cast<Node*>(Arena::base() + offset);
+    }
+
+    rbtree_offset_link() noexcept = default;
+
+    rbtree_offset_link(Node* node) noexcept : offset_{encode(node)}
+    {}
+
+    rbtree_offset_link& operator=(Node* node) noexcept
+    {
+        offset_ = encode(node);
+        return *this;
+    }
+
+    operator Node*() const noexcept
+    {
+        return decode(offset_);
+    }
+
+    Node* operator->() const noexcept
+    {
+        return decode(offset_);
+    }
+};
+
+// Same as `rbtree_node<Tag>` but with 32-bit links (12 bytes in total).
+// The color is kept in the lowest bit of the parent offset.
+template <typename Arena, typename Tag>
+struct rbtree_node<rbtree_offset<Arena, Tag>> {
+    template<
+        typename T, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
+    friend class rbtree;
+
+    template<typename T, typename Tag_, bool Const_>
+    friend class rbtree_iterator;
+
+    friend struct rbtree_access;
+
+protected:
+    using link_type = rbtree_offset_link<rbtree_node, Arena>;
+
+    rbtree_node() noexcept = default;
+
+    void set_red() noexcept { parent_ |= red_bit; }
+    void set_black() noexcept { parent_ &= ~red_bit; }
+    bool is_red() const noexcept { return (parent_ & red_bit) != 0; }
+
+    void set_parent(rbtree_node* parent) noexcept
+    {
+        parent_ = link_type::encode(parent) | (parent_ & red_bit);
+    }
+
+    rbtree_node* parent() noexcept
+    {
+        return link_type::decode(parent_ & ~red_bit);
+    }
+
+    const rbtree_node* parent() const noexcept
+    {
+        return link_type::decode(parent_ & ~red_bit);
+    }
+
+    bool unlinked() const noexcept
+    {
+        return parent() == nullptr && left == nullptr && right == nullptr;
+    }
+
+    void set_red(bool val) noexcept
+    {
+        if (val) set_red();
+        else set_black();
+    }
+
+    bool is_black() const noexcept
+    {
+        return !is_red();
+    }
+
+    void reset() noexcept
+    {
+        left = nullptr;
+        right = nullptr;
+        parent_ = 0;
+    }
+
+    link_type left;
+    link_type right;
+
+private:
+    static constexpr uint32_t red_bit = 1;
+
+    uint32_t parent_ = 0;
+};
+
+// -- counted red-black tree node -------------------------------------------
+
+// Selects nodes which additionally store the size of the subtree rooted
+// at them, e.g.
+//
+//     struct Foo : rbtree_node<rbtree_counted<>> { ... };
+//     rbtree<Foo, rbtree_counted<>> tree;
+//
+// The tree keeps the sizes up to date on every modification, which
+// enables `size()`, `nth()`, `rank()` and `rbtree_iterator::advance()` in
+// O(1) resp. O(log n).
+template <typename Tag = void>
+struct rbtree_counted {};
+
+template <typename Tag>
+struct rbtree_is_counted : std::false_type {};
+
+template <typename Tag>
+struct rbtree_is_counted<rbtree_counted<Tag>> : std::true_type {};
+
+template <typename Tag>
+inline constexpr bool rbtree_is_counted_v = rbtree_is_counted<Tag>::value;
+
+// Same as `rbtree_node<Tag>` plus the size of the subtree.
+template <typename Tag>
+struct rbtree_node<rbtree_counted<Tag>>
+    : rbtree_pointer_node<rbtree_node<rbtree_counted<Tag>>> {
+    template<
+        typename T, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
+    friend class rbtree;
+
+    template<typename T, typename Tag_, bool Const_>
+    friend class rbtree_iterator;
+
+    friend struct rbtree_access;
+
+protected:
+    rbtree_node() noexcept = default;
+
+    void reset() noexcept
+    {
+        rbtree_pointer_node<rbtree_node>::reset();
+        size_ = 1;
+    }
+
+    // Returns the size of the subtree `x`, where `x` may be null.
+    static size_t subtree_size(const rbtree_node* x) noexcept
+    {
+        return x ? x->size_ : 0;
+    }
+
+    // Recomputes the size of `x` from its children.
+    void update_size() noexcept
+    {
+        size_ = 1 + subtree_size(this->left) + subtree_size(this->right);
     }
 
-    rbtree_node<Tag>* left = nullptr;
-    rbtree_node<Tag>* right = nullptr;
+    // Returns the `k`-th node (0-based) of the subtree `x`.
+    template <typename Node>
+    static Node* select(Node* x, size_t k) noexcept
+    {
+        assert(k < subtree_size(x));
+
+        while (true) {
+            size_t l = subtree_size(x->left);
+            if (k < l) {
+                x = x->left;
+            } else if (k == l) {
+                return x;
+            } else {
+                k -= l + 1;
+                x = x->right;
+            }
+        }
+    }
 
 private:
-    bool is_red_ = false;
-    rbtree_node<Tag>* parent_ = nullptr;
+    size_t size_ = 1;
+};
+
+// -- prefixed red-black tree node ------------------------------------------
+
+// Selects nodes which additionally cache a prefix of their key next to the
+// links, e.g.
+//
+//     struct Foo : rbtree_node<rbtree_prefixed<rbtree_string_prefix>> { ... };
+//     rbtree<Foo, rbtree_prefixed<rbtree_string_prefix>, ...> tree;
+//
+// The descents compare the prefixes first and compare the keys only if
+// the prefixes are equal, which saves reaching into the element (and from
+// there e.g. to the heap buffer of a string) at most levels. `Prefix` is
+// a stateless functor `prefix_type operator()(const Key&)`, which must be
+// callable with all key types used for lookups and must be monotonic,
+// i.e., `a < b` implies `Prefix()(a) <= Prefix()(b)`. The tree sets the
+// prefix whenever it links a node.
+template <typename Prefix, typename Tag = void>
+struct rbtree_prefixed {};
+
+// Default of trees without prefixed nodes.
+struct rbtree_no_prefix {
+    using prefix_type = bool;
+};
+
+template <typename Tag>
+struct rbtree_key_prefix {
+    using type = rbtree_no_prefix;
+};
+
+template <typename Prefix, typename Tag>
+struct rbtree_key_prefix<rbtree_prefixed<Prefix, Tag>> {
+    using type = Prefix;
+};
+
+// The first 8 bytes of a string key in big-endian order (padded with zero
+// bytes), s.t. the prefixes compare as the strings.
+struct rbtree_string_prefix {
+    using prefix_type = uint64_t;
+
+    uint64_t operator()(std::string_view key) const noexcept
+    {
+        unsigned char bytes[8] = {};
+        if (!key.empty())
+            std::memcpy(bytes, key.data(), std::min(key.size(), sizeof(bytes)));
+
+        uint64_t prefix = 0;
+        for (unsigned char byte : bytes)
+            prefix = prefix << 8 | byte;
+        return prefix;
+    }
+};
+
+// Same as `rbtree_node<Tag>` plus the key prefix.
+template <typename Prefix, typename Tag>
+struct rbtree_node<rbtree_prefixed<Prefix, Tag>>
+    : rbtree_pointer_node<rbtree_node<rbtree_prefixed<Prefix, Tag>>> {
+    template<
+        typename T, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
+    friend class rbtree;
+
+    friend struct rbtree_access;
+
+protected:
+    using prefix_type = typename Prefix::prefix_type;
+
+    rbtree_node() noexcept = default;
+
+    prefix_type key_prefix{};
 };
 
 // -- red-black tree iterator ------------------------------------------------
@@ -113,6 +588,13 @@ private:
     node_pointer curr_;
 
 private:
+    // The head node is the only red node whose grandparent is itself.
+    static bool is_head(node_pointer curr) noexcept
+    {
+        return curr->is_red() && curr->parent()
+            && curr->parent()->parent() == curr;
+    }
+
     static node_pointer next(node_pointer curr) noexcept
     {
         node_pointer next = nullptr;
@@ -141,6 +623,10 @@ private:
     {
         node_pointer next = nullptr;
 
+        // The predecessor of the head node is the maximum.
+        if (is_head(curr))
+            return curr->right;
+
         if (curr->left) {
             next = curr->left;
 
@@ -161,10 +647,23 @@ private:
         return next;
     }
 
+    template <typename T_, typename Tag_, bool Const_>
+    friend class rbtree_iterator;
+
+    template<
+        typename T_, typename Tag_, typename GetKeyForValue, typename Compare,
+        typename Augment, typename Stats>
+    friend class rbtree;
+
 public:
     explicit rbtree_iterator(node_pointer curr) noexcept : curr_{curr}
     {}
 
+    template <bool Const_ = Const, typename = std::enable_if_t<Const_>>
+    rbtree_iterator(const rbtree_iterator<T, Tag, false>& other) noexcept :
+        curr_{other.curr_}
+    {}
+
     pointer get() const noexcept
     { 
         return static_cast<pointer>(curr_);
@@ -206,6 +705,64 @@ public:
         return rv;
     }
 
+    // Moves the iterator `n` elements forward (or backward if `n` is
+    // negative) in O(log n). Requires counted nodes.
+    rbtree_iterator& advance(difference_type n) noexcept
+    {
+        static_assert(
+            rbtree_is_counted_v<Tag>, "`advance` requires counted nodes.");
+        using node_type = rbtree_node<Tag>;
+
+        node_pointer x = curr_;
+        if (n < 0 && is_head(x)) {
+            x = x->right;
+            n++;
+        }
+
+        // Skip the subtree after (resp. before) `x` as a whole if the
+        // target is not in there and continue at the ancestor next in
+        // order.
+        while (n > 0) {
+            size_t r = node_type::subtree_size(x->right);
+            if (size_t(n) <= r) {
+                curr_ = node_type::select(
+                    node_pointer(x->right), size_t(n) - 1);
+                return *this;
+            }
+            n -= difference_type(r);
+
+            while (!is_head(x->parent()) && x == x->parent()->right)
+                x = x->parent();
+            x = x->parent();
+            n--;
+
+            if (is_head(x)) {
+                assert(n == 0);
+                break;
+            }
+        }
+
+        while (n < 0) {
+            size_t l = node_type::subtree_size(x->left);
+            if (size_t(-n) <= l) {
+                curr_ = node_type::select(
+                    node_pointer(x->left), l - size_t(-n));
+                return *this;
+            }
+            n += difference_type(l);
+
+            while (x == x->parent()->left)
+                x = x->parent();
+            x = x->parent();
+            n++;
+
+            assert(!is_head(x));
+        }
+
+        curr_ = x;
+        return *this;
+    }
+
     friend bool operator==(
         const rbtree_iterator& it0, const rbtree_iterator& it1) noexcept
     {
@@ -228,13 +785,28 @@ public:
 // it for their implementation can do mutations on them. However, be aware
 // that the "key part" of the element must not be changed, since this would
 // invalidate the tree structure and leads to UB.
-template<typename T, typename Tag, typename GetKeyForValue, typename Compare>
-class rbtree : public GetKeyForValue, public Compare {
+//
+// `Augment` maintains user-defined data summarizing a subtree (e.g. the
+// maximum endpoint of an interval tree). It is invoked as
+// `augment(value, left, right)`, where `left` and `right` are the children
+// of `value` (or null), on exactly those nodes whose subtree changed,
+// children before parents. It must not throw.
+//
+// `Stats` is notified of the work done by descents, rotations and fixups
+// (see `rbtree_stats`). The default `rbtree_no_stats` costs nothing.
+template <
+    typename T, typename Tag, typename GetKeyForValue, typename Compare,
+    typename Augment, typename Stats>
+class rbtree :
+    public GetKeyForValue, public Compare, public Augment, public Stats
+{
     //B3_NO_COPY(rbtree)
 
     static_assert(
         std::is_base_of_v<rbtree_node<Tag>, T>, "`T` must be a rbtree node.");
 
+    friend struct rbtree_access;
+
 public:
     using value_type = T;
     using key_type = typename GetKeyForValue::key_type;
@@ -293,48 +865,182 @@ private:
         head_.set_parent(n); 
     }
 
-    void rotate_left(node_type* x) noexcept
+    // Sets the child link `link` of a node to `x`. Pointer links are
+    // written atomically (see `concurrent_rbtree`).
+    template <typename Link>
+    static void store_link(Link& link, node_type* x) noexcept
     {
-        assert(x->right != nullptr);
-        node_type* y = x->right; 
-        x->right = y->left;
-        if (y->left)
-            y->left->set_parent(x);
-        y->set_parent(x->parent());
-        if (x->parent() == &head_)
-            set_root(y);
-        else if (x == x->parent()->left)
-            x->parent()->left = y;
+        if constexpr (std::is_pointer_v<Link>)
+            rbtree_store_relaxed(link, x);
         else
-            x->parent()->right = y;
-        x->set_parent(y);
-        y->left = x;
+            link = x;
     }
 
-    void rotate_right(node_type* x) noexcept
+    static constexpr bool is_counted = rbtree_is_counted_v<Tag>;
+
+    static constexpr bool is_augmented =
+        is_counted || !std::is_same_v<Augment, rbtree_no_augment>;
+
+    using prefix_policy = typename rbtree_key_prefix<Tag>::type;
+    using prefix_type = typename prefix_policy::prefix_type;
+
+    static constexpr bool is_prefixed =
+        !std::is_same_v<prefix_policy, rbtree_no_prefix>;
+
+    // A key searched for by a descent, together with its prefix (see
+    // `rbtree_prefixed`).
+    template <typename Key>
+    struct key_probe {
+        const Key& key;
+        prefix_type prefix;
+    };
+
+    template <typename Key>
+    key_probe<Key> make_probe(const Key& key) const noexcept
     {
-        assert(x->left != nullptr);
-        node_type* y = x->left; 
-        x->left = y->right;
-        if (y->right)
-            y->right->set_parent(x);
-        y->set_parent(x->parent());
-        if (x->parent() == &head_)
-            set_root(y);
-        else if (x == x->parent()->left)
-            x->parent()->left = y;
+        if constexpr (is_prefixed)
+            return { key, prefix_policy()(key) };
         else
-            x->parent()->right = y;
-        x->set_parent(y);
-        y->right = x;
-    }
+            return { key, prefix_type() };
+    }
+
+    // True if keys of type `Key` are compared to the keys of the tree by
+    // the built-in `<`, s.t. a three-way comparison needs no branch.
+    template <typename Key>
+    static constexpr bool is_arithmetic_compare =
+        std::is_arithmetic_v<Key> && std::is_arithmetic_v<key_type>
+        && (std::is_same_v<Compare, std::less<key_type>>
+            || std::is_same_v<Compare, std::less<>>);
+
+    // Returns a negative value, zero or a positive value if the key of
+    // `probe` is less than, equal to or greater than the key of `x`.
+    template <typename Key>
+    int probe_compare(
+        const key_probe<Key>& probe, const node_type* x) const noexcept
+    {
+        if constexpr (is_prefixed) {
+            if (probe.prefix != x->key_prefix)
+                return probe.prefix < x->key_prefix ? -1 : 1;
+        }
+
+        const key_type& key = to_key(x);
+        if constexpr (rbtree_has_compare3<Compare, Key, key_type>::value) {
+            return get_compare().compare3(probe.key, key);
+        } else if constexpr (is_arithmetic_compare<Key>) {
+            return int(key < probe.key) - int(probe.key < key);
+        } else {
+            if (is_less_than(probe.key, key))
+                return -1;
+            return is_less_than(key, probe.key) ? 1 : 0;
+        }
+    }
+
+    // Returns true if the key of `probe` is less than the key of `x`.
+    template <typename Key>
+    bool probe_less(
+        const key_probe<Key>& probe, const node_type* x) const noexcept
+    {
+        if constexpr (is_prefixed) {
+            if (probe.prefix != x->key_prefix)
+                return probe.prefix < x->key_prefix;
+        }
+        return is_less_than(probe.key, to_key(x));
+    }
+
+    // Returns true if the key of `x` is less than the key of `probe`.
+    template <typename Key>
+    bool less_than_probe(
+        const node_type* x, const key_probe<Key>& probe) const noexcept
+    {
+        if constexpr (is_prefixed) {
+            if (x->key_prefix != probe.prefix)
+                return x->key_prefix < probe.prefix;
+        }
+        return is_less_than(to_key(x), probe.key);
+    }
+
+    void set_key_prefix(node_type* x) noexcept
+    {
+        if constexpr (is_prefixed)
+            x->key_prefix = prefix_policy()(to_key(x));
+    }
+
+    // Recomputes the augmented data of `x` from its children.
+    void update_node(node_type* x) noexcept
+    {
+        if constexpr (is_counted)
+            x->update_size();
+
+        if constexpr (!std::is_same_v<Augment, rbtree_no_augment>) {
+            const value_type* left = x->left ? &to_value(x->left) : nullptr;
+            const value_type* right = x->right ? &to_value(x->right) : nullptr;
+            get_augment()(to_value(x), left, right);
+        }
+    }
+
+    // Recomputes the augmented data of `x` and all its ancestors.
+    void update_path(node_type* x) noexcept
+    {
+        if constexpr (is_augmented) {
+            while (x && x != &head_) {
+                update_node(x);
+                x = x->parent();
+            }
+        }
+    }
+
+    void rotate_left(node_type* x) noexcept
+    {
+        assert(x->right != nullptr);
+        node_type* y = x->right; 
+        store_link(x->right, y->left);
+        if (y->left)
+            y->left->set_parent(x);
+        y->set_parent(x->parent());
+        if (x->parent() == &head_)
+            set_root(y);
+        else if (x == x->parent()->left)
+            store_link(x->parent()->left, y);
+        else
+            store_link(x->parent()->right, y);
+        x->set_parent(y);
+        store_link(y->left, x);
+        update_node(x);
+        update_node(y);
+        get_stats().on_rotation();
+    }
+
+    void rotate_right(node_type* x) noexcept
+    {
+        assert(x->left != nullptr);
+        node_type* y = x->left; 
+        store_link(x->left, y->right);
+        if (y->right)
+            y->right->set_parent(x);
+        y->set_parent(x->parent());
+        if (x->parent() == &head_)
+            set_root(y);
+        else if (x == x->parent()->left)
+            store_link(x->parent()->left, y);
+        else
+            store_link(x->parent()->right, y);
+        x->set_parent(y);
+        store_link(y->right, x);
+        update_node(x);
+        update_node(y);
+        get_stats().on_rotation();
+    }
 
-    void insert_fixup(node_type* z) noexcept
+    // Returns whether the fixup had to recolor the root, i.e., whether the
+    // black-height of the tree grew by one.
+    bool insert_fixup(node_type* z) noexcept
     {
+        size_t iterations = 0;
         while (z->parent() != &head_
                && z->parent()->is_red()
                && z->parent()->parent() != &head_)
         {
+            ++iterations;
             if (z->parent() == z->parent()->parent()->left) {
                 node_type* y = z->parent()->parent()->right;
                 if (y && y->is_red()) {
@@ -369,7 +1075,10 @@ private:
                 }
             }
         }
+        get_stats().on_insert_fixup(iterations);
+        bool grew = root()->is_red();
         root()->set_black();
+        return grew;
     }
 
     template <typename Self, typename Key>
@@ -378,19 +1087,454 @@ private:
     {
         using iterator_type = decltype(self->begin());
 
+        auto probe = self->make_probe(key);
+        auto x = self->root();
+        size_t comparisons = 0;
+        while (x) {
+            int c = self->probe_compare(probe, x);
+            ++comparisons;
+            if (c == 0)
+                break;
+            x = c < 0 ? x->left : x->right;
+        }
+        self->get_stats().on_find(comparisons);
+        return x ? iterator_type(x) : self->end();
+    }
+
+    // Returns the first node in the subtree `x` whose key is not less than
+    // `key`, or `y` if there is no such node.
+    template <typename Self, typename Node, typename Key>
+    static Node* lower_bound_node(
+        Self* self, Node* x, Node* y, const Key& key) noexcept
+    {
+        auto probe = self->make_probe(key);
+        while (x) {
+            bool left = !self->less_than_probe(x, probe);
+            y = left ? x : y;
+            x = left ? x->left : x->right;
+        }
+        return y;
+    }
+
+    // Returns the first node in the subtree `x` whose key is greater than
+    // `key`, or `y` if there is no such node.
+    template <typename Self, typename Node, typename Key>
+    static Node* upper_bound_node(
+        Self* self, Node* x, Node* y, const Key& key) noexcept
+    {
+        auto probe = self->make_probe(key);
+        while (x) {
+            bool left = self->probe_less(probe, x);
+            y = left ? x : y;
+            x = left ? x->left : x->right;
+        }
+        return y;
+    }
+
+    template <typename Self, typename Key>
+    static auto equal_range_node(Self* self, const Key& key) noexcept
+        -> std::pair<decltype(self->begin()), decltype(self->begin())>
+    {
+        using iterator_type = decltype(self->begin());
+
+        auto probe = self->make_probe(key);
         auto x = self->root();
+        auto y = &self->head_;
         while (x) {
-            if (self->is_less_than(key, self->to_key(x))) {
+            if (self->less_than_probe(x, probe)) {
+                x = x->right;
+            } else if (self->probe_less(probe, x)) {
+                y = x;
                 x = x->left;
             } else {
-                if (self->is_less_than(self->to_key(x), key)) {
-                    x = x->right;
-                } else {
-                    return iterator_type(x);
+                // Both bounds are below `x`; continue the descent for
+                // each of them in the corresponding subtree.
+                decltype(x) xu = x->right;
+                decltype(y) yu = y;
+                decltype(x) xl = x->left;
+                return {
+                    iterator_type(lower_bound_node(self, xl, x, key)),
+                    iterator_type(upper_bound_node(self, xu, yu, key)) };
+            }
+        }
+        return { iterator_type(y), iterator_type(y) };
+    }
+
+    // Returns the number of elements less than (resp. not greater than if
+    // `upper`) `key`.
+    template <typename Key>
+    size_t rank_node(const Key& key, bool upper = false) const noexcept
+    {
+        static_assert(is_counted, "`rank` requires counted nodes.");
+
+        auto probe = make_probe(key);
+        size_t rank = 0;
+        const node_type* x = root();
+        while (x) {
+            if (upper ? !probe_less(probe, x) : less_than_probe(x, probe)) {
+                rank += node_type::subtree_size(x->left) + 1;
+                x = x->right;
+            } else {
+                x = x->left;
+            }
+        }
+        return rank;
+    }
+
+    template <typename Key>
+    size_t count_node(const Key& key) const noexcept
+    {
+        if constexpr (is_counted) {
+            return rank_node(key, true) - rank_node(key);
+        } else {
+            auto range = equal_range_node(this, key);
+            return size_t(std::distance(range.first, range.second));
+        }
+    }
+
+    template <typename Key, typename Disposer>
+    size_t erase_equal_helper(const Key& key, Disposer& disposer) noexcept
+    {
+        static_assert(std::is_invocable_v<Disposer, value_type*>);
+
+        node_type* x = lower_bound_node(this, root(), &head_, key);
+        size_t count = 0;
+        while (x != &head_ && !is_less_than(key, to_key(x))) {
+            node_type* next = iterator::next(x);
+            erase_node(x);
+            reset_node(x);
+            disposer(&to_value(x));
+            x = next;
+            count++;
+        }
+        return count;
+    }
+
+    // Either the node `existing` with a key equal to the searched key, or
+    // the node `parent` below which the key is to be inserted as `left`
+    // resp. right child (`parent` is null for an empty tree).
+    struct insert_position {
+        node_type* parent = nullptr;
+        bool left = false;
+        node_type* existing = nullptr;
+    };
+
+    // Returns true if the key of `x` is greater than the key of its
+    // predecessor and less than the key of its successor, i.e., `x` is at
+    // the right position for its (possibly modified) key.
+    bool is_in_order(const node_type* x) const noexcept
+    {
+        if (x != head_.left
+                && !is_less_than(to_key(const_iterator::prev(x)), to_key(x)))
+            return false;
+        if (x != head_.right
+                && !is_less_than(to_key(x), to_key(const_iterator::next(x))))
+            return false;
+        return true;
+    }
+
+    template <typename Key>
+    insert_position find_insert_position(const Key& key) noexcept
+    {
+        return find_insert_position_below(root(), key);
+    }
+
+    // Same as above, but the descent starts at `x`, whose subtree must
+    // span the position of `key`.
+    template <typename Key>
+    insert_position find_insert_position_below(
+        node_type* x, const Key& key) noexcept
+    {
+        auto probe = make_probe(key);
+        node_type* y = nullptr;
+        bool left = false;
+        size_t comparisons = 0;
+
+        while (x) {
+            y = x;
+
+            int c = probe_compare(probe, x);
+            ++comparisons;
+            if (c == 0) {
+                // The tree already corresponds an entry with `key`.
+                get_stats().on_insert_descent(comparisons);
+                return { y, false, x };
+            }
+            left = c < 0;
+            x = left ? y->left : y->right;
+        }
+
+        get_stats().on_insert_descent(comparisons);
+        return { y, left, nullptr };
+    }
+
+    // Returns the position after all elements with a key equal to `key`,
+    // s.t. equal keys are kept in insertion order. Never sets `existing`.
+    template <typename Key>
+    insert_position find_insert_equal_position(const Key& key) noexcept
+    {
+        auto probe = make_probe(key);
+        node_type* x = root();
+        node_type* y = nullptr;
+        bool left = false;
+        size_t comparisons = 0;
+        while (x) {
+            y = x;
+            left = probe_less(probe, x);
+            ++comparisons;
+            x = left ? x->left : x->right;
+        }
+        get_stats().on_insert_descent(comparisons);
+        return { y, left, nullptr };
+    }
+
+    // Same as `find_insert_position(key)`, but checks first whether `key`
+    // belongs right before or after `hint` (as for `std::set::insert(hint,
+    // value)`).
+    template <typename Key>
+    insert_position find_insert_position(
+        const_iterator hint, const Key& key) noexcept
+    {
+        node_type* pos = const_cast<node_type*>(hint.curr_);
+
+        if (pos == &head_) {
+            if (!empty() && is_less_than(to_key(head_.right), key))
+                return { head_.right, false, nullptr };
+            return find_insert_position(key);
+        }
+
+        if (is_less_than(key, to_key(pos))) {
+            if (pos == head_.left)
+                return { pos, true, nullptr };
+
+            node_type* before = const_cast<node_type*>((--hint).curr_);
+            if (!is_less_than(to_key(before), key))
+                return find_insert_position(key);
+
+            // `key` belongs between `before` and `pos`, of which one has
+            // a free slot on the corresponding side.
+            if (before->right == nullptr)
+                return { before, false, nullptr };
+            return { pos, true, nullptr };
+        }
+
+        if (is_less_than(to_key(pos), key)) {
+            if (pos == head_.right)
+                return { pos, false, nullptr };
+
+            node_type* after = const_cast<node_type*>((++hint).curr_);
+            if (!is_less_than(key, to_key(after)))
+                return find_insert_position(key);
+
+            if (pos->right == nullptr)
+                return { pos, false, nullptr };
+            return { after, true, nullptr };
+        }
+
+        return { pos, false, pos };
+    }
+
+    // Climbs from `x` up to the lowest ancestor whose subtree spans the
+    // position of `key`, which must differ from the key of `x`. If a node
+    // with `key` is passed on the way, it is returned in `existing`. Runs
+    // in O(log d), where d is the distance between `x` and `key`.
+    template <typename Key>
+    node_type* climb_towards(
+        node_type* x, const Key& key, node_type*& existing) noexcept
+    {
+        if (!is_less_than(to_key(x), key))
+            return climb_towards_less(x, key, existing);
+
+        while (x != root()) {
+            node_type* p = x->parent();
+
+            // The subtree of a left child is bounded above by its parent.
+            if (x == p->left) {
+                if (is_less_than(key, to_key(p)))
+                    return x;
+                if (!is_less_than(to_key(p), key)) {
+                    existing = p;
+                    return p;
+                }
+            }
+            x = p;
+        }
+        return x;
+    }
+
+    // Same as `climb_towards`, but `key` must be less than the key of `x`.
+    template <typename Key>
+    node_type* climb_towards_less(
+        node_type* x, const Key& key, node_type*& existing) noexcept
+    {
+        while (x != root()) {
+            node_type* p = x->parent();
+
+            // The subtree of a right child is bounded below by its parent.
+            if (x == p->right) {
+                if (is_less_than(to_key(p), key))
+                    return x;
+                if (!is_less_than(key, to_key(p))) {
+                    existing = p;
+                    return p;
+                }
+            }
+            x = p;
+        }
+        return x;
+    }
+
+    // Links `z` as `left` resp. right child of `y` (or as root if `y` is
+    // null) and rebalances the tree. `z` is initialized before it is
+    // published by a release store, s.t. a concurrent reader which reaches
+    // `z` observes its links.
+    std::pair<iterator, bool>
+    link_node(node_type* y, node_type* z, bool left) noexcept
+    {
+        z->set_parent(y ? y : &head_);
+        store_link(z->left, nullptr);
+        store_link(z->right, nullptr);
+        z->set_red();
+        set_key_prefix(z);
+        update_node(z);
+
+        std::atomic_thread_fence(std::memory_order_release);
+        if (y == nullptr) {
+            head_.set_parent(z);
+            head_.left = z;
+            head_.right = z;
+        } else if (left) {
+            store_link(y->left, z);
+
+            if (head_.left == y)
+                head_.left = z;
+        } else {
+            store_link(y->right, z);
+
+            if (head_.right == y)
+                head_.right = z;
+        }
+
+        update_path(y);
+
+        insert_fixup(z);
+        return { iterator(z), true };
+    }
+
+    template <typename Fn, typename Rollback>
+    std::pair<iterator, bool> update_key_helper(
+        iterator it, Fn& fn, Rollback* rollback)
+    {
+        node_type* x = to_node(*it);
+        fn(to_value(x));
+        set_key_prefix(x);
+
+        if (is_in_order(x)) {
+            if constexpr (!std::is_same_v<Augment, rbtree_no_augment>)
+                update_path(x);
+            return { it, true };
+        }
+
+        const key_type& key = to_key(x);
+        bool moves_right = x != head_.right
+            && !is_less_than(key, to_key(iterator::next(x)));
+        node_type* neighbor =
+            moves_right ? iterator::next(x) : iterator::prev(x);
+        erase_node(x);
+        reset_node(x);
+
+        insert_position pos;
+        if (!is_less_than(key, to_key(neighbor))
+                && !is_less_than(to_key(neighbor), key))
+            pos.existing = neighbor;
+        if (!pos.existing) {
+            node_type* y = climb_towards(neighbor, key, pos.existing);
+            if (!pos.existing)
+                pos = find_insert_position_below(y, key);
+        }
+        if (!pos.existing)
+            return link_node(pos.parent, x, pos.left);
+
+        // The previous position of `x` is right before resp. after its
+        // neighbor, which is still linked.
+        if (rollback) {
+            (*rollback)(to_value(x));
+            iterator hint(moves_right ? neighbor : iterator::next(neighbor));
+            [[maybe_unused]] bool ok = insert(hint, to_value(x)).second;
+            assert(ok && "`rollback` must restore a unique key.");
+        }
+        return { iterator(pos.existing), false };
+    }
+
+    // Looks up the keys in [`first`, `last`) and invokes `fn(index, node)`
+    // for each of them in order, where `node` is null if the key was not
+    // found. The descents of up to `find_many_width` keys are interleaved
+    // and the next node of every descent is prefetched, s.t. the cache
+    // misses of the independent lookups overlap. Each descent compares
+    // as `find_node`.
+    template <typename Self, typename ForwardIt, typename Fn>
+    static void find_many_helper(
+        Self* self, ForwardIt first, ForwardIt last, Fn&& fn) noexcept
+    {
+        using node_pointer = decltype(self->root());
+        using key_arg = std::remove_cv_t<
+            std::remove_reference_t<decltype(*first)>>;
+
+        size_t index = 0;
+        while (first != last) {
+            ForwardIt keys[find_many_width];
+            prefix_type prefixes[find_many_width];
+            node_pointer nodes[find_many_width];
+            node_pointer found[find_many_width];
+            size_t comparisons[find_many_width];
+
+            size_t n = 0;
+            for (; n < find_many_width && first != last; ++n, ++first) {
+                keys[n] = first;
+                prefixes[n] = self->make_probe(*first).prefix;
+                nodes[n] = self->root();
+                found[n] = nullptr;
+                comparisons[n] = 0;
+            }
+
+            size_t active = n;
+            for (size_t k = 0; k < n; k++) {
+                if (!nodes[k]) {
+                    self->get_stats().on_find(0);
+                    active--;
+                }
+            }
+
+            while (active > 0) {
+                for (size_t k = 0; k < n; k++) {
+                    node_pointer x = nodes[k];
+                    if (!x)
+                        continue;
+
+                    key_probe<key_arg> probe{*keys[k], prefixes[k]};
+                    int c = self->probe_compare(probe, x);
+                    ++comparisons[k];
+                    if (c == 0) {
+                        found[k] = x;
+                        x = nullptr;
+                    } else {
+                        x = c < 0 ? x->left : x->right;
+                    }
+
+                    if (x) {
+                        rbtree_prefetch(x);
+                    } else {
+                        self->get_stats().on_find(comparisons[k]);
+                        active--;
+                    }
+                    nodes[k] = x;
                 }
             }
+
+            for (size_t k = 0; k < n; k++)
+                fn(index + k, found[k]);
+            index += n;
         }
-        return self->end();
     }
 
     void transplant(node_type* u, node_type* v) noexcept
@@ -398,21 +1542,22 @@ private:
         if (u->parent() == &head_)
             set_root(v);
         else if (u == u->parent()->left)
-            u->parent()->left = v;
+            store_link(u->parent()->left, v);
         else
-            u->parent()->right = v;
+            store_link(u->parent()->right, v);
         if (v)
             v->set_parent(u->parent());
     }
 
     void erase_node(node_type* z) noexcept
     {
+        // `x` is the node which moves into the place of the removed node
+        // and may be null, hence we have to keep track of its parent.
         node_type* x = nullptr;
+        node_type* x_parent = nullptr;
         node_type* y = z;
-        int y_is_red = y->is_red();
+        bool y_is_red = y->is_red();
 
-        if (head_.parent() == z)
-            head_.set_parent(x);
         if (head_.left == z)
             head_.left = z->right ? find_minimum(z->right) : z->parent();
         if (head_.right == z)
@@ -420,9 +1565,11 @@ private:
 
         if (z->left == nullptr) {
             x = z->right;
+            x_parent = z->parent();
             transplant(z, z->right);
         } else if (z->right == nullptr) {
             x = z->left;
+            x_parent = z->parent();
             transplant(z, z->left);
         } else {
             y = find_minimum(z->right);
@@ -430,92 +1577,103 @@ private:
             x = y->right;
 
             if (y->parent() != z) {
+                x_parent = y->parent();
                 transplant(y, y->right);
-                y->right = z->right;
+                store_link(y->right, z->right);
                 y->right->set_parent(y);
+            } else {
+                x_parent = y;
             }
 
             transplant(z, y);
-            y->left = z->left;
+            store_link(y->left, z->left);
             y->left->set_parent(y);
             y->set_red(z->is_red());
         }
 
-        if (!y_is_red && x)
-            erase_fixup(x);
+        update_path(x_parent);
+
+        if (!y_is_red)
+            erase_fixup(x, x_parent);
     }
 
-    void erase_fixup(node_type* x)
+    void erase_fixup(node_type* x, node_type* x_parent) noexcept
     {
-        while (x != root() && x->is_black()) {
+        size_t iterations = 0;
+        while (x != root() && (x == nullptr || x->is_black())) {
+            ++iterations;
 
-            if (x == x->parent()->left) {
-                node_type* w = x->parent()->right;
+            if (x == x_parent->left) {
+                node_type* w = x_parent->right;
                 assert(w);
 
                 if (w->is_red()) {
                     w->set_black();
-                    x->parent()->set_red();
-                    rotate_left(x->parent());
-                    w = x->parent()->right;
+                    x_parent->set_red();
+                    rotate_left(x_parent);
+                    w = x_parent->right;
                     assert(w);
                 }
 
                 if ((!w->left || w->left->is_black()) &&
                     (!w->right || w->right->is_black())) {
                     w->set_red();
-                    x = x->parent();
+                    x = x_parent;
+                    x_parent = x->parent();
                 } else {
                     if (!w->right || w->right->is_black()) {
                         w->left->set_black();
                         w->set_red();
                         rotate_right(w);
-                        w = x->parent()->right;
+                        w = x_parent->right;
                         assert(w);
                     }
 
-                    w->set_red(x->parent()->is_red());
-                    x->parent()->set_black();
+                    w->set_red(x_parent->is_red());
+                    x_parent->set_black();
                     if (w->right)
                         w->right->set_black();
-                    rotate_left(x->parent());
+                    rotate_left(x_parent);
                     x = root();
                 }
             } else {
-                node_type* w = x->parent()->left;
+                node_type* w = x_parent->left;
                 assert(w);
 
                 if (w->is_red()) {
                     w->set_black();
-                    x->parent()->set_red();
-                    rotate_right(x->parent());
-                    w = x->parent()->left;
+                    x_parent->set_red();
+                    rotate_right(x_parent);
+                    w = x_parent->left;
                     assert(w);
                 }
 
                 if ((!w->right || w->right->is_black()) &&
                     (!w->left || w->left->is_black())) {
                     w->set_red();
-                    x = x->parent();
+                    x = x_parent;
+                    x_parent = x->parent();
                 } else {
                     if (!w->left || w->left->is_black()) {
                         w->right->set_black();
                         w->set_red();
                         rotate_left(w);
-                        w = x->parent()->left;
+                        w = x_parent->left;
                         assert(w);
                     }
 
-                    w->set_red(x->parent()->is_red());
-                    x->parent()->set_black();
+                    w->set_red(x_parent->is_red());
+                    x_parent->set_black();
                     if (w->left)
                         w->left->set_black();
-                    rotate_right(x->parent());
+                    rotate_right(x_parent);
                     x = root();
                 }
             }
         }
-        x->set_black();
+        get_stats().on_erase_fixup(iterations);
+        if (x)
+            x->set_black();
     }
 
     node_type* find_minimum(node_type* x) noexcept
@@ -536,163 +1694,751 @@ private:
     static void reset_node(node_type* node) noexcept
     {
         node->set_parent(nullptr);
-        node->left = nullptr;
-        node->right = nullptr;
+        store_link(node->left, nullptr);
+        store_link(node->right, nullptr);
     }
 
-    // Unlinks all nodes from the subtree defined by `x` (including `x`)
-    // and disposes them via `disposer`.
-    template <typename Disposer>
-    void clear_and_dispose_helper(Disposer disposer, node_type* x) noexcept
+    // Returns the element referred to by an element of a sorted range,
+    // which is either the element itself or a pointer to it.
+    template <typename Elem>
+    static value_type& sorted_value(Elem&& elem) noexcept
+    {
+        if constexpr (std::is_pointer_v<std::decay_t<Elem>>)
+            return *elem;
+        else
+            return elem;
+    }
+
+    // Builds a balanced subtree from the next `n` elements of `it` (in
+    // order) and returns its root. Nodes at `red_depth` are colored red.
+    template <typename It>
+    node_type* build_sorted(
+        It& it, size_t n, size_t depth, size_t red_depth) noexcept
+    {
+        if (n == 0)
+            return nullptr;
+
+        size_t n_left = (n - 1) / 2;
+        node_type* left = build_sorted(it, n_left, depth + 1, red_depth);
+
+        node_type* x = to_node(sorted_value(*it));
+        ++it;
+        x->reset();
+        set_key_prefix(x);
+
+        node_type* right =
+            build_sorted(it, n - n_left - 1, depth + 1, red_depth);
+
+        x->left = left;
+        if (left)
+            left->set_parent(x);
+        x->right = right;
+        if (right)
+            right->set_parent(x);
+        x->set_red(depth == red_depth);
+        update_node(x);
+
+        return x;
+    }
+
+    // Builds the tree from the `n` sorted elements of `first`. The tree
+    // must be empty.
+    template <typename It>
+    void build_from_sorted(It first, size_t n) noexcept
+    {
+        assert(empty());
+        if (n == 0)
+            return;
+
+        // All levels above `red_depth` are complete. Coloring the nodes on
+        // the last, incomplete level red results in equal black-heights.
+        size_t red_depth = 0;
+        while ((size_t(2) << red_depth) <= n + 1)
+            red_depth++;
+
+        head_.left = to_node(sorted_value(*first));
+        set_root(build_sorted(first, n, 0, red_depth));
+        root()->set_black();
+        head_.right = find_maximum(root());
+    }
+
+    // A list of nodes linked via `right` (see `flatten`).
+    struct sorted_list {
+        node_type* first = nullptr;
+        node_type* last = nullptr;
+        size_t size = 0;
+
+        void push_back(node_type* x) noexcept
+        {
+            if (last)
+                last->right = x;
+            else
+                first = x;
+            last = x;
+            size++;
+        }
+    };
+
+    struct list_iterator {
+        node_type* x;
+
+        value_type& operator*() const noexcept
+        {
+            return *static_cast<value_type*>(x);
+        }
+
+        list_iterator& operator++() noexcept
+        {
+            x = x->right;
+            return *this;
+        }
+    };
+
+    // Turns the subtree `x` into a list linked via `right` in order by
+    // right rotations and returns its first node. Runs in O(n).
+    static node_type* flatten(node_type* x) noexcept
     {
+        sorted_list list;
         while (x) {
             node_type* s = x->left;
 
             if (s) {
-                // Right rotate until `x` has no left child anymore.
                 x->left = s->right;
                 s->right = x;
+                x = s;
             } else {
-                // If `x` has no left child anymore we can erase it.
                 s = x->right;
-                //reset_node(x);
-                disposer(&to_value(x));
+                list.push_back(x);
+                x = s;
             }
-
-            x = s;
         }
+        return list.first;
     }
 
-    const GetKeyForValue& get_get_key_for_value() const noexcept
+    // Returns the number of black nodes on a path from `x` to a leaf,
+    // where a red `x` itself does not count.
+    static size_t black_height(const node_type* x) noexcept
     {
-        return *static_cast<const GetKeyForValue*>(this);
+        size_t bh = 0;
+        for (; x; x = x->left)
+            bh += x->is_black();
+        return bh;
     }
 
-    GetKeyForValue& get_get_key_for_value() noexcept
-    {
-        return *static_cast<GetKeyForValue*>(this);
-    }
+    // The height of a valid tree with less than 2^64 nodes is at most
+    // `2 * 64`. Deeper paths indicate a corrupted (e.g. cyclic) tree.
+    static constexpr size_t max_valid_height = 128;
 
-    const Compare& get_compare() const noexcept
+    // Checks the invariants local to `x`: the parent links of its children,
+    // no red child below a red `x`, and the size resp. key prefix cached in
+    // `x`.
+    bool is_valid_node(const node_type* x) const noexcept
     {
-        return *static_cast<const Compare*>(this);
+        for (const node_type* y : {x->left, x->right}) {
+            if (y && (y->parent() != x || (x->is_red() && y->is_red())))
+                return false;
+        }
+        if constexpr (is_counted) {
+            if (node_type::subtree_size(x) != 1
+                    + node_type::subtree_size(x->left)
+                    + node_type::subtree_size(x->right))
+                return false;
+        }
+        if constexpr (is_prefixed) {
+            if (x->key_prefix != prefix_policy()(to_key(x)))
+                return false;
+        }
+        return true;
     }
 
-    Compare& get_compare() noexcept
+    // Checks the subtree `x` at depth `depth`, where `prev` is the in-order
+    // predecessor of the subtree (or null) and is updated to its greatest
+    // node. Returns the black-height of the subtree, or -1 if it is invalid.
+    ptrdiff_t validate_subtree(
+        const node_type* x, size_t depth,
+        const node_type*& prev) const noexcept
     {
-        return *static_cast<Compare*>(this);
+        if (!x)
+            return 0;
+        if (depth >= max_valid_height || !is_valid_node(x))
+            return -1;
+
+        ptrdiff_t bh = validate_subtree(x->left, depth + 1, prev);
+        if (bh < 0)
+            return -1;
+        if (prev && is_less_than(to_key(x), to_key(prev)))
+            return -1;
+        prev = x;
+        if (validate_subtree(x->right, depth + 1, prev) != bh)
+            return -1;
+        return bh + x->is_black();
+    }
+
+    // Checks the root and that the cached extremes are the leftmost resp.
+    // rightmost nodes in O(log n).
+    bool validate_root() const noexcept
+    {
+        const node_type* x = root();
+        if (!x)
+            return head_.left == &head_ && head_.right == &head_;
+        if (x->parent() != &head_ || x->is_red() || !head_.is_red())
+            return false;
+
+        const node_type* l = x;
+        const node_type* r = x;
+        for (size_t depth = 0; l->left || r->right; ++depth) {
+            if (depth >= max_valid_height)
+                return false;
+            l = l->left ? l->left : l;
+            r = r->right ? r->right : r;
+        }
+        return head_.left == l && head_.right == r;
     }
 
-public:
-    rbtree(
-        const GetKeyForValue& get_key = GetKeyForValue(),
-        const Compare& compare = Compare()) noexcept :
-        GetKeyForValue(get_key), Compare(compare)
+    void update_extremes() noexcept
     {
-        head_.left = &head_;
-        head_.right = &head_;
+        if (root()) {
+            head_.left = find_minimum(root());
+            head_.right = find_maximum(root());
+        } else {
+            head_.left = &head_;
+            head_.right = &head_;
+        }
     }
-  
-    rbtree(rbtree&& other) noexcept :
-        rbtree(other.get_get_key_for_value(), other.get_compare())
+
+    // Joins the subtrees `l` and `r` with the black-heights `bl` and `br`
+    // and the node `k` in between into the new root of this tree (the
+    // cached extremes are not updated). Returns the new black-height.
+    //
+    // The node is linked into the taller subtree where the black-height
+    // matches the one of the other subtree and the tree is rebalanced as
+    // after an insertion, which runs in O(|bl - br| + 1).
+    size_t join_subtrees(
+        node_type* l, size_t bl, node_type* k, node_type* r, size_t br) noexcept
     {
-        swap(other);
-    }
-  
-    rbtree& operator=(rbtree&& other) noexcept
+        if (l && l->is_red()) {
+            l->set_black();
+            bl++;
+        }
+        if (r && r->is_red()) {
+            r->set_black();
+            br++;
+        }
+
+        k->left = nullptr;
+        k->right = nullptr;
+
+        if (bl == br) {
+            k->left = l;
+            if (l)
+                l->set_parent(k);
+            k->right = r;
+            if (r)
+                r->set_parent(k);
+            set_root(k);
+            k->set_black();
+            update_node(k);
+            return bl + 1;
+        }
+
+        if (bl > br) {
+            // Descent along the right spine of `l`.
+            set_root(l);
+            node_type* p = nullptr;
+            node_type* c = l;
+            size_t h = bl;
+            while (c && !(c->is_black() && h == br)) {
+                if (c->is_black())
+                    h--;
+                p = c;
+                c = c->right;
+            }
+
+            k->left = c;
+            if (c)
+                c->set_parent(k);
+            k->right = r;
+            if (r)
+                r->set_parent(k);
+            k->set_parent(p);
+            p->right = k;
+            k->set_red();
+            update_node(k);
+            update_path(p);
+            return bl + insert_fixup(k);
+        } else {
+            // Descent along the left spine of `r`.
+            set_root(r);
+            node_type* p = nullptr;
+            node_type* c = r;
+            size_t h = br;
+            while (c && !(c->is_black() && h == bl)) {
+                if (c->is_black())
+                    h--;
+                p = c;
+                c = c->left;
+            }
+
+            k->right = c;
+            if (c)
+                c->set_parent(k);
+            k->left = l;
+            if (l)
+                l->set_parent(k);
+            k->set_parent(p);
+            p->left = k;
+            k->set_red();
+            update_node(k);
+            update_path(p);
+            return br + insert_fixup(k);
+        }
+    }
+
+    // Splits the subtree `x` at depth `depth` with black-height `bh` into
+    // the nodes for which `is_greater(x, depth)` is false, which are joined
+    // into this tree, and the others, which are joined into `greater`.
+    // `is_greater` must be false for a prefix of the nodes in order. Both
+    // trees must be empty before. Returns the resulting black-heights.
+    template <typename IsGreater>
+    std::pair<size_t, size_t> split_subtree(
+        node_type* x, size_t bh, size_t depth, IsGreater& is_greater,
+        rbtree& greater) noexcept
     {
-        swap(other);
-        return *this;
+        if (x == nullptr)
+            return { 0, 0 };
+
+        size_t bh_child = bh - x->is_black();
+        node_type* l = x->left;
+        node_type* r = x->right;
+
+        if (is_greater(x, depth)) {
+            auto rv = split_subtree(
+                l, bh_child, depth + 1, is_greater, greater);
+            rv.second = greater.join_subtrees(
+                greater.root(), rv.second, x, r, bh_child);
+            return rv;
+        } else {
+            auto rv = split_subtree(
+                r, bh_child, depth + 1, is_greater, greater);
+            rv.first = join_subtrees(l, bh_child, x, root(), rv.first);
+            return rv;
+        }
     }
-  
-    ~rbtree() noexcept
+
+    template <typename IsGreater>
+    rbtree split_if(IsGreater& is_greater) noexcept
     {
+        rbtree greater(get_get_key_for_value(), get_compare(), get_augment());
+
+        node_type* x = root();
+        size_t bh = black_height(x);
         clear();
+
+        split_subtree(x, bh, 0, is_greater, greater);
+        update_extremes();
+        greater.update_extremes();
+        return greater;
     }
 
-    template <
-        typename Cloner, typename Disposer,
-        typename = std::enable_if_t<std::is_invocable_r_v<T*, Cloner, const T*>>,
-        typename = std::enable_if_t<std::is_invocable_v<Disposer, T*>>>
-    rbtree clone(Cloner cloner, Disposer disposer) const
+    template <typename Key>
+    rbtree split_helper(const Key& key) noexcept
+    {
+        auto is_greater = [&](const node_type* x, size_t) {
+            return is_less_than(key, to_key(x));
+        };
+        return split_if(is_greater);
+    }
+
+    // Moves `z` and all elements after it into the returned tree in
+    // O(log n). Unlike a split by key, this is exact for equal keys.
+    rbtree split_before(node_type* z) noexcept
+    {
+        // The path from the root to `z`, along which the split descends
+        // until it reaches `z` and then continues below `z->left`.
+        const node_type* path[max_valid_height];
+        size_t depth = 0;
+        for (const node_type* x = z; x != &head_; x = x->parent())
+            ++depth;
+        assert(depth <= max_valid_height);
+        size_t i = depth;
+        for (const node_type* x = z; x != &head_; x = x->parent())
+            path[--i] = x;
+
+        auto is_greater = [&](const node_type* x, size_t d) {
+            if (d >= depth || path[d] != x)
+                return false;
+            return x == z || path[d + 1] == x->left;
+        };
+        return split_if(is_greater);
+    }
+
+    // Moves the elements of `rest`, none of which may be less than an
+    // element of this tree, to the end of this tree in O(log n) (see
+    // `join`). Unlike `join`, equal keys are allowed at the seam.
+    void append(rbtree& rest) noexcept
     {
-        rbtree rv(get_get_key_for_value(), get_compare());
+        if (rest.empty())
+            return;
+
+        node_type* k = rest.head_.left;
+        rest.erase_node(k);
+        node_type* l = root();
+        node_type* r = rest.root();
+        rest.clear();
 
+        k->reset();
+        set_key_prefix(k);
+        join_subtrees(l, black_height(l), k, r, black_height(r));
+        update_extremes();
+    }
+
+    // Same as `find_node`, but starts at `hint` (see `find_from`).
+    template <typename Key>
+    iterator find_from_node(node_type* hint, const Key& key) noexcept
+    {
         if (empty())
-            return rv;
+            return end();
 
-        // Rollback if cloner throws.
-        bool rollback = true;
-        auto _ = finally([&]() {
-            if (!rollback)
-                return;
+        auto probe = make_probe(key);
+        node_type* x = hint == &head_ ? head_.right : hint;
+        if (probe_compare(probe, x) == 0)
+            return iterator(x);
 
-            node_type* x = rv.root();
-            while (x) {
-                node_type* save = x->left;
+        node_type* existing = nullptr;
+        x = climb_towards(x, key, existing);
+        if (existing)
+            return iterator(existing);
 
-                if (save) {
-                    x->left = save->right;
-                    save->right = x;
-                } else {
-                    save = x->right;
-                    disposer(static_cast<value_type*>(x));
-                }
-                x = save;
+        size_t comparisons = 0;
+        while (x) {
+            int c = probe_compare(probe, x);
+            ++comparisons;
+            if (c == 0)
+                break;
+            x = c < 0 ? x->left : x->right;
+        }
+        get_stats().on_find(comparisons);
+        return x ? iterator(x) : end();
+    }
+
+    // Unlinks all nodes from the subtree defined by `x` (including `x`)
+    // and disposes them via `disposer`.
+    template <typename Disposer>
+    void clear_and_dispose_helper(Disposer disposer, node_type* x) noexcept
+    {
+        while (x) {
+            node_type* s = x->left;
+
+            if (s) {
+                // Right rotate until `x` has no left child anymore.
+                x->left = s->right;
+                s->right = x;
+            } else {
+                // If `x` has no left child anymore we can erase it.
+                s = x->right;
+                //reset_node(x);
+                disposer(&to_value(x));
             }
-        });
 
-        // Clone the tree.
-        const node_type* node_orig = root();
-        node_type* node_clone =
-            cloner(static_cast<const value_type*>(node_orig));
+            x = s;
+        }
+    }
 
-        node_clone->set_parent(&rv.head_);
-        node_clone->set_red(node_orig->is_red());
+    // Returns the node below `x` reached by following the `depth` lowest
+    // bits of `path` (most significant first), where a set bit selects the
+    // right child, or null if there is no such node.
+    template <typename Node>
+    static Node* follow_path(Node* x, size_t path, size_t depth) noexcept
+    {
+        while (x && depth > 0)
+            x = (path >> --depth) & 1 ? x->right : x->left;
+        return x;
+    }
 
-        rv.head_.set_parent(node_clone);
-        rv.head_.left = node_clone;
-        rv.head_.right = node_clone;
+    // Clones the top `depth` levels of the subtree `x` and links the copy
+    // below `parent` (or as the root if `parent` is the head). Each copy is
+    // linked before its children are cloned, s.t. all copies are reachable
+    // if `cloner` throws. Note, the augmented data of the copies is only
+    // computed for complete subtrees.
+    template <typename Cloner>
+    node_type* clone_subtree(
+        const node_type* x, node_type* parent, bool left, size_t depth,
+        Cloner& cloner)
+    {
+        node_type* y = to_node(*cloner(&to_value(x)));
+        y->reset();
+        set_key_prefix(y);
 
-        while (true) {
-            if (node_orig->left && !node_clone->left) {
-                node_orig = node_orig->left;
-                
-                node_type* parent_clone = node_clone;
-                node_clone = cloner(static_cast<const value_type*>(node_orig));
-                node_clone->set_red(node_orig->is_red());
-                parent_clone->left = node_clone;
-                node_clone->set_parent(parent_clone);
-
-                if (node_orig->left == head_.left)
-                    rv.head_.left = node_clone;
-            } else if (node_orig->right && !node_clone->right) {
-                node_orig = node_orig->right;
-                
-                node_type* parent_clone = node_clone;
-                node_clone = cloner(static_cast<const value_type*>(node_orig));
-                node_clone->set_red(node_orig->is_red());
-                parent_clone->right = node_clone;
-                node_clone->set_parent(parent_clone);
-
-                if (node_orig->right == head_.right)
-                    rv.head_.right = node_clone;
-            } else {
-                node_orig = node_orig->parent();
-                node_clone = node_clone->parent();
+        if (parent == &head_) {
+            set_root(y);
+        } else if (left) {
+            y->set_parent(parent);
+            parent->left = y;
+        } else {
+            y->set_parent(parent);
+            parent->right = y;
+        }
+        y->set_red(x->is_red());
 
-                if (node_orig == &head_)
-                    break;
-            }
+        if (depth == 1)
+            return y;
+        if (x->left)
+            clone_subtree(x->left, y, true, depth - 1, cloner);
+        if (x->right)
+            clone_subtree(x->right, y, false, depth - 1, cloner);
+        update_node(y);
+        return y;
+    }
+
+    void update_subtree(node_type* x, size_t depth) noexcept
+    {
+        if constexpr (is_augmented) {
+            if (!x || depth == 0)
+                return;
+            update_subtree(x->left, depth - 1);
+            update_subtree(x->right, depth - 1);
+            update_node(x);
         }
+    }
 
-        // Everything succeeded. Set `rollback` to false to not trigger
-        // the finally.
-        rollback = false;
+    // Clones the top `depth` levels of the tree and then the subtrees below
+    // them by `run(count, fn)`, which invokes `fn(i)` for all i in [0,
+    // `count`), possibly concurrently.
+    template <typename Cloner, typename Disposer, typename Run>
+    rbtree clone_helper(
+        Cloner& cloner, Disposer& disposer, size_t depth, Run&& run) const
+    {
+        rbtree rv(get_get_key_for_value(), get_compare(), get_augment());
+        if (empty())
+            return rv;
 
+        try {
+            if (depth == 0) {
+                rv.clone_subtree(root(), &rv.head_, false, SIZE_MAX, cloner);
+            } else {
+                rv.clone_subtree(root(), &rv.head_, false, depth, cloner);
+
+                // The parent of the copy of the subtree at `path` is the
+                // copy of the parent of the subtree.
+                auto clone = [&](size_t path) {
+                    const node_type* x = follow_path(root(), path, depth);
+                    if (!x)
+                        return;
+                    node_type* y =
+                        follow_path(rv.root(), path >> 1, depth - 1);
+                    assert(y);
+                    rv.clone_subtree(x, y, !(path & 1), SIZE_MAX, cloner);
+                };
+                run(size_t(1) << depth, clone);
+                rv.update_subtree(rv.root(), depth);
+            }
+        } catch (...) {
+            rv.clear_and_dispose_helper(disposer, rv.root());
+            rv.clear();
+            throw;
+        }
+
+        rv.update_extremes();
         return rv;
     }
 
+    // Disposes of the top `depth` levels of the tree, after the subtrees
+    // below them were disposed of by `run(count, fn)` (see
+    // `clone_helper`).
+    template <typename Disposer, typename Run>
+    void clear_and_dispose_helper(
+        Disposer& disposer, size_t depth, Run&& run) noexcept
+    {
+        auto dispose = [&](size_t path) {
+            node_type* x = follow_path(root(), path, depth);
+            clear_and_dispose_helper(disposer, x);
+        };
+        run(size_t(1) << depth, dispose);
+        dispose_top(disposer, root(), depth);
+        clear();
+    }
+
+    template <typename Disposer>
+    void dispose_top(Disposer& disposer, node_type* x, size_t depth) noexcept
+    {
+        if (!x || depth == 0)
+            return;
+        node_type* left = x->left;
+        node_type* right = x->right;
+        dispose_top(disposer, left, depth - 1);
+        dispose_top(disposer, right, depth - 1);
+        disposer(&to_value(x));
+    }
+
+    template <typename Fn>
+    node_type* invoke_for_parent(Fn&& fn, node_type* parent)
+    {
+        if constexpr (std::is_invocable_v<Fn, value_type*>)
+            return std::forward<Fn>(fn)(parent ? &to_value(parent) : nullptr);
+        else
+            return std::forward<Fn>(fn)();
+    }
+
+    static size_t height(const node_type* x) noexcept
+    {
+        if (!x)
+            return 0;
+        return 1 + std::max(height(x->left), height(x->right));
+    }
+
+    // Moves `x` to `relocate(x)` and redirects all links to it. Returns the
+    // new node.
+    template <typename Relocate>
+    node_type* relocate_node(node_type* x, Relocate& relocate)
+    {
+        node_type hook = *x;
+        node_type* y = to_node(*relocate(&to_value(x)));
+        if (y == x)
+            return x;
+
+        static_cast<node_type&>(*y) = hook;
+
+        node_type* parent = hook.parent();
+        if (parent == &head_)
+            head_.set_parent(y);
+        else if (parent->left == x)
+            parent->left = y;
+        else
+            parent->right = y;
+
+        if (y->left)
+            y->left->set_parent(y);
+        if (y->right)
+            y->right->set_parent(y);
+
+        if (head_.left == x)
+            head_.left = y;
+        if (head_.right == x)
+            head_.right = y;
+        return y;
+    }
+
+    // Relocates the nodes `depth` levels below `x` and their subtrees in
+    // van Emde Boas order with height `height`, or in breadth-first order
+    // if `height` is zero.
+    template <typename Relocate>
+    void relocate_level(
+        node_type* x, size_t depth, size_t height, Relocate& relocate)
+    {
+        if (!x)
+            return;
+        if (depth > 0) {
+            relocate_level(x->left, depth - 1, height, relocate);
+            relocate_level(x->right, depth - 1, height, relocate);
+        } else if (height == 0) {
+            relocate_node(x, relocate);
+        } else {
+            relocate_van_emde_boas(x, height, relocate);
+        }
+    }
+
+    // Relocates the top `height` levels of the subtree `x` in van Emde Boas
+    // order. Returns the new root of the subtree.
+    template <typename Relocate>
+    node_type* relocate_van_emde_boas(
+        node_type* x, size_t height, Relocate& relocate)
+    {
+        if (height == 1)
+            return relocate_node(x, relocate);
+
+        size_t top = height / 2;
+        x = relocate_van_emde_boas(x, top, relocate);
+        relocate_level(x, top, height - top, relocate);
+        return x;
+    }
+
+    const GetKeyForValue& get_get_key_for_value() const noexcept
+    {
+        return *static_cast<const GetKeyForValue*>(this);
+    }
+
+    GetKeyForValue& get_get_key_for_value() noexcept
+    {
+        return *static_cast<GetKeyForValue*>(this);
+    }
+
+    const Compare& get_compare() const noexcept
+    {
+        return *static_cast<const Compare*>(this);
+    }
+
+    Compare& get_compare() noexcept
+    {
+        return *static_cast<Compare*>(this);
+    }
+
+    const Augment& get_augment() const noexcept
+    {
+        return *static_cast<const Augment*>(this);
+    }
+
+    Augment& get_augment() noexcept
+    {
+        return *static_cast<Augment*>(this);
+    }
+
+    Stats& get_stats() noexcept
+    {
+        return *static_cast<Stats*>(this);
+    }
+
+    const Stats& get_stats() const noexcept
+    {
+        return *static_cast<const Stats*>(this);
+    }
+
+public:
+    rbtree(
+        const GetKeyForValue& get_key = GetKeyForValue(),
+        const Compare& compare = Compare(),
+        const Augment& augment = Augment()) noexcept :
+        GetKeyForValue(get_key), Compare(compare), Augment(augment)
+    {
+        // The head is colored red to tell it apart from the root.
+        head_.set_red();
+        head_.left = &head_;
+        head_.right = &head_;
+    }
+  
+    rbtree(rbtree&& other) noexcept :
+        rbtree(
+            other.get_get_key_for_value(), other.get_compare(),
+            other.get_augment())
+    {
+        swap(other);
+    }
+  
+    rbtree& operator=(rbtree&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+  
+    ~rbtree() noexcept
+    {
+        clear();
+    }
+
+    // Returns a copy of the tree, where `cloner(value)` returns a copy of
+    // `value`. If `cloner` throws, the copies made so far are passed to
+    // `disposer` and the exception is rethrown.
+    template <
+        typename Cloner, typename Disposer,
+        typename = std::enable_if_t<std::is_invocable_r_v<T*, Cloner, const T*>>,
+        typename = std::enable_if_t<std::is_invocable_v<Disposer, T*>>>
+    rbtree clone(Cloner cloner, Disposer disposer) const
+    {
+        return clone_helper(cloner, disposer, 0, [](size_t count, auto& fn) {
+            for (size_t i = 0; i < count; ++i)
+                fn(i);
+        });
+    }
+
     // -- iterators ----------------------------------------------------------
 
     const_iterator cbegin() const noexcept
@@ -732,8 +2478,130 @@ public:
         return root() == nullptr;
     }
 
+    // Returns the number of elements in O(1). Requires counted nodes.
+    size_t size() const noexcept
+    {
+        static_assert(is_counted, "`size` requires counted nodes.");
+        return node_type::subtree_size(root());
+    }
+
+    // Returns the number of nodes on the longest path from the root to a
+    // leaf in O(n).
+    size_t height() const noexcept
+    {
+        return height(root());
+    }
+
+    // Returns the number of black nodes on any path from the root to a leaf
+    // in O(log n).
+    size_t black_height() const noexcept
+    {
+        return black_height(root());
+    }
+
+    // -- stats --------------------------------------------------------------
+
+    // Returns the statistics of the tree (see `rbtree_stats`).
+    const Stats& stats() const noexcept
+    {
+        return get_stats();
+    }
+
+    void reset_stats() noexcept
+    {
+        get_stats() = Stats();
+    }
+
+    // -- validation ---------------------------------------------------------
+
+    // Checks all invariants of the tree in one O(n) pass: the order of the
+    // keys, no red node with a red child, equal black-heights, the parent
+    // links, the cached extremes and, if present, the cached subtree sizes
+    // and key prefixes. Returns false if any of them is violated, e.g.,
+    // after the key part of an element was changed in place.
+    bool validate() const noexcept
+    {
+        if (!validate_root())
+            return false;
+        const node_type* prev = nullptr;
+        return validate_subtree(root(), 0, prev) >= 0;
+    }
+
+    // Same as `validate()`, but only checks the path from the root to the
+    // leaf selected by the bits of `path` (e.g. a random number), where the
+    // lowest bit selects the child of the root (1 for right), in O(log n).
+    // The keys on the path are checked against the bounds given by their
+    // ancestors, and its black-height against that of the leftmost path.
+    bool validate_path(uint64_t path) const noexcept
+    {
+        if (!validate_root())
+            return false;
+
+        size_t expected_bh = black_height(root());
+        size_t bh = 0;
+        const node_type* lower = nullptr;
+        const node_type* upper = nullptr;
+        const node_type* x = root();
+        for (size_t depth = 0; x; ++depth) {
+            if (depth >= max_valid_height || !is_valid_node(x))
+                return false;
+            if (lower && is_less_than(to_key(x), to_key(lower)))
+                return false;
+            if (upper && is_less_than(to_key(upper), to_key(x)))
+                return false;
+
+            bh += x->is_black();
+            if ((path >> (depth % 64)) & 1) {
+                lower = x;
+                x = x->right;
+            } else {
+                upper = x;
+                x = x->left;
+            }
+        }
+        return bh == expected_bh;
+    }
+
     // -- lookup -------------------------------------------------------------
 
+    // Returns the least resp. greatest element in O(1). The tree must not
+    // be empty.
+    value_type& front() noexcept
+    {
+        assert(!empty());
+        return to_value(head_.left);
+    }
+
+    const value_type& front() const noexcept
+    {
+        assert(!empty());
+        return to_value(head_.left);
+    }
+
+    value_type& back() noexcept
+    {
+        assert(!empty());
+        return to_value(head_.right);
+    }
+
+    const value_type& back() const noexcept
+    {
+        assert(!empty());
+        return to_value(head_.right);
+    }
+
+    // Returns an iterator to `value`, which must be part of the tree, in
+    // O(1).
+    iterator iterator_to(value_type& value) noexcept
+    {
+        return iterator(to_node(value));
+    }
+
+    const_iterator iterator_to(const value_type& value) const noexcept
+    {
+        return const_iterator(static_cast<const node_type*>(&value));
+    }
+
     bool contains(const key_type& key) const noexcept
     {
         return end() != find_node(this, key);
@@ -744,115 +2612,534 @@ public:
         typename = typename Comp::is_transparent>
     bool contains(const Key& key) const noexcept
     {
-        return end() != find_node(this, key);
+        return end() != find_node(this, key);
+    }
+
+    const_iterator find(const key_type& key) const noexcept
+    {
+        return find_node(this, key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    const_iterator find(const Key& key) const noexcept
+    {
+        return find_node(this, key);
+    }
+
+    iterator find(const key_type& key) noexcept
+    { 
+        return find_node(this, key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    iterator find(const Key& key) noexcept
+    {
+        return find_node(this, key);
+    }
+
+    // Same as `find(key)`, but climbs from `hint` (a finger, e.g. the
+    // result of the previous lookup) to the lowest ancestor whose subtree
+    // spans `key` and descends from there. Takes O(log d), where d is the
+    // distance between `hint` and `key` in order.
+    iterator find_from(const_iterator hint, const key_type& key) noexcept
+    {
+        return find_from_node(const_cast<node_type*>(hint.curr_), key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    iterator find_from(const_iterator hint, const Key& key) noexcept
+    {
+        return find_from_node(const_cast<node_type*>(hint.curr_), key);
+    }
+
+    const_iterator lower_bound(const key_type& key) const noexcept
+    {
+        return const_iterator(lower_bound_node(this, root(), &head_, key));
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    const_iterator lower_bound(const Key& key) const noexcept
+    {
+        return const_iterator(lower_bound_node(this, root(), &head_, key));
+    }
+
+    iterator lower_bound(const key_type& key) noexcept
+    {
+        return iterator(lower_bound_node(this, root(), &head_, key));
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    iterator lower_bound(const Key& key) noexcept
+    {
+        return iterator(lower_bound_node(this, root(), &head_, key));
+    }
+
+    const_iterator upper_bound(const key_type& key) const noexcept
+    {
+        return const_iterator(upper_bound_node(this, root(), &head_, key));
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    const_iterator upper_bound(const Key& key) const noexcept
+    {
+        return const_iterator(upper_bound_node(this, root(), &head_, key));
+    }
+
+    iterator upper_bound(const key_type& key) noexcept
+    {
+        return iterator(upper_bound_node(this, root(), &head_, key));
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    iterator upper_bound(const Key& key) noexcept
+    {
+        return iterator(upper_bound_node(this, root(), &head_, key));
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range(const key_type& key) const noexcept
+    {
+        return equal_range_node(this, key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    std::pair<const_iterator, const_iterator>
+    equal_range(const Key& key) const noexcept
+    {
+        return equal_range_node(this, key);
+    }
+
+    std::pair<iterator, iterator>
+    equal_range(const key_type& key) noexcept
+    {
+        return equal_range_node(this, key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    std::pair<iterator, iterator>
+    equal_range(const Key& key) noexcept
+    {
+        return equal_range_node(this, key);
+    }
+
+    // Returns the number of elements with a key equal to `key`, which takes
+    // O(log n) for counted nodes and O(log n + count) otherwise.
+    size_t count(const key_type& key) const noexcept
+    {
+        return count_node(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    size_t count(const Key& key) const noexcept
+    {
+        return count_node(key);
+    }
+
+    // Number of lookups interleaved by `find_many` and `contains_many`.
+    static constexpr size_t find_many_width = 8;
+
+    // Looks up all keys in [`first`, `last`) and writes an iterator to the
+    // corresponding element (or `end()`) to `out` for each of them. The
+    // keys must be of type `key_type` unless `Compare` is transparent.
+    // Interleaves the lookups to overlap their cache misses, which is
+    // considerably faster than individual `find`s for large trees.
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_many(
+        ForwardIt first, ForwardIt last, OutputIt out) const noexcept
+    {
+        find_many_helper(this, first, last, [&](size_t, const node_type* x) {
+            *out++ = x ? const_iterator(x) : end();
+        });
+        return out;
+    }
+
+    template <typename ForwardIt, typename OutputIt>
+    OutputIt find_many(ForwardIt first, ForwardIt last, OutputIt out) noexcept
+    {
+        find_many_helper(this, first, last, [&](size_t, node_type* x) {
+            *out++ = x ? iterator(x) : end();
+        });
+        return out;
+    }
+
+    // Same as `find_many`, but returns a mask whose `k`-th bit is set if
+    // the `k`-th key is part of the tree. At most 64 keys are allowed.
+    template <typename ForwardIt>
+    uint64_t contains_many(ForwardIt first, ForwardIt last) const noexcept
+    {
+        assert(std::distance(first, last) <= 64);
+
+        uint64_t mask = 0;
+        find_many_helper(this, first, last, [&](size_t k, const node_type* x) {
+            if (x)
+                mask |= uint64_t(1) << k;
+        });
+        return mask;
+    }
+
+    // Returns the `k`-th element (0-based) or `end()` if `k >= size()` in
+    // O(log n). Requires counted nodes.
+    const_iterator nth(size_t k) const noexcept
+    {
+        static_assert(is_counted, "`nth` requires counted nodes.");
+        if (k >= size())
+            return end();
+        return const_iterator(node_type::select(root(), k));
+    }
+
+    iterator nth(size_t k) noexcept
+    {
+        static_assert(is_counted, "`nth` requires counted nodes.");
+        if (k >= size())
+            return end();
+        return iterator(node_type::select(root(), k));
+    }
+
+    // Returns the number of elements less than `key` in O(log n), i.e.,
+    // the position of `lower_bound(key)`. Requires counted nodes.
+    size_t rank(const key_type& key) const noexcept
+    {
+        return rank_node(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    size_t rank(const Key& key) const noexcept
+    {
+        return rank_node(key);
+    }
+
+    // -- modifiers ----------------------------------------------------------
+
+    // Inserts the node returned by `fn()` if `key` is not part of the tree
+    // yet. If `fn(parent)` is well-formed, it is passed the future parent
+    // of the node (or null), e.g., to allocate the node close to it (see
+    // `rbtree_node_pool::allocate_near`).
+    template<typename Key, typename Fn>
+    std::pair<iterator, bool> insert_for_key(const Key& key, Fn&& fn)
+    {
+        insert_position pos = find_insert_position(key);
+        if (pos.existing)
+            return { iterator(pos.existing), false };
+
+        node_type* z = invoke_for_parent(std::forward<Fn>(fn), pos.parent);
+        return link_node(pos.parent, z, pos.left);
+    }
+
+    // Same as `insert_for_key(key, fn)` but with the semantics of `insert(
+    // hint, value)`.
+    template<typename Key, typename Fn>
+    std::pair<iterator, bool>
+    insert_for_key(const_iterator hint, const Key& key, Fn&& fn)
+    {
+        insert_position pos = find_insert_position(hint, key);
+        if (pos.existing)
+            return { iterator(pos.existing), false };
+
+        node_type* z = invoke_for_parent(std::forward<Fn>(fn), pos.parent);
+        return link_node(pos.parent, z, pos.left);
     }
 
-    const_iterator find(const key_type& key) const noexcept
+    std::pair<iterator, bool>
+    insert(value_type& value) noexcept
     {
-        return find_node(this, key);
+        insert_position pos = find_insert_position(to_key(value));
+        if (pos.existing)
+            return { iterator(pos.existing), false };
+
+        node_type* z = to_node(value);      
+        z->reset();
+        return link_node(pos.parent, z, pos.left);
     }
 
-    template <
-        typename Key, typename Comp = Compare,
-        typename = typename Comp::is_transparent>
-    const_iterator find(const Key& key) const noexcept
+    // Inserts `value` as close as possible to the position just prior to
+    // `hint`. If `value` belongs right before or after `hint`, no descent
+    // from the root is necessary and the insertion takes amortized O(1).
+    std::pair<iterator, bool>
+    insert(const_iterator hint, value_type& value) noexcept
     {
-        return find_node(this, key);
-    }
+        insert_position pos = find_insert_position(hint, to_key(value));
+        if (pos.existing)
+            return { iterator(pos.existing), false };
 
-    iterator find(const key_type& key) noexcept
-    { 
-        return find_node(this, key);
+        node_type* z = to_node(value);
+        z->reset();
+        return link_node(pos.parent, z, pos.left);
     }
 
-    template <
-        typename Key, typename Comp = Compare,
-        typename = typename Comp::is_transparent>
-    iterator find(const Key& key) noexcept
+    // Inserts `value` even if the tree already contains elements with an
+    // equal key, after all of them, s.t. equal elements are kept in the
+    // order of their insertion (as for `std::multiset::insert`). This
+    // allows to use the tree as a multiset resp. stable priority queue
+    // without widening the keys by a sequence number. `find` returns any
+    // of the equal elements; use `lower_bound` or `equal_range` to visit
+    // all of them, and note that `insert` still rejects duplicate keys.
+    iterator insert_equal(value_type& value) noexcept
     {
-        return find_node(this, key);
+        insert_position pos = find_insert_equal_position(to_key(value));
+        node_type* z = to_node(value);
+        z->reset();
+        return link_node(pos.parent, z, pos.left).first;
     }
 
-    // -- modifiers ----------------------------------------------------------
-
-    template<typename Key, typename Fn>
-    std::pair<iterator, bool> insert_for_key(const Key& key, Fn&& fn)
+    // Same as `insert_equal(value)` for the node returned by `fn()` (resp.
+    // `fn(parent)`, see `insert_for_key`), which must have the key `key`.
+    template <typename Key, typename Fn>
+    iterator insert_equal_for_key(const Key& key, Fn&& fn)
     {
-        node_type* y = nullptr;
-        node_type* x = root();
+        insert_position pos = find_insert_equal_position(key);
+        node_type* z = invoke_for_parent(std::forward<Fn>(fn), pos.parent);
+        return link_node(pos.parent, z, pos.left).first;
+    }
+
+    // Inserts the elements in [`first`, `last`), which must be sorted in
+    // strictly increasing order. The range may either refer to the elements
+    // or contain pointers to them. Elements whose keys are already part of
+    // the tree are skipped. Returns the number of inserted elements.
+    //
+    // Each descent starts at the previously inserted element and climbs
+    // only as far up as necessary, s.t. inserting k clustered elements
+    // costs O(k log d) instead of O(k log n), where d is the distance
+    // between consecutive elements.
+    template <typename ForwardIt>
+    size_t insert_batch_sorted(ForwardIt first, ForwardIt last) noexcept
+    {
+        size_t count = 0;
+        node_type* prev = nullptr;
 
-        while (x) {
-            y = x;
+        for (; first != last; ++first) {
+            value_type& value = sorted_value(*first);
+            assert(!prev || is_less_than(to_key(prev), to_key(value)));
 
-            if (is_less_than(key, to_key(x))) {
-                x = y->left;
+            insert_position pos;
+            if (prev == nullptr) {
+                pos = find_insert_position(cend(), to_key(value));
             } else {
-                if (is_less_than(to_key(x), key))
-                    x = y->right;
-                else {
-                    // The tree already corresponds an entry with `key`.
-                    return { iterator(x), false };
-                }
+                node_type* x = climb_towards(prev, to_key(value), pos.existing);
+                if (!pos.existing)
+                    pos = find_insert_position_below(x, to_key(value));
             }
+
+            if (pos.existing) {
+                prev = pos.existing;
+                continue;
+            }
+
+            node_type* z = to_node(value);
+            z->reset();
+            prev = link_node(pos.parent, z, pos.left).first.get();
+            count++;
         }
 
-        node_type* z = std::forward<Fn>(fn)();
-        return insert_parent(y, z);
+        return count;
     }
 
-    std::pair<iterator, bool>
-    insert(value_type& value) noexcept
+    // Erases the elements with the keys in [`first`, `last`), which must be
+    // sorted in strictly increasing order, and invokes `disposer` on each
+    // of them. Keys which are not part of the tree are skipped. Returns the
+    // number of erased elements.
+    //
+    // As for `insert_batch_sorted`, each lookup starts at the position of
+    // the previous key instead of the root.
+    template <typename ForwardIt, typename Disposer>
+    size_t erase_batch_sorted(
+        ForwardIt first, ForwardIt last, Disposer disposer) noexcept
     {
-        node_type* y = nullptr;
-        node_type* x = root();
-
-        while (x) {
-            y = x;
+        static_assert(std::is_invocable_v<Disposer, value_type*>);
 
-            if (is_less_than(to_key(value), to_key(x))) {
-                x = y->left;
+        size_t count = 0;
+        node_type* next = nullptr;
+
+        for (; first != last; ++first) {
+            const auto& key = *first;
+
+            // Find the lower bound `z` of `key` starting at `next`, the
+            // lower bound of the previous key.
+            node_type* z = nullptr;
+            if (next == nullptr) {
+                z = lower_bound_node(this, root(), &head_, key);
+            } else if (next == &head_) {
+                break;
+            } else if (!is_less_than(to_key(next), key)) {
+                z = next;
             } else {
-                if (is_less_than(to_key(x), to_key(value)))
-                    x = y->right;
-                else {
-                    // The tree already corresponds an entry with `key`.
-                    return { iterator(x), false };
+                node_type* x = climb_towards(next, key, z);
+                if (!z) {
+                    node_type* bound = x == root() ? &head_ : x->parent();
+                    z = lower_bound_node(this, x, bound, key);
                 }
             }
+
+            if (z == &head_ || is_less_than(key, to_key(z))) {
+                next = z;
+                continue;
+            }
+
+            next = iterator::next(z);
+            erase_node(z);
+            reset_node(z);
+            disposer(&to_value(z));
+            count++;
         }
 
-        node_type* z = to_node(value);      
-        z->reset();
-        return insert_parent(y, z);
+        return count;
+    }
+
+    template <typename ForwardIt>
+    size_t erase_batch_sorted(ForwardIt first, ForwardIt last) noexcept
+    {
+        return erase_batch_sorted(first, last, [](value_type*) {});
+    }
+
+    // Inserts `value` in amortized O(1) if it is greater than all elements
+    // in the tree. Otherwise, it falls back to `insert(value)`.
+    std::pair<iterator, bool>
+    push_back(value_type& value) noexcept
+    {
+        return insert(cend(), value);
+    }
+
+    // Inserts `value` in amortized O(1) if it is less than all elements in
+    // the tree. Otherwise, it falls back to `insert(value)`.
+    std::pair<iterator, bool>
+    push_front(value_type& value) noexcept
+    {
+        return insert(cbegin(), value);
     }
   
     std::pair<iterator, bool>
     insert_parent(node_type* y, node_type* z) noexcept
     {
-        if (y == nullptr) {
-            set_root(z);
-            head_.left = root();
-            head_.right = root();
-        } else if (is_less_than(to_key(z), to_key(y))) {
-            z->set_parent(y);
-            y->left = z;
+        return link_node(y, z, y && is_less_than(to_key(z), to_key(y)));
+    }
+
+    // Modifies the key of `*it` by `fn(*it)`. If the element is still
+    // between its neighbors, it stays in place, which takes O(1) (plus
+    // O(log n) to update the augmented data of augmented trees). Otherwise,
+    // it is unlinked and relinked by a search starting at its old neighbor
+    // in the direction of the move, which takes O(log d), where d is the
+    // distance of the move. If the tree already contains an element with
+    // the new key, the element is erased and the other element is returned
+    // together with false.
+    template <typename Fn>
+    std::pair<iterator, bool> update_key(iterator it, Fn fn)
+    {
+        return update_key_helper(it, fn, static_cast<Fn*>(nullptr));
+    }
 
-            if (head_.left == y)
-                head_.left = z;
-        } else {
-            z->set_parent(y);
-            y->right = z;
+    // Same as above, but if the tree already contains an element with the
+    // new key, `rollback(*it)` is invoked, which must restore the previous
+    // key, and the element is linked back at its previous position in
+    // amortized O(1), i.e., `it` stays valid.
+    template <typename Fn, typename Rollback>
+    std::pair<iterator, bool> update_key(iterator it, Fn fn, Rollback rollback)
+    {
+        return update_key_helper(it, fn, &rollback);
+    }
 
-            if (head_.right == y)
-                head_.right = z;
-        }
+    // Erases the element at `it` without a lookup and returns an iterator
+    // to the next element. Takes amortized O(1) plus the rebalancing.
+    iterator erase(const_iterator it) noexcept
+    {
+        node_type* z = const_cast<node_type*>(it.curr_);
+        assert(z != &head_);
+        iterator next(iterator::next(z));
+        erase_node(z);
+        reset_node(z);
+        return next;
+    }
 
-        z->left = nullptr;
-        z->right = nullptr;
-        z->set_red();
+    iterator erase(iterator it) noexcept
+    {
+        return erase(const_iterator(it));
+    }
 
-        insert_fixup(z);
-        return { iterator(z), true };
+    // Erases the elements in [`first`, `last`) without any lookup and
+    // returns `last`. Short ranges are erased element by element. Once the
+    // range turns out to be longer than about the height of the tree, the
+    // rest of it is cut out by two splits and a join, s.t. erasing k
+    // elements takes O(log n + k) without rebalancing per element.
+    iterator erase(const_iterator first, const_iterator last) noexcept
+    {
+        return erase(first, last, [](value_type*) {});
+    }
+
+    // Same as above, and invokes `disposer` on each erased element.
+    template <typename Disposer>
+    iterator erase(
+        const_iterator first, const_iterator last, Disposer disposer) noexcept
+    {
+        static_assert(std::is_invocable_v<Disposer, value_type*>);
+
+        node_type* x = const_cast<node_type*>(first.curr_);
+        node_type* end = const_cast<node_type*>(last.curr_);
+
+        size_t limit = 2 * black_height(root()) + 2;
+        for (size_t i = 0; x != end && i < limit; ++i) {
+            node_type* next = iterator::next(x);
+            erase_node(x);
+            reset_node(x);
+            disposer(&to_value(x));
+            x = next;
+        }
+        if (x == end)
+            return iterator(end);
+
+        rbtree rest(get_get_key_for_value(), get_compare(), get_augment());
+        if (end != &head_)
+            rest = split_before(end);
+        rbtree range = split_before(x);
+        append(rest);
+
+        range.clear_and_dispose_helper([&](value_type* value) {
+            reset_node(to_node(*value));
+            disposer(value);
+        }, range.root());
+        range.clear();
+        return iterator(end);
+    }
+
+    // Erases the least resp. greatest element in amortized O(1) and returns
+    // it, or returns null if the tree is empty.
+    value_type* pop_front() noexcept
+    {
+        if (empty())
+            return nullptr;
+        node_type* z = head_.left;
+        erase_node(z);
+        reset_node(z);
+        return &to_value(z);
+    }
+
+    value_type* pop_back() noexcept
+    {
+        if (empty())
+            return nullptr;
+        node_type* z = head_.right;
+        erase_node(z);
+        reset_node(z);
+        return &to_value(z);
     }
 
     // Note, `key` *must* be part of this tree.
@@ -879,12 +3166,43 @@ public:
         return &to_value(it.get());
     }
   
+    // Erases all elements with a key equal to `key` and invokes `disposer`
+    // on each of them in order. Returns the number of erased elements.
+    template <typename Disposer>
+    size_t erase_equal(const key_type& key, Disposer disposer) noexcept
+    {
+        return erase_equal_helper(key, disposer);
+    }
+
+    template <
+        typename Key, typename Disposer, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    size_t erase_equal(const Key& key, Disposer disposer) noexcept
+    {
+        return erase_equal_helper(key, disposer);
+    }
+
+    size_t erase_equal(const key_type& key) noexcept
+    {
+        auto disposer = [](value_type*) {};
+        return erase_equal_helper(key, disposer);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    size_t erase_equal(const Key& key) noexcept
+    {
+        auto disposer = [](value_type*) {};
+        return erase_equal_helper(key, disposer);
+    }
+
     // Clears the rbtree simply by resetting the head node.
     void clear() noexcept
     {
-        head_.set_parent(&head_);
-        head_.left = nullptr;
-        head_.right = nullptr;
+        head_.set_parent(nullptr);
+        head_.left = &head_;
+        head_.right = &head_;
     }
 
     // Clears the rbtree by iterating over each element and invoking
@@ -895,15 +3213,166 @@ public:
         static_assert(std::is_invocable_v<Disposer, value_type*>);
 
         clear_and_dispose_helper(disposer, root());
-        set_root(nullptr);
-        head_.left = nullptr;
-        head_.right = nullptr;
+        clear();
+    }
+
+    // Moves the storage of all nodes in the given `layout` order, s.t. a
+    // descent touches few cache lines if `relocate` places the nodes
+    // consecutively (e.g. by `rbtree_node_pool::allocate_fresh`).
+    // `relocate(value)` must move `value` to its new location and return
+    // it, or return `value` to leave it in place. The links are restored by
+    // the tree; the tree must not be accessed from within `relocate`. Takes
+    // O(n log n) for breadth-first and O(n log log n) for van Emde Boas
+    // order.
+    template <
+        typename Relocate,
+        typename = std::enable_if_t<std::is_invocable_r_v<T*, Relocate, T*>>>
+    void relayout(
+        Relocate relocate,
+        rbtree_layout layout = rbtree_layout::van_emde_boas)
+    {
+        size_t h = height(root());
+        if (layout == rbtree_layout::van_emde_boas) {
+            if (h > 0)
+                relocate_van_emde_boas(root(), h, relocate);
+        } else {
+            for (size_t depth = 0; depth < h; ++depth)
+                relocate_level(root(), depth, 0, relocate);
+        }
+    }
+
+    // Replaces the content of the tree by the elements in [`first`,
+    // `last`) in O(n). The elements must be sorted in strictly increasing
+    // order. The range may either refer to the elements or contain
+    // pointers to them. The previous elements are unlinked as by `clear()`.
+    template <typename ForwardIt>
+    void assign_sorted(ForwardIt first, ForwardIt last) noexcept
+    {
+        clear();
+
+        size_t n = size_t(std::distance(first, last));
+        if (n == 0)
+            return;
+
+        assert(std::adjacent_find(first, last, [&](auto&& x, auto&& y) {
+            return !is_less_than(
+                to_key(sorted_value(x)), to_key(sorted_value(y)));
+        }) == last);
+
+        build_from_sorted(first, n);
+    }
+
+    // -- split/join ---------------------------------------------------------
+
+    // Moves all elements greater than `key` into the returned tree in
+    // O(log n) (O(log^2 n) for augmented trees).
+    rbtree split(const key_type& key) noexcept
+    {
+        return split_helper(key);
+    }
+
+    template <
+        typename Key, typename Comp = Compare,
+        typename = typename Comp::is_transparent>
+    rbtree split(const Key& key) noexcept
+    {
+        return split_helper(key);
+    }
+
+    // Joins the elements of `left`, `pivot` and the elements of `right`
+    // into a single tree in O(log n) (O(log^2 n) for augmented trees). All
+    // elements of `left` must be less than `pivot`, which must be less than
+    // all elements of `right`.
+    static rbtree join(
+        rbtree&& left, value_type& pivot, rbtree&& right) noexcept
+    {
+        rbtree rv(std::move(left));
+        node_type* k = rv.to_node(pivot);
+
+        assert(rv.empty()
+            || rv.is_less_than(rv.to_key(rv.head_.right), rv.to_key(k)));
+        assert(right.empty()
+            || rv.is_less_than(rv.to_key(k), rv.to_key(right.head_.left)));
+
+        node_type* l = rv.root();
+        node_type* r = right.root();
+        right.clear();
+
+        k->reset();
+        rv.set_key_prefix(k);
+        rv.join_subtrees(l, black_height(l), k, r, black_height(r));
+        rv.update_extremes();
+        return rv;
+    }
+
+    // Same as above, but without a pivot element.
+    static rbtree join(rbtree&& left, rbtree&& right) noexcept
+    {
+        if (right.empty())
+            return std::move(left);
+
+        node_type* pivot = right.head_.left;
+        right.erase_node(pivot);
+        return join(std::move(left), right.to_value(pivot), std::move(right));
+    }
+
+    // Moves all elements of `other` whose keys are not part of this tree
+    // yet into this tree (as `std::set::merge`). If all elements of one tree
+    // are less than all elements of the other tree, this is a `join` in
+    // O(log n + log m). Otherwise, both trees are rebuilt in O(n + m).
+    void merge(rbtree& other) noexcept
+    {
+        if (other.empty())
+            return;
+
+        if (empty() || is_less_than(
+                to_key(head_.right), to_key(other.head_.left))) {
+            *this = join(std::move(*this), std::move(other));
+            return;
+        }
+
+        if (is_less_than(to_key(other.head_.right), to_key(head_.left))) {
+            rbtree right(std::move(*this));
+            *this = join(std::move(other), std::move(right));
+            return;
+        }
+
+        node_type* a = flatten(root());
+        node_type* b = flatten(other.root());
+        clear();
+        other.clear();
+
+        // Merge both lists, where elements of `other` with an equal key
+        // remain in `other`.
+        sorted_list merged;
+        sorted_list rest;
+        while (a && b) {
+            if (is_less_than(to_key(b), to_key(a))) {
+                merged.push_back(b);
+                b = b->right;
+            } else {
+                if (!is_less_than(to_key(a), to_key(b))) {
+                    rest.push_back(b);
+                    b = b->right;
+                }
+                merged.push_back(a);
+                a = a->right;
+            }
+        }
+        for (; a; a = a->right)
+            merged.push_back(a);
+        for (; b; b = b->right)
+            merged.push_back(b);
+
+        build_from_sorted(list_iterator{merged.first}, merged.size);
+        other.build_from_sorted(list_iterator{rest.first}, rest.size);
     }
 
     void swap(rbtree& other) noexcept
     {
         std::swap(get_compare(), other.get_compare());
         std::swap(get_get_key_for_value(), other.get_get_key_for_value());
+        std::swap(get_augment(), other.get_augment());
 
         if (head_.parent() && other.head_.parent()) {
             assert(head_.is_red() == other.head_.is_red());
@@ -920,7 +3389,7 @@ public:
         } else if (head_.parent()) {
             other.head_.left = head_.left;
             other.head_.right = head_.right;
-            other.head_.set_parent(head_.parent_);
+            other.head_.set_parent(head_.parent());
             other.head_.parent()->set_parent(&other.head_);
 
             head_.left = &head_;
@@ -940,3 +3409,226 @@ public:
         }
     }
 };
+
+// -- red-black tree access --------------------------------------------------
+
+// Grants algorithms built on top of the tree (e.g. `interval_rbtree`)
+// access to its structure.
+struct rbtree_access {
+    template <typename Tree>
+    static constexpr bool is_counted = std::remove_const_t<Tree>::is_counted;
+
+    template <typename Tree>
+    static auto root(Tree& tree) noexcept
+    {
+        return tree.root();
+    }
+
+    // Clones (resp. disposes of) the subtrees below the top `depth` levels
+    // of `tree` by `run(count, fn)`, which must invoke `fn(i)` for all i in
+    // [0, `count`) and may do so concurrently (see `parallel_clone`).
+    template <typename Tree, typename Cloner, typename Disposer, typename Run>
+    static auto clone(
+        const Tree& tree, Cloner& cloner, Disposer& disposer, size_t depth,
+        Run&& run)
+    {
+        return tree.clone_helper(cloner, disposer, depth, run);
+    }
+
+    template <typename Tree, typename Disposer, typename Run>
+    static void clear_and_dispose(
+        Tree& tree, Disposer& disposer, size_t depth, Run&& run) noexcept
+    {
+        tree.clear_and_dispose_helper(disposer, depth, run);
+    }
+
+    template <typename Tree>
+    static auto head(Tree& tree) noexcept
+    {
+        return &tree.head_;
+    }
+
+    template <typename Node>
+    static Node* left(Node* x) noexcept
+    {
+        return x->left;
+    }
+
+    template <typename Node>
+    static Node* right(Node* x) noexcept
+    {
+        return x->right;
+    }
+
+    template <typename Node>
+    static Node* parent(Node* x) noexcept
+    {
+        return x->parent();
+    }
+
+    template <typename Node>
+    static bool is_red(const Node* x) noexcept
+    {
+        return x->is_red();
+    }
+
+    // The steps of an insertion, s.t. several trees can first be searched
+    // and then modified (see `multi_index_rbtree`).
+    template <typename Tree>
+    static auto find_insert_position(
+        Tree& tree, typename Tree::value_type& value) noexcept
+    {
+        return tree.find_insert_position(tree.to_key(value));
+    }
+
+    template <typename Tree, typename Position>
+    static void link(
+        Tree& tree, const Position& pos,
+        typename Tree::value_type& value) noexcept
+    {
+        assert(!pos.existing);
+        auto* z = tree.to_node(value);
+        z->reset();
+        tree.link_node(pos.parent, z, pos.left);
+    }
+
+    template <typename Tree>
+    static void unlink(Tree& tree, typename Tree::value_type& value) noexcept
+    {
+        auto* z = tree.to_node(value);
+        tree.erase_node(z);
+        tree.reset_node(z);
+    }
+
+    template <typename Tree>
+    static bool is_in_order(
+        Tree& tree, typename Tree::value_type& value) noexcept
+    {
+        return tree.is_in_order(tree.to_node(value));
+    }
+
+    template <typename Node>
+    static constexpr bool has_pointer_links =
+        std::is_pointer_v<decltype(Node::left)>;
+
+    // Same as `left`, `right` and `parent`, but the links may be written
+    // concurrently (see `concurrent_rbtree`). Requires pointer links.
+    template <typename Node>
+    static Node* load_left(Node* x) noexcept
+    {
+        return rbtree_load_relaxed(x->left);
+    }
+
+    template <typename Node>
+    static Node* load_right(Node* x) noexcept
+    {
+        return rbtree_load_relaxed(x->right);
+    }
+
+    template <typename Node>
+    static Node* load_parent(Node* x) noexcept
+    {
+        using node_type = std::remove_const_t<Node>;
+        return reinterpret_cast<Node*>(
+            rbtree_load_relaxed(x->parent_) & ~node_type::red_bit);
+    }
+};
+
+// -- interval tree ----------------------------------------------------------
+
+// Node of an `interval_rbtree` holding the closed interval [`low`, `high`].
+// `max_high` is maintained by the tree and holds the maximum `high` of the
+// subtree rooted at the node.
+template <typename Key, typename Tag = void>
+struct rbtree_interval_node : rbtree_node<Tag> {
+    using interval_key_type = Key;
+
+    Key low{};
+    Key high{};
+    Key max_high{};
+};
+
+template <typename T>
+struct get_interval_low {
+    using value_type = T;
+    using key_type = typename T::interval_key_type;
+
+    const key_type& operator()(const value_type& value) const noexcept
+    {
+        return value.low;
+    }
+};
+
+template <typename T, typename Compare>
+struct interval_augment {
+    Compare compare;
+
+    void operator()(T& value, const T* left, const T* right) const noexcept
+    {
+        value.max_high = value.high;
+        if (left && compare(value.max_high, left->max_high))
+            value.max_high = left->max_high;
+        if (right && compare(value.max_high, right->max_high))
+            value.max_high = right->max_high;
+    }
+};
+
+// Interval tree ordered by the lower endpoints of the intervals. Note, as
+// for any `rbtree` the keys, i.e., the lower endpoints, must be unique.
+template <
+    typename T, typename Tag = void,
+    typename Compare = std::less<typename T::interval_key_type>>
+class interval_rbtree :
+    public rbtree<
+        T, Tag, get_interval_low<T>, Compare, interval_augment<T, Compare>>
+{
+    using base_type = rbtree<
+        T, Tag, get_interval_low<T>, Compare, interval_augment<T, Compare>>;
+
+    template <typename Node, typename Key, typename Fn>
+    void overlap_search_helper(
+        Node* x, const Key& low, const Key& high, Fn& fn) const
+    {
+        using reference =
+            std::conditional_t<std::is_const_v<Node>, const T&, T&>;
+        const Compare& less = *this;
+
+        while (x) {
+            reference value = static_cast<reference>(*x);
+
+            // No interval in this subtree reaches up to `low`.
+            if (less(value.max_high, low))
+                return;
+
+            overlap_search_helper(rbtree_access::left(x), low, high, fn);
+
+            // This and all following intervals start after `high`.
+            if (less(high, value.low))
+                return;
+
+            if (!less(value.high, low))
+                fn(value);
+
+            x = rbtree_access::right(x);
+        }
+    }
+
+public:
+    using base_type::base_type;
+    using key_type = typename base_type::key_type;
+
+    // Invokes `fn` on all intervals overlapping [`low`, `high`] in order of
+    // their lower endpoints. Runs in O(k log n) for k reported intervals.
+    template <typename Fn>
+    void overlap_search(const key_type& low, const key_type& high, Fn&& fn)
+    {
+        overlap_search_helper(rbtree_access::root(*this), low, high, fn);
+    }
+
+    template <typename Fn>
+    void overlap_search(
+        const key_type& low, const key_type& high, Fn&& fn) const
+    {
+        overlap_search_helper(rbtree_access::root(*this), low, high, fn);
+    }
+};
@@ -0,0 +1,495 @@
+#include "concurrent-rbtree.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct ConcurrentNode : rbtree_node<> {
+    int key;
+    std::atomic<bool> reclaimed{false};
+
+    explicit ConcurrentNode(int key = 0) noexcept : key(key) {}
+
+    bool operator<(const ConcurrentNode& other) const noexcept
+    {
+        return key < other.key;
+    }
+};
+
+struct get_concurrent_key {
+    using value_type = ConcurrentNode;
+    using key_type = int;
+
+    const int& operator()(const ConcurrentNode& node) const noexcept
+    {
+        return node.key;
+    }
+};
+
+using concurrent_tree_type = concurrent_rbtree<
+    ConcurrentNode, void, get_concurrent_key, std::less<int>>;
+
+// Counts the keys read of nodes which were already handed to the disposer.
+std::atomic<size_t> reclaimed_key_reads{0};
+
+// Set by threads which only search the tree and never hold the writer lock.
+thread_local bool yield_in_get_key = false;
+
+struct get_checked_key {
+    using value_type = ConcurrentNode;
+    using key_type = int;
+
+    const int& operator()(const ConcurrentNode& node) const noexcept
+    {
+        // Widens the window in which `reclaim` may dispose of the node, but
+        // rarely enough for most searches to complete.
+        thread_local unsigned calls = 0;
+        if (yield_in_get_key && ++calls % 16 == 0)
+            std::this_thread::yield();
+        if (node.reclaimed.load(std::memory_order_relaxed))
+            reclaimed_key_reads.fetch_add(1, std::memory_order_relaxed);
+        return node.key;
+    }
+};
+
+}
+
+// -- concurrent readers -----------------------------------------------------
+
+TEST_CASE("concurrent_rbtree: single thread")
+{
+    std::vector<ConcurrentNode> nodes(100);
+    concurrent_tree_type tree;
+    for (int i = 0; i < 100; ++i) {
+        nodes[i].key = 2 * i;
+        REQUIRE(tree.insert(nodes[i]).second);
+    }
+
+    auto reader = tree.make_reader();
+    {
+        auto guard = reader.lock();
+        REQUIRE(guard.find(42) == &nodes[21]);
+        REQUIRE(guard.find(43) == nullptr);
+        REQUIRE(guard.contains(0));
+        REQUIRE(!guard.contains(200));
+        REQUIRE(guard.lower_bound(43) == &nodes[22]);
+        REQUIRE(guard.upper_bound(42) == &nodes[22]);
+        REQUIRE(guard.first() == &nodes[0]);
+
+        int expected = 0;
+        for (auto x = guard.first(); x; x = guard.next(x), expected += 2)
+            REQUIRE(x->key == expected);
+        REQUIRE(expected == 200);
+
+        // Erased while a reader holds a pointer, the reader continues after
+        // the erased key.
+        const ConcurrentNode* x = guard.find(42);
+        REQUIRE(tree.erase(42) == &nodes[21]);
+        REQUIRE(guard.next(x) == &nodes[22]);
+
+        // Still observable by the read section above.
+        size_t disposed = 0;
+        REQUIRE(tree.reclaim([&](ConcurrentNode*) { ++disposed; }) == 1);
+        REQUIRE(disposed == 0);
+
+        std::vector<int> keys;
+        guard.for_each_from(38, [&](const ConcurrentNode& node) {
+            keys.push_back(node.key);
+            return keys.size() < 3;
+        });
+        REQUIRE(keys == std::vector<int>{38, 40, 44});
+    }
+
+    size_t disposed = 0;
+    REQUIRE(tree.reclaim([&](ConcurrentNode*) { ++disposed; }) == 0);
+    REQUIRE(disposed == 1);
+}
+
+TEST_CASE("concurrent_rbtree: one writer, many readers")
+{
+    // Even keys stay in the tree, odd keys are inserted and erased by the
+    // writer while the readers check what they observe.
+    constexpr int key_count = 4096;
+    constexpr int reader_count = 4;
+
+    std::vector<ConcurrentNode> nodes(key_count);
+    concurrent_tree_type tree;
+    for (int i = 0; i < key_count; ++i) {
+        nodes[i].key = i;
+        if (i % 2 == 0)
+            tree.insert(nodes[i]);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> errors{0};
+    std::vector<std::thread> readers;
+
+    for (int r = 0; r < reader_count; ++r) {
+        readers.emplace_back([&, r] {
+            auto reader = tree.make_reader();
+            quick_rng rng(r + 1);
+            while (!done.load(std::memory_order_relaxed)) {
+                auto guard = reader.lock();
+                int key = int(rng.next() % key_count);
+
+                const ConcurrentNode* x = guard.find(key & ~1);
+                if (!x || x->key != (key & ~1))
+                    ++errors;
+                if (guard.find(key_count + key))
+                    ++errors;
+
+                int prev = -1;
+                size_t visited = 0;
+                guard.for_each_from(key, [&](const ConcurrentNode& node) {
+                    if (node.reclaimed.load(std::memory_order_relaxed))
+                        ++errors;
+                    if (node.key <= prev)
+                        ++errors;
+                    // No permanent key may be skipped.
+                    if (prev >= 0 && (prev | 1) + 1 < node.key)
+                        ++errors;
+                    prev = node.key;
+                    return ++visited < 32;
+                });
+            }
+        });
+    }
+
+    quick_rng rng;
+    std::vector<bool> linked(key_count, false);
+    std::vector<bool> available(key_count, true);
+    for (int i = 0; i < 200000; ++i) {
+        int key = int(rng.next() % key_count) | 1;
+        if (linked[key]) {
+            REQUIRE(tree.erase(key) == &nodes[key]);
+            linked[key] = false;
+            available[key] = false;
+        } else if (available[key]) {
+            nodes[key].reclaimed.store(false, std::memory_order_relaxed);
+            REQUIRE(tree.insert(nodes[key]).second);
+            linked[key] = true;
+        }
+
+        if (i % 64 == 0) {
+            tree.reclaim([&](ConcurrentNode* node) {
+                node->reclaimed.store(true, std::memory_order_relaxed);
+                available[node->key] = true;
+            });
+        }
+    }
+
+    done = true;
+    for (auto& reader : readers)
+        reader.join();
+
+    REQUIRE(errors == 0);
+    REQUIRE(tree.reclaim([](ConcurrentNode*) {}) == 0);
+}
+
+TEST_CASE("concurrent_rbtree: many writers")
+{
+    // Every writer owns the keys congruent to its index. Keys divisible by
+    // 8 are never erased and must be visible to the readers throughout.
+    constexpr int key_count = 4096;
+    constexpr int writer_count = 4;
+
+    std::vector<ConcurrentNode> nodes(key_count);
+    concurrent_tree_type tree;
+    for (int i = 0; i < key_count; ++i) {
+        nodes[i].key = i;
+        if (i % 8 == 0)
+            tree.insert(nodes[i]);
+        else
+            nodes[i].reclaimed = true;
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> errors{0};
+    std::thread reader_thread([&] {
+        auto reader = tree.make_reader();
+        quick_rng rng(17);
+        while (!done.load(std::memory_order_relaxed)) {
+            auto guard = reader.lock();
+            int key = int(rng.next() % key_count) & ~7;
+            if (guard.find(key) != &nodes[key])
+                ++errors;
+        }
+    });
+
+    std::vector<std::vector<bool>> linked(
+        writer_count, std::vector<bool>(key_count, false));
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writer_count; ++w) {
+        writers.emplace_back([&, w] {
+            quick_rng rng(w + 1);
+            std::vector<bool>& own = linked[w];
+            for (int i = 0; i < 50000; ++i) {
+                int key = int(rng.next() % (key_count / writer_count));
+                key = key * writer_count + w;
+                if (key % 8 == 0)
+                    continue;
+
+                if (own[key]) {
+                    if (tree.erase(key) != &nodes[key])
+                        ++errors;
+                    own[key] = false;
+                } else if (nodes[key].reclaimed) {
+                    nodes[key].reclaimed = false;
+                    if (!tree.insert(nodes[key]).second)
+                        ++errors;
+                    own[key] = true;
+                }
+
+                if (i % 256 == 0) {
+                    tree.reclaim([&](ConcurrentNode* node) {
+                        node->reclaimed = true;
+                    });
+                }
+            }
+        });
+    }
+
+    for (auto& writer : writers)
+        writer.join();
+    done = true;
+    reader_thread.join();
+    REQUIRE(errors == 0);
+
+    std::vector<int> expected;
+    for (int i = 0; i < key_count; ++i)
+        if (i % 8 == 0 || linked[i % writer_count][i])
+            expected.push_back(i);
+
+    std::vector<int> keys;
+    for (const auto& node : tree.unsafe_tree())
+        keys.push_back(node.key);
+    REQUIRE(keys == expected);
+    tree.reclaim([](ConcurrentNode*) {});
+}
+
+TEST_CASE("concurrent_rbtree: writers racing reclaim")
+{
+    // The disposer poisons the nodes, which must never be visited by the
+    // optimistic searches of `insert` afterwards. Keys divisible by 8 are
+    // never erased, i.e., inserting them again never takes the writer lock.
+    constexpr int key_count = 1024;
+    constexpr int writer_count = 2;
+    constexpr int searcher_count = 2;
+
+    std::vector<ConcurrentNode> nodes(key_count);
+    std::vector<ConcurrentNode> duplicates(key_count);
+    concurrent_rbtree<
+        ConcurrentNode, void, get_checked_key, std::less<int>> tree;
+    for (int i = 0; i < key_count; ++i) {
+        nodes[i].key = i;
+        duplicates[i].key = i;
+        if (i % 8 == 0)
+            tree.insert(nodes[i]);
+        else
+            nodes[i].reclaimed = true;
+    }
+    reclaimed_key_reads = 0;
+
+    std::atomic<int> searching{searcher_count};
+    std::atomic<size_t> errors{0};
+    std::vector<std::thread> threads;
+
+    // The writers insert and erase the keys congruent to their index and
+    // reclaim the erased nodes right away, as long as the searchers look up
+    // the permanent keys.
+    for (int w = 0; w < writer_count; ++w) {
+        threads.emplace_back([&, w] {
+            std::vector<bool> linked(key_count, false);
+            quick_rng rng(w + 1);
+            while (searching.load(std::memory_order_relaxed) > 0) {
+                int key = int(rng.next() % (key_count / writer_count));
+                key = key * writer_count + w;
+                if (key % 8 == 0)
+                    continue;
+
+                if (linked[key]) {
+                    if (tree.erase(key) != &nodes[key])
+                        ++errors;
+                    linked[key] = false;
+                } else if (nodes[key].reclaimed) {
+                    nodes[key].reclaimed = false;
+                    if (!tree.insert(nodes[key]).second)
+                        ++errors;
+                    linked[key] = true;
+                }
+
+                tree.reclaim([](ConcurrentNode* node) {
+                    node->reclaimed.store(true, std::memory_order_relaxed);
+                });
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    for (int s = 0; s < searcher_count; ++s) {
+        threads.emplace_back([&, s] {
+            auto reader = tree.make_reader();
+            quick_rng rng(s + 17);
+            yield_in_get_key = true;
+            for (int i = 0; i < 20000; ++i) {
+                int key = int(rng.next() % key_count) & ~7;
+                // Every 64th search runs in a read section of the caller.
+                auto [x, inserted] = i % 64 ?
+                    tree.insert(duplicates[key]) :
+                    tree.insert(reader.lock(), duplicates[key]);
+                if (inserted || x != &nodes[key])
+                    ++errors;
+            }
+            --searching;
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    REQUIRE(errors == 0);
+    REQUIRE(reclaimed_key_reads == 0);
+    REQUIRE(tree.unsafe_tree().validate());
+    tree.reclaim([](ConcurrentNode*) {});
+}
+
+// -- sharded tree -----------------------------------------------------------
+
+namespace {
+
+using sharded_tree_type = sharded_rbtree<
+    ConcurrentNode, void, get_concurrent_key, std::less<int>, 4>;
+
+std::vector<int> to_vector(const sharded_tree_type& tree)
+{
+    std::vector<int> keys;
+    tree.for_each([&](const ConcurrentNode& node) {
+        keys.push_back(node.key);
+        return true;
+    });
+    return keys;
+}
+
+}
+
+TEST_CASE("sharded_rbtree: routing and rebalancing")
+{
+    std::vector<ConcurrentNode> nodes(1000);
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; ++i) {
+        nodes[i].key = i;
+        expected.push_back(i);
+    }
+
+    int splitters[] = { 10, 20, 30 };
+    sharded_tree_type tree(std::begin(splitters), std::end(splitters));
+
+    SECTION("insert/find/erase") {
+        for (auto& node : nodes)
+            REQUIRE(tree.insert(node).second);
+        REQUIRE(!tree.insert(nodes[5]).second);
+        REQUIRE(tree.size() == 1000);
+        REQUIRE(tree.shard_size(0) == 10);
+        REQUIRE(tree.shard_size(3) == 970);
+        REQUIRE(tree.find(25) == &nodes[25]);
+        REQUIRE(tree.find(1000) == nullptr);
+        REQUIRE(to_vector(tree) == expected);
+
+        REQUIRE(tree.erase(20) == &nodes[20]);
+        REQUIRE(tree.erase(20) == nullptr);
+        REQUIRE(!tree.contains(20));
+        REQUIRE(tree.shard_size(2) == 9);
+    }
+
+    SECTION("batches") {
+        std::vector<ConcurrentNode*> batch;
+        for (auto& node : nodes)
+            batch.push_back(&node);
+        REQUIRE(tree.insert_batch_sorted(batch.begin(), batch.end()) == 1000);
+        REQUIRE(tree.shard_size(1) == 10);
+        REQUIRE(to_vector(tree) == expected);
+
+        std::vector<int> keys = { 5, 15, 16, 500, 2000 };
+        REQUIRE(tree.erase_batch_sorted(keys.begin(), keys.end()) == 4);
+        REQUIRE(tree.size() == 996);
+        REQUIRE(!tree.contains(15));
+    }
+
+    SECTION("rebalance") {
+        for (auto& node : nodes)
+            tree.insert(node);
+
+        tree.rebalance();
+        for (size_t i = 0; i < tree.shard_count(); ++i)
+            REQUIRE(tree.shard_size(i) == 250);
+        REQUIRE(to_vector(tree) == expected);
+        REQUIRE(tree.find(499) == &nodes[499]);
+        REQUIRE(tree.with_shard(2, [](auto& shard) {
+            return shard.begin()->key;
+        }) == 500);
+
+        // Moves the splitters back down.
+        for (int i = 100; i < 1000; ++i)
+            tree.erase(i);
+        tree.rebalance();
+        for (size_t i = 0; i < tree.shard_count(); ++i)
+            REQUIRE(tree.shard_size(i) == 25);
+        expected.resize(100);
+        REQUIRE(to_vector(tree) == expected);
+    }
+}
+
+TEST_CASE("sharded_rbtree: concurrent rebalancing")
+{
+    constexpr int key_count = 4096;
+    constexpr int writer_count = 4;
+
+    std::vector<ConcurrentNode> nodes(key_count);
+    for (int i = 0; i < key_count; ++i)
+        nodes[i].key = i;
+
+    sharded_tree_type tree;
+    std::atomic<bool> done{false};
+    std::thread rebalancer([&] {
+        while (!done.load())
+            tree.rebalance();
+    });
+
+    std::vector<std::vector<bool>> linked(
+        writer_count, std::vector<bool>(key_count, false));
+    std::vector<std::thread> writers;
+    std::atomic<size_t> errors{0};
+    for (int w = 0; w < writer_count; ++w) {
+        writers.emplace_back([&, w] {
+            quick_rng rng(w + 1);
+            std::vector<bool>& own = linked[w];
+            for (int i = 0; i < 20000; ++i) {
+                int key = int(rng.next() % (key_count / writer_count));
+                key = key * writer_count + w;
+                if (own[key] != tree.contains(key))
+                    ++errors;
+                if (own[key])
+                    errors += tree.erase(key) != &nodes[key];
+                else
+                    errors += !tree.insert(nodes[key]).second;
+                own[key] = !own[key];
+            }
+        });
+    }
+
+    for (auto& writer : writers)
+        writer.join();
+    done = true;
+    rebalancer.join();
+    REQUIRE(errors == 0);
+
+    std::vector<int> expected;
+    for (int i = 0; i < key_count; ++i)
+        if (linked[i % writer_count][i])
+            expected.push_back(i);
+    REQUIRE(to_vector(tree) == expected);
+    REQUIRE(tree.size() == expected.size());
+}
@@ -0,0 +1,212 @@
+#include "frozen-index.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct by_int_tag {};
+struct by_string_tag {};
+
+struct FrozenNode
+    : rbtree_node<>, rbtree_node<by_int_tag>, rbtree_node<by_string_tag> {
+    explicit FrozenNode(int foo) noexcept
+        : foo(foo), str(std::to_string(foo))
+    {}
+
+    int foo;
+    std::string str;
+
+    bool operator<(const FrozenNode& other) const noexcept
+    {
+        return foo < other.foo;
+    }
+};
+
+struct get_frozen_int {
+    using key_type = int;
+
+    const int& operator()(const FrozenNode& node) const noexcept
+    {
+        return node.foo;
+    }
+};
+
+struct get_frozen_string {
+    using key_type = std::string;
+
+    const std::string& operator()(const FrozenNode& node) const noexcept
+    {
+        return node.str;
+    }
+};
+
+template <typename Index, typename Key, typename = void>
+struct can_find : std::false_type {};
+
+template <typename Index, typename Key>
+struct can_find<Index, Key, std::void_t<decltype(
+    std::declval<const Index&>().find(std::declval<const Key&>()))>>
+    : std::true_type {};
+
+// Compares the lookups of `index` to those of `set` for all keys in
+// `set` and `queries`.
+template <typename Index, typename Set, typename Key, typename KeyOf>
+void check_index(
+    const Index& index, const Set& set, const std::vector<Key>& queries,
+    KeyOf key_of)
+{
+    REQUIRE(index.size() == set.size());
+    REQUIRE(index.empty() == set.empty());
+
+    auto check = [&](const Key& key) {
+        auto lb = set.lower_bound(key);
+        auto* x = index.lower_bound(key);
+        REQUIRE((lb == set.end() ? nullptr : *lb) == x);
+
+        auto ub = set.upper_bound(key);
+        auto* y = index.upper_bound(key);
+        REQUIRE((ub == set.end() ? nullptr : *ub) == y);
+
+        bool found = lb != set.end() && !(key < key_of(**lb));
+        REQUIRE(index.contains(key) == found);
+        REQUIRE(index.find(key) == (found ? x : nullptr));
+    };
+    for (auto* node : set)
+        check(key_of(*node));
+    for (const Key& key : queries)
+        check(key);
+}
+
+template <typename KeyOf>
+struct compare_by {
+    using is_transparent = void;
+
+    KeyOf key_of;
+
+    template <
+        typename Key, typename = std::enable_if_t<!std::is_pointer_v<Key>>>
+    bool operator()(const FrozenNode* x, const Key& key) const noexcept
+    {
+        return key_of(*x) < key;
+    }
+
+    template <
+        typename Key, typename = std::enable_if_t<!std::is_pointer_v<Key>>>
+    bool operator()(const Key& key, const FrozenNode* x) const noexcept
+    {
+        return key < key_of(*x);
+    }
+
+    bool operator()(const FrozenNode* x, const FrozenNode* y) const noexcept
+    {
+        return key_of(*x) < key_of(*y);
+    }
+};
+
+} // namespace
+
+TEST_CASE("frozen_index: lookup")
+{
+    for (int n : {0, 1, 2, 15, 16, 17, 100, 273, 1000, 5000}) {
+        std::vector<std::unique_ptr<FrozenNode>> nodes;
+        rbtree<FrozenNode> by_value;
+        rbtree<FrozenNode, by_int_tag, get_frozen_int, std::less<int>> by_int;
+        rbtree<FrozenNode, by_string_tag, get_frozen_string, std::less<>>
+            by_string;
+
+        quick_rng rng(n + 1);
+        std::vector<int> ints;
+        for (int k = 0; k < n; k++) {
+            int foo = int(rng.next() % 10000) - 5000;
+            ints.push_back(foo);
+            nodes.push_back(std::make_unique<FrozenNode>(foo));
+            if (by_int.insert(*nodes.back()).second) {
+                by_value.insert(*nodes.back());
+                by_string.insert(*nodes.back());
+            }
+        }
+        for (int k = 0; k < 100; k++)
+            ints.push_back(int(rng.next() % 12000) - 6000);
+        ints.push_back(INT32_MIN);
+        ints.push_back(INT32_MAX);
+
+        std::vector<std::string> strings;
+        for (int foo : ints)
+            strings.push_back(std::to_string(foo));
+        strings.push_back("");
+        strings.push_back("~");
+
+        auto int_of = [](const FrozenNode& x) { return x.foo; };
+        auto string_of = [](const FrozenNode& x) { return x.str; };
+        std::set<FrozenNode*, compare_by<decltype(int_of)>> int_set(
+            compare_by<decltype(int_of)>{int_of});
+        std::set<FrozenNode*, compare_by<decltype(string_of)>> string_set(
+            compare_by<decltype(string_of)>{string_of});
+        for (FrozenNode& node : by_int) {
+            int_set.insert(&node);
+            string_set.insert(&node);
+        }
+
+        SECTION("arithmetic keys " + std::to_string(n)) {
+            frozen_index<FrozenNode, get_frozen_int, std::less<int>> index(
+                by_int);
+            check_index(index, int_set, ints, int_of);
+
+            // Heterogeneous lookups for the same index type.
+            frozen_index<const FrozenNode, get_frozen_int, std::less<>>
+                const_index(std::as_const(by_int));
+            std::vector<double> doubles;
+            for (int foo : ints)
+                doubles.push_back(foo + 0.5);
+            for (double key : doubles) {
+                const FrozenNode* x = const_index.lower_bound(key);
+                auto it = int_set.lower_bound(key);
+                REQUIRE((it == int_set.end() ? nullptr : *it) == x);
+            }
+        }
+
+        SECTION("string keys " + std::to_string(n)) {
+            frozen_index<FrozenNode, get_frozen_string, std::less<>> index(
+                by_string);
+            check_index(index, string_set, strings, string_of);
+            for (const std::string& key : strings)
+                REQUIRE(index.find(key.c_str()) == index.find(key));
+
+            // Without a transparent comparison, other key types are
+            // converted to `key_type` once per lookup.
+            using opaque_index = frozen_index<
+                FrozenNode, get_frozen_string, std::less<std::string>>;
+            STATIC_REQUIRE(!can_find<opaque_index, std::string_view>::value);
+            STATIC_REQUIRE(can_find<opaque_index, const char*>::value);
+            opaque_index opaque(by_string);
+            for (const std::string& key : strings)
+                REQUIRE(opaque.find(key.c_str()) == index.find(key));
+        }
+
+        SECTION("elements as keys " + std::to_string(n)) {
+            frozen_index<FrozenNode> index(by_value);
+            std::vector<FrozenNode> queries;
+            for (int foo : ints)
+                queries.emplace_back(foo);
+            auto self = [](const FrozenNode& x) -> const FrozenNode& {
+                return x;
+            };
+            std::set<FrozenNode*, compare_by<decltype(self)>> set(
+                int_set.begin(), int_set.end(),
+                compare_by<decltype(self)>{self});
+            check_index(index, set, queries, self);
+        }
+
+        by_value.clear();
+        by_int.clear();
+        by_string.clear();
+    }
+}
@@ -0,0 +1,155 @@
+#include "multi-index-rbtree.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace {
+
+struct by_id {};
+struct by_time {};
+
+struct Job : rbtree_node<by_id>, rbtree_node<by_time> {
+    Job(int id, int time) noexcept : id(id), time(time) {}
+
+    int id;
+    int time;
+};
+
+struct get_id {
+    using key_type = int;
+
+    const int& operator()(const Job& job) const noexcept
+    {
+        return job.id;
+    }
+};
+
+struct get_time {
+    using key_type = int;
+
+    const int& operator()(const Job& job) const noexcept
+    {
+        return job.time;
+    }
+};
+
+using job_index = multi_index_rbtree<
+    Job, rbtree_index<by_id, get_id>, rbtree_index<by_time, get_time>>;
+
+void check_jobs(const job_index& jobs, const std::map<int, int>& by_id_model)
+{
+    std::map<int, int> by_time_model;
+    for (auto [id, time] : by_id_model)
+        by_time_model.emplace(time, id);
+
+    auto it = by_id_model.begin();
+    for (const Job& job : jobs.get<0>()) {
+        REQUIRE(it != by_id_model.end());
+        REQUIRE(job.id == it->first);
+        REQUIRE(job.time == it->second);
+        ++it;
+    }
+    REQUIRE(it == by_id_model.end());
+
+    auto jt = by_time_model.begin();
+    for (const Job& job : jobs.get<1>()) {
+        REQUIRE(jt != by_time_model.end());
+        REQUIRE(job.time == jt->first);
+        REQUIRE(job.id == jt->second);
+        ++jt;
+    }
+    REQUIRE(jt == by_time_model.end());
+}
+
+} // namespace
+
+TEST_CASE("multi_index_rbtree: insert/erase/modify")
+{
+    job_index jobs;
+    std::vector<std::unique_ptr<Job>> storage;
+    std::map<int, int> model;
+    std::set<int> times;
+
+    SECTION("rejected insertions leave all trees unchanged") {
+        Job a(1, 10), b(2, 20), c(3, 10), d(1, 30);
+        REQUIRE(jobs.insert(a));
+        REQUIRE(jobs.insert(b));
+        REQUIRE(!jobs.insert(c));
+        REQUIRE(!jobs.insert(d));
+        check_jobs(jobs, {{1, 10}, {2, 20}});
+
+        jobs.erase(a);
+        REQUIRE(jobs.insert(c));
+        check_jobs(jobs, {{2, 20}, {3, 10}});
+
+        // A conflicting modification is rolled back...
+        REQUIRE(!jobs.modify(b, [](Job& job) { job.time = 10; },
+            [](Job& job) { job.time = 20; }));
+        check_jobs(jobs, {{2, 20}, {3, 10}});
+
+        // ... or erases the element without a rollback.
+        REQUIRE(!jobs.modify(b, [](Job& job) { job.id = 3; }));
+        check_jobs(jobs, {{3, 10}});
+
+        jobs.clear();
+        REQUIRE(jobs.empty());
+    }
+
+    SECTION("fuzz") {
+        quick_rng rng(21);
+        for (int k = 0; k < 5000; k++) {
+            int id = int(rng.next() % 500);
+            int time = int(rng.next() % 500);
+            auto it = model.find(id);
+
+            switch (rng.next() % 3) {
+            case 0: {
+                storage.push_back(std::make_unique<Job>(id, time));
+                bool ok = it == model.end() && !times.count(time);
+                REQUIRE(jobs.insert(*storage.back()) == ok);
+                if (ok) {
+                    model.emplace(id, time);
+                    times.insert(time);
+                }
+                break;
+            }
+            case 1:
+                if (it != model.end()) {
+                    Job* job = &*jobs.get<0>().find(id);
+                    jobs.erase(*job);
+                    times.erase(it->second);
+                    model.erase(it);
+                }
+                break;
+            default:
+                if (it != model.end()) {
+                    // Move the job by a small or a large amount of time.
+                    Job* job = &*jobs.get<0>().find(id);
+                    int old_time = job->time;
+                    if (rng.next() % 2)
+                        time = old_time + int(rng.next() % 3) - 1;
+                    bool ok = time == old_time || !times.count(time);
+                    REQUIRE(jobs.modify(*job,
+                        [&](Job& job) { job.time = time; },
+                        [&](Job& job) { job.time = old_time; }) == ok);
+                    if (ok) {
+                        times.erase(old_time);
+                        times.insert(time);
+                        it->second = time;
+                    }
+                    REQUIRE(job->time == it->second);
+                }
+                break;
+            }
+        }
+        check_jobs(jobs, model);
+
+        size_t disposed = 0;
+        jobs.clear_and_dispose([&](Job*) { ++disposed; });
+        REQUIRE(disposed == model.size());
+        REQUIRE(jobs.empty());
+    }
+}
@@ -0,0 +1,208 @@
+#include "parallel-rbtree.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename Tag>
+struct ParallelNode : rbtree_node<Tag> {
+    explicit ParallelNode(int foo) noexcept : foo(foo) {}
+
+    int foo;
+    std::atomic<int> visits{0};
+
+    bool operator<(const ParallelNode& other) const noexcept
+    {
+        return foo < other.foo;
+    }
+};
+
+template <typename Tag, typename Executor>
+void check_parallel_algorithms(int n, Executor&& executor, size_t concurrency)
+{
+    using node_type = ParallelNode<Tag>;
+    std::vector<std::unique_ptr<node_type>> nodes;
+    rbtree<node_type, Tag> tree;
+    quick_rng rng(n + 1);
+    for (int k = 0; k < n; k++) {
+        nodes.push_back(std::make_unique<node_type>(int(rng.next() % 1000000)));
+        tree.insert(*nodes.back());
+    }
+
+    parallel_for_each(tree, [](node_type& node) {
+        node.visits++;
+    }, executor, concurrency);
+    for (const node_type& node : tree)
+        REQUIRE(node.visits == 1);
+
+    long sum = parallel_reduce(
+        static_cast<const rbtree<node_type, Tag>&>(tree), 0L,
+        [](long acc, const node_type& node) { return acc + node.foo; },
+        [](long lhs, long rhs) { return lhs + rhs; },
+        executor, concurrency);
+    long expected_sum = 0;
+    for (const node_type& node : tree)
+        expected_sum += node.foo;
+    REQUIRE(sum == expected_sum);
+
+    // Concatenation is not commutative, hence the order of the partial
+    // results matters.
+    using keys_type = std::vector<int>;
+    keys_type keys = parallel_reduce(
+        tree, keys_type(),
+        [](keys_type acc, const node_type& node) {
+            acc.push_back(node.foo);
+            return acc;
+        },
+        [](keys_type lhs, keys_type rhs) {
+            lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+            return lhs;
+        },
+        executor, concurrency);
+    keys_type expected;
+    for (const node_type& node : tree)
+        expected.push_back(node.foo);
+    REQUIRE(keys == expected);
+
+    tree.clear();
+}
+
+}
+
+// -- parallel algorithms ----------------------------------------------------
+
+TEST_CASE("rbtree: parallel_for_each/parallel_reduce")
+{
+    // The threads of an executor are reused by later algorithms.
+    rbtree_thread_executor pool(3);
+    for (int n : { 0, 1, 7, 1000, 50000 }) {
+        check_parallel_algorithms<void>(n, rbtree_thread_executor(), 4);
+        check_parallel_algorithms<void>(n, rbtree_inline_executor(), 3);
+        check_parallel_algorithms<void>(n, pool, 8);
+        check_parallel_algorithms<rbtree_counted<>>(
+            n, rbtree_thread_executor(), 4);
+        check_parallel_algorithms<rbtree_counted<>>(
+            n, rbtree_inline_executor(), 1);
+    }
+
+    SECTION("exceptions are rethrown") {
+        std::vector<std::unique_ptr<ParallelNode<void>>> nodes;
+        rbtree<ParallelNode<void>> tree;
+        for (int k = 0; k < 1000; k++) {
+            nodes.push_back(std::make_unique<ParallelNode<void>>(k));
+            tree.insert(*nodes.back());
+        }
+
+        REQUIRE_THROWS_AS(
+            parallel_for_each(tree, [](ParallelNode<void>& node) {
+                if (node.foo == 500)
+                    throw std::runtime_error("500");
+            }, rbtree_thread_executor(), 4),
+            std::runtime_error);
+        tree.clear();
+    }
+
+    SECTION("the started tasks are waited for if the executor throws") {
+        std::vector<std::unique_ptr<ParallelNode<void>>> nodes;
+        rbtree<ParallelNode<void>> tree;
+        for (int k = 0; k < 1000; k++) {
+            nodes.push_back(std::make_unique<ParallelNode<void>>(k));
+            tree.insert(*nodes.back());
+        }
+
+        // Starts the first task and fails to start any other.
+        std::vector<std::thread> threads;
+        auto executor = [&](auto task) {
+            if (!threads.empty())
+                throw std::runtime_error("executor");
+            threads.emplace_back(std::move(task));
+        };
+        std::atomic<int> visits{0};
+        REQUIRE_THROWS_AS(
+            parallel_for_each(tree, [&](ParallelNode<void>&) {
+                visits++;
+            }, executor, 4),
+            std::runtime_error);
+        int visited = visits;
+        threads[0].join();
+        REQUIRE(visits == visited);
+        tree.clear();
+    }
+}
+
+// -- parallel clone/teardown ------------------------------------------------
+
+TEST_CASE("rbtree: parallel_clone/parallel_clear_and_dispose")
+{
+    using node_type = ParallelNode<rbtree_counted<>>;
+    using tree_type = rbtree<node_type, rbtree_counted<>>;
+
+    std::atomic<int> live{0};
+    auto cloner = [&](const node_type* node) {
+        live++;
+        return new node_type(node->foo);
+    };
+    auto disposer = [&](node_type* node) {
+        live--;
+        delete node;
+    };
+
+    for (int n : { 0, 1, 5, 100, 20000 }) {
+        tree_type tree;
+        for (int k = 0; k < n; k++) {
+            live++;
+            tree.insert(*new node_type(k));
+        }
+
+        tree_type copy = parallel_clone(
+            tree, cloner, disposer, rbtree_thread_executor(), 4);
+        REQUIRE(live == 2 * n);
+        REQUIRE(copy.size() == size_t(n));
+        int k = 0;
+        for (const node_type& node : copy)
+            REQUIRE(node.foo == k++);
+        REQUIRE(k == n);
+        for (size_t i = 0; i < size_t(n); i += 97)
+            REQUIRE(copy.nth(i)->foo == int(i));
+        if (n > 0)
+            REQUIRE((--copy.end())->foo == n - 1);
+
+        parallel_clear_and_dispose(
+            copy, disposer, rbtree_thread_executor(), 4);
+        REQUIRE(copy.empty());
+        REQUIRE(live == n);
+        parallel_clear_and_dispose(
+            tree, disposer, rbtree_inline_executor(), 3);
+        REQUIRE(live == 0);
+    }
+
+    SECTION("rolls back if the cloner throws") {
+        tree_type tree;
+        for (int k = 0; k < 5000; k++) {
+            live++;
+            tree.insert(*new node_type(k));
+        }
+
+        std::atomic<int> cloned{0};
+        auto throwing_cloner = [&](const node_type* node) {
+            if (++cloned == 3000)
+                throw std::runtime_error("3000");
+            live++;
+            return new node_type(node->foo);
+        };
+        REQUIRE_THROWS_AS(
+            parallel_clone(
+                tree, throwing_cloner, disposer, rbtree_thread_executor(),
+                4),
+            std::runtime_error);
+        REQUIRE(live == 5000);
+        tree.clear_and_dispose(disposer);
+        REQUIRE(live == 0);
+    }
+}
@@ -0,0 +1,121 @@
+#include "persistent-rbtree.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename Tree>
+std::vector<typename Tree::value_type> to_vector(const Tree& tree)
+{
+    std::vector<typename Tree::value_type> values;
+    tree.for_each([&](const auto& value) {
+        values.push_back(value);
+        return true;
+    });
+    return values;
+}
+
+}
+
+// -- persistent tree --------------------------------------------------------
+
+TEST_CASE("persistent_rbtree: snapshots")
+{
+    persistent_rbtree<std::string> tree;
+    REQUIRE(tree.insert("b"));
+    REQUIRE(tree.insert("a"));
+    REQUIRE(!tree.insert("a"));
+    REQUIRE(tree.size() == 2);
+
+    auto snapshot = tree.snapshot();
+    REQUIRE(tree.insert("c"));
+    REQUIRE(tree.erase(std::string("a")));
+    REQUIRE(!tree.erase(std::string("a")));
+
+    REQUIRE(to_vector(tree) == std::vector<std::string>{"b", "c"});
+    REQUIRE(to_vector(snapshot) == std::vector<std::string>{"a", "b"});
+    REQUIRE(snapshot.size() == 2);
+    REQUIRE(*snapshot.find(std::string("a")) == "a");
+    REQUIRE(tree.find(std::string("a")) == nullptr);
+    REQUIRE(*tree.lower_bound(std::string("bb")) == "c");
+
+    // Modifying the snapshot does not affect the live version.
+    snapshot.clear();
+    REQUIRE(snapshot.empty());
+    REQUIRE(tree.size() == 2);
+}
+
+TEST_CASE("persistent_rbtree: fuzz tests")
+{
+    struct version {
+        persistent_rbtree<int> tree;
+        std::set<int> set;
+    };
+
+    persistent_rbtree<int> tree;
+    std::set<int> set;
+    std::vector<version> versions;
+    quick_rng rng(4711);
+
+    for (int k = 0; k < 50000; k++) {
+        int key = int(rng.next() % 1000);
+        if (rng.next() % 2)
+            REQUIRE(tree.insert(key) == set.insert(key).second);
+        else
+            REQUIRE(tree.erase(key) == (set.erase(key) > 0));
+        REQUIRE(tree.size() == set.size());
+
+        if (k % 500 == 0)
+            versions.push_back({ tree.snapshot(), set });
+        if (versions.size() > 16)
+            versions.erase(versions.begin() + rng.next() % versions.size());
+    }
+
+    for (const version& v : versions) {
+        REQUIRE(
+            to_vector(v.tree) == std::vector<int>(v.set.begin(), v.set.end()));
+    }
+    REQUIRE(to_vector(tree) == std::vector<int>(set.begin(), set.end()));
+}
+
+TEST_CASE("persistent_rbtree: reading snapshots concurrently")
+{
+    persistent_rbtree<int> tree;
+    for (int k = 0; k < 1000; k++)
+        tree.insert(2 * k);
+
+    // Each reader checks its snapshot while the writer keeps modifying the
+    // live version and releases the snapshot when done.
+    std::atomic<size_t> errors{0};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&errors, snapshot = tree.snapshot()] {
+            int expected = 0;
+            snapshot.for_each([&](int key) {
+                errors += key != expected;
+                expected += 2;
+                return true;
+            });
+            errors += expected != 2000;
+            for (int k = 0; k < 1000; k++)
+                errors += !snapshot.contains(2 * k);
+        });
+        for (int k = 0; k < 500; k++) {
+            tree.erase(2 * k);
+            tree.insert(2 * k + 1);
+        }
+        for (int k = 0; k < 500; k++) {
+            tree.erase(2 * k + 1);
+            tree.insert(2 * k);
+        }
+    }
+
+    for (auto& reader : readers)
+        reader.join();
+    REQUIRE(errors == 0);
+}
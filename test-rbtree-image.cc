@@ -0,0 +1,234 @@
+#include "rbtree-image.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct ImageNode : rbtree_node<> {
+    ImageNode(int key, int value) noexcept : key(key), value(value) {}
+
+    int key;
+    int value;
+};
+
+struct ImageRecord {
+    int key;
+    int value;
+};
+
+struct get_image_key {
+    using key_type = int;
+
+    template <typename Node>
+    const int& operator()(const Node& node) const noexcept
+    {
+        return node.key;
+    }
+};
+
+using tree_type = rbtree<ImageNode, void, get_image_key, std::less<int>>;
+using image_type = rbtree_image<ImageRecord, get_image_key, std::less<int>>;
+
+// Page-aligned storage as a mapped file would provide.
+struct alignas(4096) page {
+    char bytes[4096];
+};
+
+std::vector<page> write_image(const tree_type& tree, rbtree_image_order order)
+{
+    std::ostringstream out;
+    write_rbtree_image(out, tree, [](const ImageNode& node) {
+        return ImageRecord{node.key, node.value};
+    }, order);
+
+    std::string bytes = out.str();
+    std::vector<page> pages(bytes.size() / sizeof(page) + 1);
+    std::memcpy(pages.data(), bytes.data(), bytes.size());
+    size_t count = size_t(std::distance(tree.begin(), tree.end()));
+    REQUIRE(bytes.size() == rbtree_image_nodes_offset
+        + count * sizeof(rbtree_image_node<ImageRecord>));
+    return pages;
+}
+
+// Checks that the image keeps the shape and colors of `tree`.
+void check_shape(
+    const rbtree_image_node<ImageRecord>* x, const rbtree_node<>* y)
+{
+    if (!x) {
+        REQUIRE(!y);
+        return;
+    }
+    REQUIRE(y);
+    REQUIRE(x->record.key == static_cast<const ImageNode*>(y)->key);
+    REQUIRE(x->is_red() == rbtree_access::is_red(y));
+    check_shape(x->left(), rbtree_access::left(y));
+    check_shape(x->right(), rbtree_access::right(y));
+}
+
+void check_image(int n, rbtree_image_order order)
+{
+    std::vector<std::unique_ptr<ImageNode>> nodes;
+    tree_type tree;
+    std::set<int> set;
+    quick_rng rng(n);
+
+    for (int k = 0; k < n; k++) {
+        int key = int(rng.next() % 100000);
+        nodes.push_back(std::make_unique<ImageNode>(key, -key));
+        if (tree.insert(*nodes.back()).second)
+            set.insert(key);
+    }
+
+    auto pages = write_image(tree, order);
+    image_type image(pages.data(), pages.size() * sizeof(page));
+    REQUIRE(image.size() == set.size());
+    REQUIRE(image.order() == order);
+    check_shape(image.root(), rbtree_access::root(std::as_const(tree)));
+
+    std::vector<int> keys;
+    image.for_each([&](const ImageRecord& record) {
+        REQUIRE(record.value == -record.key);
+        keys.push_back(record.key);
+    });
+    REQUIRE(keys == std::vector<int>(set.begin(), set.end()));
+
+    for (int i = 0; i < 1000; i++) {
+        int key = int(rng.next() % 100010) - 5;
+        auto it = set.lower_bound(key);
+        const ImageRecord* x = image.lower_bound(key);
+        REQUIRE((it == set.end()) == (x == nullptr));
+        if (x)
+            REQUIRE(x->key == *it);
+
+        it = set.upper_bound(key);
+        x = image.upper_bound(key);
+        REQUIRE((it == set.end()) == (x == nullptr));
+        if (x)
+            REQUIRE(x->key == *it);
+
+        REQUIRE(image.contains(key) == (set.count(key) > 0));
+    }
+
+    // Rehydrate into new nodes.
+    std::vector<std::unique_ptr<ImageNode>> copies;
+    tree_type copy;
+    image.rehydrate(copy, [&](const ImageRecord& record) {
+        copies.push_back(
+            std::make_unique<ImageNode>(record.key, record.value));
+        return copies.back().get();
+    });
+    auto it = set.begin();
+    for (const ImageNode& node : copy) {
+        REQUIRE(node.key == *it++);
+        REQUIRE(node.value == -node.key);
+    }
+    REQUIRE(it == set.end());
+
+    copy.clear();
+    tree.clear();
+}
+
+} // namespace
+
+TEST_CASE("rbtree_image: write, search and rehydrate")
+{
+    for (int n : {0, 1, 2, 3, 10, 100, 1000, 10000}) {
+        check_image(n, rbtree_image_order::in_order);
+        check_image(n, rbtree_image_order::van_emde_boas);
+    }
+}
+
+TEST_CASE("rbtree_image: rejects foreign data")
+{
+    ImageNode node(1, 2);
+    tree_type tree;
+    tree.insert(node);
+    auto pages = write_image(tree, rbtree_image_order::in_order);
+    size_t size = rbtree_image_nodes_offset
+        + sizeof(rbtree_image_node<ImageRecord>);
+
+    REQUIRE(image_type(pages.data(), size).size() == 1);
+    REQUIRE_THROWS_AS(
+        image_type(pages.data(), size - 1), std::invalid_argument);
+    REQUIRE_THROWS_AS(
+        image_type(pages.data(), 16), std::invalid_argument);
+
+    // A different record type.
+    REQUIRE_THROWS_AS(
+        (rbtree_image<int>(pages.data(), size)), std::invalid_argument);
+
+    pages[0].bytes[0] ^= 1;
+    REQUIRE_THROWS_AS(image_type(pages.data(), size), std::invalid_argument);
+
+    // An exception thrown while rehydrating leaves the elements made so far
+    // in the tree.
+    pages[0].bytes[0] ^= 1;
+    tree.clear();
+    image_type image(pages.data(), size);
+    REQUIRE_THROWS_AS(image.rehydrate(tree, [](const ImageRecord&) {
+        throw std::runtime_error("fail");
+        return static_cast<ImageNode*>(nullptr);
+    }), std::runtime_error);
+    REQUIRE(tree.empty());
+}
+
+TEST_CASE("rbtree_image: rejects corrupt links")
+{
+    constexpr int N = 100;
+    std::vector<std::unique_ptr<ImageNode>> nodes;
+    tree_type tree;
+    for (int k = 0; k < N; k++) {
+        nodes.push_back(std::make_unique<ImageNode>(k, -k));
+        tree.insert(*nodes.back());
+    }
+    auto pages = write_image(tree, rbtree_image_order::in_order);
+    tree.clear();
+
+    size_t size = pages.size() * sizeof(page);
+    auto* image_nodes = reinterpret_cast<rbtree_image_node<ImageRecord>*>(
+        pages[0].bytes + rbtree_image_nodes_offset);
+    REQUIRE(image_type(pages.data(), size).size() == N);
+
+    SECTION("beyond the image") {
+        image_nodes[0].right_ = N;
+        REQUIRE_THROWS_AS(
+            image_type(pages.data(), size), std::invalid_argument);
+    }
+
+    SECTION("before the image") {
+        image_nodes[N - 1].left_ = (image_nodes[N - 1].left_ & 1) - 2 * N;
+        REQUIRE_THROWS_AS(
+            image_type(pages.data(), size), std::invalid_argument);
+    }
+
+    SECTION("cycle") {
+        // The last node in order links back to the first one.
+        image_nodes[N - 1].right_ = -(N - 1);
+        REQUIRE_THROWS_AS(
+            image_type(pages.data(), size), std::invalid_argument);
+    }
+
+    SECTION("too deep") {
+        // A chain of left links, which stays within the image.
+        for (int i = 0; i < N; i++) {
+            image_nodes[i].left_ = i > 0 ? -2 : 0;
+            image_nodes[i].right_ = 0;
+        }
+        rbtree_image_header h;
+        std::memcpy(&h, pages[0].bytes, sizeof(h));
+        h.root = N - 1;
+        std::memcpy(pages[0].bytes, &h, sizeof(h));
+        REQUIRE_THROWS_AS(
+            image_type(pages.data(), size), std::invalid_argument);
+    }
+}
@@ -0,0 +1,287 @@
+#include "rbtree-pool.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <deque>
+#include <functional>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename Tag>
+struct PoolNode : rbtree_node<Tag> {
+    explicit PoolNode(int foo) noexcept : foo(foo) {}
+
+    int foo;
+};
+
+struct get_pool_key {
+    using key_type = int;
+
+    template <typename Node>
+    const int& operator()(const Node& node) const noexcept
+    {
+        return node.foo;
+    }
+};
+
+// Checks the links and colors of `tree` and returns its nodes in
+// breadth-first order.
+template <typename Tree>
+auto check_structure(Tree& tree)
+{
+    using node_type = std::remove_pointer_t<
+        decltype(rbtree_access::root(tree))>;
+
+    std::vector<node_type*> order;
+    node_type* root = rbtree_access::root(tree);
+    if (!root)
+        return order;
+    REQUIRE(rbtree_access::parent(root) == rbtree_access::head(tree));
+    REQUIRE(!rbtree_access::is_red(root));
+
+    std::deque<node_type*> queue{root};
+    while (!queue.empty()) {
+        node_type* x = queue.front();
+        queue.pop_front();
+        order.push_back(x);
+        for (node_type* y : {rbtree_access::left(x), rbtree_access::right(x)}) {
+            if (!y)
+                continue;
+            REQUIRE(rbtree_access::parent(y) == x);
+            REQUIRE(!(rbtree_access::is_red(x) && rbtree_access::is_red(y)));
+            queue.push_back(y);
+        }
+    }
+    return order;
+}
+
+template <typename Tree, typename Node>
+size_t depth_of(Tree& tree, Node* x)
+{
+    size_t depth = 0;
+    for (; x != rbtree_access::root(tree); x = rbtree_access::parent(x))
+        ++depth;
+    return depth;
+}
+
+template <typename Tree>
+void check_contents(Tree& tree, const std::set<int>& set)
+{
+    auto it = set.begin();
+    for (auto& node : tree)
+        REQUIRE(node.foo == *it++);
+    REQUIRE(it == set.end());
+
+    auto rit = set.rbegin();
+    for (auto node = tree.end(); node != tree.begin();)
+        REQUIRE((--node)->foo == *rit++);
+
+    for (int k : set)
+        REQUIRE(tree.find(k) != tree.end());
+}
+
+template <typename Tag>
+void check_relayout(int n, rbtree_layout layout)
+{
+    using node_type = PoolNode<Tag>;
+    std::vector<node_type> nodes;
+    std::vector<node_type> moved;
+    nodes.reserve(n);
+    moved.reserve(n);
+
+    rbtree<node_type, Tag, get_pool_key, std::less<int>> tree;
+    std::set<int> set;
+    quick_rng rng(n);
+    for (int k = 0; k < n; k++) {
+        nodes.emplace_back(int(rng.next() % 1000000));
+        if (tree.insert(nodes.back()).second)
+            set.insert(nodes.back().foo);
+    }
+
+    tree.relayout([&](node_type* value) {
+        moved.push_back(std::move(*value));
+        return &moved.back();
+    }, layout);
+    check_contents(tree, set);
+    REQUIRE(moved.size() == set.size());
+
+    auto order = check_structure(tree);
+    if (order.empty())
+        return;
+    REQUIRE(static_cast<node_type*>(order.front()) == moved.data());
+
+    if (layout == rbtree_layout::breadth_first) {
+        for (size_t i = 0; i < order.size(); i++)
+            REQUIRE(static_cast<node_type*>(order[i]) == &moved[i]);
+    } else {
+        // The top half of the levels precedes all other nodes.
+        size_t height = 0;
+        for (auto* x : order)
+            height = std::max(height, depth_of(tree, x) + 1);
+        size_t top = 0;
+        for (auto* x : order)
+            top += depth_of(tree, x) < height / 2;
+        for (auto* x : order) {
+            size_t i = size_t(static_cast<node_type*>(x) - moved.data());
+            REQUIRE((depth_of(tree, x) < height / 2) == (i < top));
+        }
+    }
+
+    if constexpr (rbtree_is_counted_v<Tag>) {
+        REQUIRE(tree.size() == set.size());
+        size_t k = 0;
+        for (int key : set)
+            REQUIRE(tree.nth(k++)->foo == key);
+    }
+    tree.clear();
+}
+
+} // namespace
+
+TEST_CASE("rbtree: relayout")
+{
+    for (int n : {0, 1, 2, 3, 10, 100, 1000, 5000}) {
+        check_relayout<void>(n, rbtree_layout::breadth_first);
+        check_relayout<void>(n, rbtree_layout::van_emde_boas);
+        check_relayout<rbtree_counted<void>>(
+            n, rbtree_layout::breadth_first);
+        check_relayout<rbtree_counted<void>>(
+            n, rbtree_layout::van_emde_boas);
+    }
+}
+
+TEST_CASE("rbtree: node pool")
+{
+    using node_type = PoolNode<void>;
+    using pool_type = rbtree_node_pool<node_type, 4096>;
+    constexpr int N = 10000;
+
+    pool_type pool;
+    rbtree<node_type, void, get_pool_key, std::less<int>> tree;
+    std::set<int> set;
+    quick_rng rng(N);
+
+    SECTION("allocate_near") {
+        void* p = pool.allocate();
+        void* q = pool.allocate_near(p);
+        REQUIRE(pool_type::same_slab(p, q));
+        pool.deallocate(p);
+        REQUIRE(pool.allocate_near(q) == p);
+        pool.deallocate(q);
+        pool.deallocate(p);
+        pool.shrink();
+        REQUIRE(pool.slab_count() == 0);
+    }
+
+    SECTION("allocate_near with a hint from another pool") {
+        pool_type other;
+        void* p = other.allocate();
+        void* q = pool.allocate_near(p);
+        REQUIRE(!pool_type::same_slab(p, q));
+        REQUIRE(other.slab_count() == 1);
+        REQUIRE(pool.slab_count() == 1);
+        pool.deallocate(q);
+        other.deallocate(p);
+    }
+
+    SECTION("insert_for_key and compact") {
+        size_t near = 0;
+        for (int k = 0; k < N; k++) {
+            int key = int(rng.next() % 1000000);
+            tree.insert_for_key(key, [&](node_type* parent) {
+                void* p = pool.allocate_near(parent);
+                near += parent && pool_type::same_slab(parent, p);
+                set.insert(key);
+                return new (p) node_type(key);
+            });
+        }
+        REQUIRE(near > 0);
+        check_contents(tree, set);
+
+        // Erase most elements, which leaves the slabs sparsely used.
+        for (auto it = set.begin(); it != set.end();) {
+            if (rng.next() % 4 == 0) {
+                ++it;
+                continue;
+            }
+            node_type* x = tree.erase(*it);
+            REQUIRE(x);
+            x->~node_type();
+            pool.deallocate(x);
+            it = set.erase(it);
+        }
+        size_t slabs = pool.slab_count();
+
+        rbtree_compact(tree, pool, rbtree_layout::breadth_first);
+        check_contents(tree, set);
+        check_structure(tree);
+        REQUIRE(pool.slab_count() <
+            set.size() / pool_type::slots_per_slab + 3);
+        REQUIRE(pool.slab_count() < slabs);
+
+        rbtree_compact(tree, pool);
+        check_contents(tree, set);
+        check_structure(tree);
+
+        tree.clear_and_dispose([&](node_type* x) {
+            x->~node_type();
+            pool.deallocate(x);
+        });
+        pool.shrink();
+        REQUIRE(pool.slab_count() == 0);
+    }
+}
+
+TEST_CASE("rbtree: node pool recycling")
+{
+    using node_type = PoolNode<void>;
+    using pool_type = rbtree_node_pool<node_type, 4096>;
+    constexpr int N = 5000;
+
+    pool_type pool;
+    rbtree<node_type, void, get_pool_key, std::less<int>> tree;
+    std::set<int> set;
+
+    auto fill = [&] {
+        for (int k = 0; k < N; k++) {
+            tree.insert_for_key(k, [&] { return pool.create(k); });
+            set.insert(k);
+        }
+        check_contents(tree, set);
+    };
+
+    fill();
+    size_t slabs = pool.slab_count();
+    REQUIRE(slabs >= N / pool_type::slots_per_slab);
+
+    SECTION("disposer") {
+        for (int k = 0; k < N; k += 3) {
+            REQUIRE(tree.erase_equal(k, pool.disposer()) == 1);
+            set.erase(k);
+        }
+        check_contents(tree, set);
+        tree.clear_and_dispose(pool.disposer());
+        set.clear();
+
+        // The freed slots are reused before new slabs are taken.
+        fill();
+        REQUIRE(pool.slab_count() == slabs);
+    }
+
+    SECTION("remote disposer") {
+        std::thread thread([&] {
+            tree.clear_and_dispose(pool.remote_disposer());
+        });
+        thread.join();
+        set.clear();
+
+        fill();
+        REQUIRE(pool.slab_count() == slabs);
+    }
+
+    tree.clear_and_dispose(pool.disposer());
+    pool.shrink();
+    REQUIRE(pool.slab_count() == 0);
+}
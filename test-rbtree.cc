@@ -1,7 +1,10 @@
 #include "rbtree.h"
 #include "test-utils.h"
 #include <catch2/catch_all.hpp>
-#include <unordered_set>
+#include <climits>
+#include <map>
+#include <memory>
+#include <new>
 #include <set>
 
 namespace {
@@ -18,16 +21,6 @@ bool operator<(const StringNode& node0, const StringNode& node1) noexcept
     return node0.str < node1.str;
 }
 
-bool operator<(const StringNode& node, const char* zstr) noexcept
-{
-    return node.str < zstr;
-}
-
-bool operator<(const char* zstr, const StringNode& node) noexcept
-{
-    return zstr < node.str;
-}
-
 bool operator<(const StringNode& node, const std::string& str) noexcept
 {
     return node.str < str;
@@ -124,6 +117,23 @@ TEST_CASE("rbtree : simple iterator test")
     tree.clear_and_dispose([](StringNode* n) { delete n; });
     return;
 }
+TEST_CASE("rbtree: node size")
+{
+    // The color is packed into the parent pointer.
+    STATIC_REQUIRE(sizeof(rbtree_node<>) == 3 * sizeof(void*));
+
+    A a(1), b(2), c(3);
+    rbtree<A> tree;
+    tree.insert(a);
+    tree.insert(b);
+    tree.insert(c);
+    REQUIRE(tree.erase(b) == &b);
+    REQUIRE(tree.contains(a));
+    REQUIRE(tree.contains(c));
+    REQUIRE(tree.begin()->foo == 1);
+    REQUIRE(std::next(tree.begin())->foo == 3);
+}
+
 // -- destructor/clear -------------------------------------------------------
 
 TEST_CASE("rbtree: destructor/clear")
@@ -141,7 +151,7 @@ TEST_CASE("rbtree: destructor/clear")
     return;
 }
 
-// -- performance (insert) ---------------------------------------------------
+// -- int nodes --------------------------------------------------------------
 
 namespace {
 
@@ -158,113 +168,515 @@ bool operator<(const IntNode& node0, const IntNode& node1) noexcept
 
 }
 
-TEST_CASE("rbtree: performance test")
+// -- offset nodes -----------------------------------------------------------
+
+namespace {
+
+struct TestArena {
+    static char* base() noexcept { return storage; }
+
+    alignas(64) static inline char storage[1 << 16];
+};
+
+struct OffsetNode : rbtree_node<rbtree_offset<TestArena>> {
+    explicit OffsetNode(int foo) noexcept : foo(foo) {}
+
+    int foo;
+};
+
+bool operator<(const OffsetNode& node0, const OffsetNode& node1) noexcept
+{
+    return node0.foo < node1.foo;
+}
+
+}
+
+TEST_CASE("rbtree: offset nodes")
 {
-    constexpr size_t N = 50000;
+    using tree_type = rbtree<OffsetNode, rbtree_offset<TestArena>>;
+    constexpr int N = 1000;
+
+    STATIC_REQUIRE(sizeof(rbtree_node<rbtree_offset<TestArena>>) == 12);
+
+    // Both the tree and its nodes must live in the arena. Offset 0 is
+    // reserved for null links.
+    char* p = TestArena::base() + alignof(tree_type);
+    tree_type* tree = new (p) tree_type();
+    p += sizeof(tree_type) + alignof(OffsetNode);
+
+    std::vector<OffsetNode*> nodes;
+    for (int k = 0; k < N; k++) {
+        nodes.push_back(new (p) OffsetNode((k * 7919) % N));
+        p += sizeof(OffsetNode);
+    }
+    REQUIRE(p <= TestArena::base() + sizeof(TestArena::storage));
+
+    std::set<int> set;
+    quick_rng rng = {848484};
+    for (int k = 0; k < 10 * N; k++) {
+        OffsetNode* node = nodes[rng.next() % N];
+        if (rng.next() % 3) {
+            REQUIRE(
+                tree->insert(*node).second == set.insert(node->foo).second);
+        } else {
+            REQUIRE(
+                (tree->erase(*node) != nullptr) == (set.erase(node->foo) > 0));
+        }
+    }
+
+    auto it_set = set.begin();
+    for (const OffsetNode& node : *tree) {
+        REQUIRE(it_set != set.end());
+        REQUIRE(node.foo == *it_set);
+        it_set++;
+    }
+    REQUIRE(it_set == set.end());
+
+    auto it = tree->end();
+    for (auto it_rev = set.rbegin(); it_rev != set.rend(); it_rev++)
+        REQUIRE((--it)->foo == *it_rev);
+    REQUIRE(it == tree->begin());
+
+    tree->~tree_type();
+}
+
+// -- hinted insertion -------------------------------------------------------
+
+TEST_CASE("rbtree: hinted insertion")
+{
+    constexpr int N = 1000;
 
     std::vector<IntNode*> nodes;
-    nodes.resize(N);
-    for (size_t k = 0; k < N; k++) {
-        nodes[k] = new IntNode(int(k));
+    for (int k = 0; k < N; k++)
+        nodes.push_back(new IntNode(k));
+
+    SECTION("push_back/push_front") {
+        rbtree<IntNode> tree;
+        for (int k = N / 2; k < N; k++)
+            REQUIRE(tree.push_back(*nodes[k]).second);
+        for (int k = N / 2 - 1; k >= 0; k--)
+            REQUIRE(tree.push_front(*nodes[k]).second);
+        REQUIRE(!tree.push_back(*nodes[N / 2]).second);
+
+        int k = 0;
+        for (IntNode& node : tree)
+            REQUIRE(node.foo == k++);
+        REQUIRE(k == N);
+        tree.clear();
     }
 
-    // -- insert ------------------------------------------------
+    SECTION("insert with hint") {
+        rbtree<IntNode> tree;
+        std::set<int> set;
+        quick_rng rng = {5151};
+
+        for (int k = 0; k < 4 * N; k++) {
+            IntNode* node = nodes[rng.next() % N];
+
+            // Use hints which are right, wrong or somewhere near.
+            rbtree<IntNode>::const_iterator hint = tree.end();
+            switch (rng.next() % 4) {
+            case 0: hint = tree.lower_bound(*node); break;
+            case 1: hint = tree.upper_bound(*node); break;
+            case 2: hint = tree.begin(); break;
+            default: break;
+            }
 
-    BENCHMARK("rbtree: insert") {
+            auto rv = tree.insert(hint, *node);
+            REQUIRE(rv.second == set.insert(node->foo).second);
+            REQUIRE(rv.first->foo == node->foo);
+        }
+
+        auto it_set = set.begin();
+        for (IntNode& node : tree)
+            REQUIRE(node.foo == *it_set++);
+        REQUIRE(it_set == set.end());
+        tree.clear();
+    }
+
+    SECTION("insert_for_key with hint") {
         rbtree<IntNode> tree;
-        for (size_t k = 0; k < N; k++) {
-            tree.insert(*nodes[k]);
+        for (int k = 0; k < N; k++) {
+            auto rv = tree.insert_for_key(
+                tree.end(), *nodes[k], [&]() { return nodes[k]; });
+            REQUIRE(rv.second);
         }
-    };
 
-    BENCHMARK("std::set: insert") {
-        std::set<int> set;
-        for (size_t k = 0; k < N; k++) {
-            set.insert(int(k));
+        auto rv = tree.insert_for_key(
+            tree.find(*nodes[5]), *nodes[5], [&]() { return nullptr; });
+        REQUIRE(!rv.second);
+        REQUIRE(rv.first->foo == 5);
+
+        int k = 0;
+        for (IntNode& node : tree)
+            REQUIRE(node.foo == k++);
+        tree.clear();
+    }
+
+    for (IntNode* node : nodes)
+        delete node;
+}
+
+// -- counted nodes ----------------------------------------------------------
+
+namespace {
+
+struct CountedNode : rbtree_node<rbtree_counted<>> {
+    explicit CountedNode(int foo) noexcept : foo(foo) {}
+
+    int foo;
+};
+
+bool operator<(const CountedNode& node0, const CountedNode& node1) noexcept
+{
+    return node0.foo < node1.foo;
+}
+
+}
+
+TEST_CASE("rbtree: counted nodes")
+{
+    using tree_type = rbtree<CountedNode, rbtree_counted<>>;
+    constexpr int N = 500;
+
+    std::vector<CountedNode*> nodes;
+    for (int k = 0; k < N; k++)
+        nodes.push_back(new CountedNode(k));
+
+    tree_type tree;
+    std::set<int> set;
+    quick_rng rng = {1234};
+
+    for (int k = 0; k < 20 * N; k++) {
+        CountedNode* node = nodes[rng.next() % N];
+        if (rng.next() % 3) {
+            REQUIRE(tree.insert(*node).second == set.insert(node->foo).second);
+        } else {
+            REQUIRE(
+                (tree.erase(*node) != nullptr) == (set.erase(node->foo) > 0));
         }
-    };
+        REQUIRE(tree.size() == set.size());
+
+        if (k % 50 != 0)
+            continue;
 
-    BENCHMARK("std::unordered_set: insert") {
-        std::unordered_set<int> set;
-        for (size_t k = 0; k < N; k++) {
-            set.insert(int(k));
+        std::vector<int> sorted(set.begin(), set.end());
+        for (size_t i = 0; i < sorted.size(); i++) {
+            REQUIRE(tree.nth(i)->foo == sorted[i]);
+            REQUIRE(tree.rank(*nodes[sorted[i]]) == i);
         }
-    };
+        REQUIRE(tree.nth(sorted.size()) == tree.end());
+        REQUIRE(tree.rank(CountedNode(N)) == sorted.size());
 
-    // -- find ---------------------------------------------------
+        if (sorted.empty())
+            continue;
 
-    {
-        rbtree<IntNode> tree;
-        for (size_t k = 0; k < N; k++)
-            tree.insert(*nodes[k]);
+        size_t from = rng.next() % sorted.size();
+        size_t to = rng.next() % (sorted.size() + 1);
+        auto it = tree.nth(from);
+        it.advance(ptrdiff_t(to) - ptrdiff_t(from));
+        REQUIRE(it == tree.nth(to));
 
-        int found = 0;
-        BENCHMARK("rbtree: find") {
-            for (size_t k = 0; k < N; k++) {
-                found += int(tree.contains(*nodes[k]) == true);
-            }
-        };
+        auto it_end = tree.end();
+        it_end.advance(-ptrdiff_t(sorted.size() - from));
+        REQUIRE(it_end == tree.nth(from));
     }
 
-    {
-        std::set<int> set;
-        for (size_t k = 0; k < N; k++)
-            set.insert(int(k));
+    tree.clear();
+    for (CountedNode* node : nodes)
+        delete node;
+}
+
+// -- bulk build -------------------------------------------------------------
+
+TEST_CASE("rbtree: assign_sorted")
+{
+    SECTION("from elements") {
+        for (int n : {0, 1, 2, 3, 7, 8, 100, 5000}) {
+            std::vector<IntNode> nodes;
+            for (int k = 0; k < n; k++)
+                nodes.emplace_back(2 * k);
+
+            rbtree<IntNode> tree;
+            tree.assign_sorted(nodes.begin(), nodes.end());
+
+            int k = 0;
+            for (IntNode& node : tree)
+                REQUIRE(node.foo == 2 * k++);
+            REQUIRE(k == n);
+
+            k = n;
+            for (auto it = tree.end(); it != tree.begin();)
+                REQUIRE((--it)->foo == 2 * --k);
+
+            // The tree remains fully functional.
+            IntNode odd(-1), even(2 * n);
+            REQUIRE(tree.insert(odd).second);
+            REQUIRE(tree.insert(even).second);
+            for (IntNode& node : nodes)
+                REQUIRE(tree.erase(node) == &node);
+            REQUIRE(tree.begin()->foo == -1);
+            REQUIRE(std::next(tree.begin())->foo == 2 * n);
+            tree.clear();
+            REQUIRE(tree.empty());
+            REQUIRE(tree.begin() == tree.end());
+        }
+    }
+
+    SECTION("from pointers into counted nodes") {
+        constexpr int N = 1000;
+        std::vector<CountedNode*> nodes;
+        for (int k = 0; k < N; k++)
+            nodes.push_back(new CountedNode(k));
+
+        rbtree<CountedNode, rbtree_counted<>> tree;
+        tree.assign_sorted(nodes.begin(), nodes.end());
+        REQUIRE(tree.size() == N);
+        for (int k = 0; k < N; k++)
+            REQUIRE(tree.nth(size_t(k))->foo == k);
+
+        // Assigning replaces the previous content.
+        tree.assign_sorted(nodes.begin() + N / 2, nodes.end());
+        REQUIRE(tree.size() == N / 2);
+        REQUIRE(tree.begin()->foo == N / 2);
+
+        tree.clear_and_dispose([](CountedNode* node) { delete node; });
+        for (int k = 0; k < N / 2; k++)
+            delete nodes[k];
+    }
+}
+
+// -- split/join/merge -------------------------------------------------------
+
+namespace {
+
+template <typename Tree>
+std::vector<int> to_vector(const Tree& tree)
+{
+    std::vector<int> rv;
+    for (const auto& node : tree)
+        rv.push_back(node.foo);
+    return rv;
+}
 
-        int found = 0;
-        BENCHMARK("std::set: find") {
-            for (size_t k = 0; k < N; k++) {
-                found += int(set.find(int(k)) != set.end());
+}
+
+TEST_CASE("rbtree: split/join/merge")
+{
+    using tree_type = rbtree<CountedNode, rbtree_counted<>>;
+    constexpr int N = 1000;
+
+    std::vector<CountedNode*> nodes;
+    for (int k = 0; k < N; k++)
+        nodes.push_back(new CountedNode(k));
+
+    quick_rng rng = {2929};
+
+    SECTION("split and join") {
+        for (int round = 0; round < 50; round++) {
+            tree_type tree;
+            std::vector<int> expected;
+            for (int k = 0; k < N; k++) {
+                if (rng.next() % 2) {
+                    tree.insert(*nodes[k]);
+                    expected.push_back(k);
+                }
             }
-        };
+
+            int key = int(rng.next() % (N + 2)) - 1;
+            tree_type greater = tree.split(CountedNode(key));
+
+            auto mid = std::upper_bound(expected.begin(), expected.end(), key);
+            REQUIRE(to_vector(tree) == std::vector<int>(expected.begin(), mid));
+            REQUIRE(to_vector(greater) == std::vector<int>(mid, expected.end()));
+            REQUIRE(tree.size() == size_t(mid - expected.begin()));
+            REQUIRE(greater.size() == size_t(expected.end() - mid));
+
+            // Both parts remain fully functional.
+            if (!tree.empty()) {
+                CountedNode& last = *std::prev(tree.end());
+                REQUIRE(tree.erase(last) == &last);
+                tree.insert(last);
+            }
+
+            if (greater.empty()) {
+                tree = tree_type::join(std::move(tree), std::move(greater));
+            } else {
+                CountedNode& pivot = *greater.begin();
+                greater.erase(pivot);
+                tree = tree_type::join(
+                    std::move(tree), pivot, std::move(greater));
+            }
+            REQUIRE(greater.empty());
+            REQUIRE(to_vector(tree) == expected);
+            REQUIRE(tree.size() == expected.size());
+            for (size_t k = 0; k < expected.size(); k++)
+                REQUIRE(tree.nth(k)->foo == expected[k]);
+            tree.clear();
+        }
     }
 
-    {
-        std::unordered_set<int> set;
-        for (size_t k = 0; k < N; k++)
-            set.insert(int(k));
-
-        int found = 0;
-        BENCHMARK("std::unordered_set: find") {
-            for (size_t k = 0; k < N; k++) {
-                found += int(set.find(int(k)) != set.end());
+    SECTION("merge") {
+        for (int round = 0; round < 50; round++) {
+            tree_type tree0, tree1;
+            std::vector<int> expected0, expected1;
+            std::vector<CountedNode> dups;
+            dups.reserve(N);
+
+            // Alternate between overlapping and disjoint key ranges.
+            int mode = round % 3;
+            for (int k = 0; k < N; k++) {
+                bool low = k < N / 2;
+                bool in0 = mode == 0 ? rng.next() % 2 : low == (mode == 1);
+                bool in1 = mode == 0 ? rng.next() % 2 : low != (mode == 1);
+                if (in0) {
+                    tree0.insert(*nodes[k]);
+                    expected0.push_back(k);
+                }
+                if (in1 && in0) {
+                    dups.emplace_back(k);
+                    tree1.insert(dups.back());
+                    expected1.push_back(k);
+                } else if (in1) {
+                    tree1.insert(*nodes[k]);
+                    expected0.push_back(k);
+                }
             }
-        };
+            std::sort(expected0.begin(), expected0.end());
+
+            tree0.merge(tree1);
+            REQUIRE(to_vector(tree0) == expected0);
+            REQUIRE(to_vector(tree1) == expected1);
+            REQUIRE(tree0.size() == expected0.size());
+            REQUIRE(tree1.size() == expected1.size());
+            for (CountedNode& dup : dups)
+                REQUIRE(tree0.find(dup) != tree0.end());
+            tree0.clear();
+            tree1.clear();
+        }
     }
 
-    // -- erase --------------------------------------------------
-  
-    BENCHMARK_ADVANCED("rbtree: erase")(Catch::Benchmark::Chronometer meter) {
-        rbtree<IntNode> tree;
-        for (size_t k = 0; k < N; k++)
-            tree.insert(*nodes[k]);
-        meter.measure([&] { 
-            for (size_t k = 0; k < N; k++)
-                tree.erase(*nodes[k]);
-        });
-    };
-  
-    BENCHMARK_ADVANCED("std::set: erase")(Catch::Benchmark::Chronometer meter) {
-        std::set<int> set;
-        for (size_t k = 0; k < N; k++)
-            set.insert(int(k));
-        meter.measure([&] { 
-            for (size_t k = 0; k < N; k++)
-                set.erase(int(k));
-        });
-    };
-  
-    BENCHMARK_ADVANCED(
-        "std::unordered set: erase")(Catch::Benchmark::Chronometer meter)
+    for (CountedNode* node : nodes)
+        delete node;
+}
+
+// -- batched insert/erase ---------------------------------------------------
+
+TEST_CASE("rbtree: insert_batch_sorted/erase_batch_sorted")
+{
+    using tree_type = rbtree<CountedNode, rbtree_counted<>>;
+    constexpr int N = 2000;
+
+    std::vector<CountedNode*> nodes;
+    for (int k = 0; k < N; k++)
+        nodes.push_back(new CountedNode(k));
+
+    quick_rng rng = {8080};
+    tree_type tree;
+    std::set<int> set;
+
+    for (int round = 0; round < 200; round++) {
+        // Clustered batches starting at a random position.
+        int from = int(rng.next() % N);
+        int density = 1 + int(rng.next() % 8);
+        std::vector<CountedNode*> batch;
+        for (int k = from; k < N && batch.size() < 100; k++) {
+            if (rng.next() % density == 0)
+                batch.push_back(nodes[k]);
+        }
+
+        if (rng.next() % 2) {
+            size_t expected = 0;
+            for (CountedNode* node : batch)
+                expected += set.insert(node->foo).second;
+            REQUIRE(tree.insert_batch_sorted(batch.begin(), batch.end())
+                == expected);
+        } else {
+            std::vector<CountedNode> keys;
+            for (CountedNode* node : batch)
+                keys.emplace_back(node->foo);
+
+            size_t expected = 0;
+            for (CountedNode* node : batch)
+                expected += set.erase(node->foo);
+
+            std::vector<int> disposed;
+            size_t count = tree.erase_batch_sorted(
+                keys.begin(), keys.end(), [&](CountedNode* node) {
+                    disposed.push_back(node->foo);
+                });
+            REQUIRE(count == expected);
+            REQUIRE(disposed.size() == expected);
+            REQUIRE(std::is_sorted(disposed.begin(), disposed.end()));
+        }
+
+        REQUIRE(tree.size() == set.size());
+        REQUIRE(to_vector(tree) == std::vector<int>(set.begin(), set.end()));
+    }
+
+    tree.clear();
+    for (CountedNode* node : nodes)
+        delete node;
+}
+
+// -- interval tree ----------------------------------------------------------
+
+namespace {
+
+struct Span : rbtree_interval_node<int> {
+    Span(int low, int high) noexcept
     {
-        std::unordered_set<int> set;
-        for (size_t k = 0; k < N; k++)
-            set.insert(int(k));
-        meter.measure([&] { 
-            for (size_t k = 0; k < N; k++)
-                set.erase(int(k));
+        this->low = low;
+        this->high = high;
+    }
+};
+
+}
+
+TEST_CASE("rbtree: interval tree")
+{
+    constexpr int N = 400;
+    quick_rng rng = {7777};
+
+    std::vector<Span*> spans;
+    for (int k = 0; k < N; k++)
+        spans.push_back(new Span(k, k + int(rng.next() % 50)));
+
+    interval_rbtree<Span> tree;
+    std::vector<bool> linked(N, false);
+
+    for (int k = 0; k < 20 * N; k++) {
+        int idx = int(rng.next() % N);
+        if (rng.next() % 3) {
+            REQUIRE(tree.insert(*spans[idx]).second == !linked[idx]);
+            linked[idx] = true;
+        } else {
+            REQUIRE((tree.erase(spans[idx]->low) != nullptr) == linked[idx]);
+            linked[idx] = false;
+        }
+
+        if (k % 20 != 0)
+            continue;
+
+        int low = int(rng.next() % (N + 50)) - 25;
+        int high = low + int(rng.next() % 30);
+
+        std::vector<int> expected;
+        for (int i = 0; i < N; i++) {
+            if (linked[i] && spans[i]->low <= high && low <= spans[i]->high)
+                expected.push_back(i);
+        }
+
+        std::vector<int> found;
+        tree.overlap_search(low, high, [&](Span& span) {
+            found.push_back(span.low);
         });
-    };
+        REQUIRE(found == expected);
+    }
+
+    tree.clear();
+    for (Span* span : spans)
+        delete span;
 }
 
 // -- fuzz tests -------------------------------------------------------------
@@ -327,6 +739,98 @@ TEST_CASE("rbtree: fuzz tests")
     tree.clear_and_dispose([](StringNode* node) { delete node; });
 }
 
+// -- bounds -----------------------------------------------------------------
+
+TEST_CASE("rbtree: lower_bound/upper_bound/equal_range")
+{
+    using set_type = rbtree<
+        StringNode, void, get_key_for_value<StringNode>, std::less<>>;
+    quick_rng rng = {3984};
+
+    std::set<std::string> set;
+    set_type tree;
+
+    for (int k = 0; k < 1000; k++) {
+        std::string str = random_ascii_string(1, 4, rng);
+        if (set.insert(str).second)
+            tree.insert(*(new StringNode(str)));
+    }
+
+    auto to_set_it = [&](set_type::iterator it) {
+        return it == tree.end() ? set.end() : set.find(it->str);
+    };
+
+    for (int k = 0; k < 1000; k++) {
+        std::string str = random_ascii_string(1, 4, rng);
+        REQUIRE(to_set_it(tree.lower_bound(str)) == set.lower_bound(str));
+        REQUIRE(to_set_it(tree.upper_bound(str)) == set.upper_bound(str));
+
+        auto range = tree.equal_range(str);
+        auto set_range = set.equal_range(str);
+        REQUIRE(to_set_it(range.first) == set_range.first);
+        REQUIRE(to_set_it(range.second) == set_range.second);
+    }
+
+    // Lookups for a key present in the tree.
+    for (const std::string& str : set) {
+        const set_type& ctree = tree;
+        REQUIRE(ctree.lower_bound(str)->str == str);
+        REQUIRE(ctree.equal_range(str).first->str == str);
+        REQUIRE(std::next(ctree.equal_range(str).first)
+            == ctree.equal_range(str).second);
+        REQUIRE(ctree.upper_bound(str) == std::next(ctree.find(str)));
+    }
+
+    REQUIRE(tree.lower_bound(StringNode("\x7f")) == tree.end());
+    REQUIRE(tree.upper_bound(StringNode("")) == tree.begin());
+
+    tree.clear_and_dispose([](StringNode* node) { delete node; });
+}
+
+// -- batched lookup ---------------------------------------------------------
+
+TEST_CASE("rbtree: find_many/contains_many")
+{
+    using set_type = rbtree<
+        StringNode, void, get_key_for_value<StringNode>, std::less<>>;
+    quick_rng rng = {6060};
+
+    set_type tree;
+    for (int k = 0; k < 2000; k++) {
+        std::string str = random_ascii_string(1, 3, rng);
+        if (!tree.contains(str))
+            tree.insert(*(new StringNode(str)));
+    }
+
+    for (size_t n : {0, 1, 7, 8, 9, 64, 200}) {
+        std::vector<std::string> keys;
+        for (size_t k = 0; k < n; k++)
+            keys.push_back(random_ascii_string(1, 3, rng));
+
+        std::vector<set_type::iterator> found;
+        tree.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+        REQUIRE(found.size() == n);
+        for (size_t k = 0; k < n; k++)
+            REQUIRE(found[k] == tree.find(keys[k]));
+
+        const set_type& ctree = tree;
+        std::vector<set_type::const_iterator> cfound(n, ctree.end());
+        auto out = ctree.find_many(keys.begin(), keys.end(), cfound.begin());
+        REQUIRE(out == cfound.end());
+        for (size_t k = 0; k < n; k++)
+            REQUIRE(cfound[k] == ctree.find(keys[k]));
+
+        if (n > 64)
+            continue;
+
+        uint64_t mask = tree.contains_many(keys.begin(), keys.end());
+        for (size_t k = 0; k < n; k++)
+            REQUIRE(((mask >> k) & 1) == tree.contains(keys[k]));
+    }
+
+    tree.clear_and_dispose([](StringNode* node) { delete node; });
+}
+
 // -- clear_and_dispose ------------------------------------------------------
 
 struct ClearTester : rbtree_node<> {
@@ -361,4 +865,765 @@ TEST_CASE("rbtree: clear and dispose")
     REQUIRE(counter == N);
     tree.clear_and_dispose([](ClearTester* ct) { delete ct; });
     REQUIRE(counter == 0);
-}
\ No newline at end of file
+}
+// -- clone ------------------------------------------------------------------
+
+TEST_CASE("rbtree: clone")
+{
+    using tree_type = rbtree<CountedNode, rbtree_counted<>>;
+    constexpr int N = 1000;
+
+    tree_type tree;
+    for (int k = 0; k < N; k++)
+        tree.insert(*new CountedNode(k));
+
+    auto cloner = [](const CountedNode* node) {
+        return new CountedNode(*node);
+    };
+    auto disposer = [](CountedNode* node) { delete node; };
+
+    SECTION("copies the elements") {
+        tree_type copy = tree.clone(cloner, disposer);
+        REQUIRE(copy.size() == N);
+        int k = 0;
+        for (auto it = copy.begin(); it != copy.end(); ++it, ++k) {
+            REQUIRE(it->foo == k);
+            REQUIRE(&*it != &*tree.nth(size_t(k)));
+        }
+        REQUIRE(copy.nth(500)->foo == 500);
+        REQUIRE((--copy.end())->foo == N - 1);
+        copy.clear_and_dispose(disposer);
+    }
+
+    SECTION("rolls back if the cloner throws") {
+        int cloned = 0;
+        int disposed = 0;
+        auto throwing_cloner = [&](const CountedNode* node) {
+            if (++cloned == N / 2)
+                throw std::bad_alloc();
+            return new CountedNode(*node);
+        };
+        auto counting_disposer = [&](CountedNode* node) {
+            ++disposed;
+            delete node;
+        };
+        REQUIRE_THROWS_AS(
+            tree.clone(throwing_cloner, counting_disposer), std::bad_alloc);
+        REQUIRE(disposed == cloned - 1);
+    }
+
+    tree.clear_and_dispose(disposer);
+}
+
+// -- prefixed nodes ---------------------------------------------------------
+
+namespace {
+
+using string_prefixed = rbtree_prefixed<rbtree_string_prefix>;
+
+struct PrefixedNode : rbtree_node<string_prefixed> {
+    std::string str;
+
+    explicit PrefixedNode(std::string str) noexcept : str{std::move(str)} {}
+};
+
+struct get_prefixed_key {
+    using key_type = std::string;
+
+    const std::string& operator()(const PrefixedNode& node) const noexcept
+    {
+        return node.str;
+    }
+};
+
+using prefixed_tree =
+    rbtree<PrefixedNode, string_prefixed, get_prefixed_key, std::less<>>;
+
+// Returns a random string over "ab" with a common prefix of length
+// `common`, s.t. many keys share their cached prefix.
+std::string random_prefixed_string(size_t common, quick_rng& rng)
+{
+    std::string str(common, 'x');
+    size_t len = rng.next() % 6;
+    for (size_t k = 0; k < len; k++)
+        str.push_back(char('a' + rng.next() % 2));
+    return str;
+}
+
+void check_prefixed(
+    const prefixed_tree& tree, const std::set<std::string>& set)
+{
+    auto it = set.begin();
+    for (const PrefixedNode& node : tree)
+        REQUIRE(node.str == *it++);
+    REQUIRE(it == set.end());
+}
+
+}
+
+TEST_CASE("rbtree: prefixed nodes")
+{
+    STATIC_REQUIRE(
+        sizeof(rbtree_node<string_prefixed>) == 4 * sizeof(uint64_t));
+
+    rbtree_string_prefix prefix;
+    REQUIRE(prefix("") < prefix("a"));
+    REQUIRE(prefix("a") < prefix("ab"));
+    REQUIRE(prefix("abcdefgh") == prefix("abcdefghi"));
+    REQUIRE(prefix("\xff") > prefix("a"));
+
+    for (size_t common : {0, 3, 8, 12}) {
+        quick_rng rng(common + 1);
+        std::vector<std::unique_ptr<PrefixedNode>> nodes;
+        std::set<std::string> set;
+        prefixed_tree tree;
+
+        for (int k = 0; k < 2000; k++) {
+            std::string str = random_prefixed_string(common, rng);
+            if (rng.next() % 3 == 0) {
+                PrefixedNode* x = tree.erase(str);
+                REQUIRE((x != nullptr) == (set.erase(str) == 1));
+                continue;
+            }
+            nodes.push_back(std::make_unique<PrefixedNode>(str));
+            auto rv = tree.insert_for_key(str, [&]() {
+                return nodes.back().get();
+            });
+            REQUIRE(rv.second == set.insert(str).second);
+        }
+        check_prefixed(tree, set);
+
+        for (int k = 0; k < 500; k++) {
+            std::string str = random_prefixed_string(common, rng);
+            REQUIRE(tree.contains(str) == (set.count(str) == 1));
+            REQUIRE(tree.contains(str.c_str()) == (set.count(str) == 1));
+
+            auto lb = tree.lower_bound(str);
+            auto set_lb = set.lower_bound(str);
+            REQUIRE((lb == tree.end()) == (set_lb == set.end()));
+            if (set_lb != set.end())
+                REQUIRE(lb->str == *set_lb);
+
+            auto ub = tree.upper_bound(str);
+            auto set_ub = set.upper_bound(str);
+            REQUIRE((ub == tree.end()) == (set_ub == set.end()));
+            if (set_ub != set.end())
+                REQUIRE(ub->str == *set_ub);
+        }
+
+        // Split and join relink nodes, which must keep their prefixes.
+        std::string pivot = random_prefixed_string(common, rng);
+        prefixed_tree right = tree.split(pivot);
+        for (const PrefixedNode& node : right)
+            REQUIRE(pivot < node.str);
+        tree = prefixed_tree::join(std::move(tree), std::move(right));
+        check_prefixed(tree, set);
+        for (const std::string& str : set)
+            REQUIRE(tree.find(str)->str == str);
+
+        prefixed_tree copy = tree.clone(
+            [&](const PrefixedNode* node) {
+                nodes.push_back(std::make_unique<PrefixedNode>(node->str));
+                return nodes.back().get();
+            },
+            [](PrefixedNode*) {});
+        for (const std::string& str : set)
+            REQUIRE(copy.find(str.c_str())->str == str);
+        copy.clear();
+        tree.clear();
+    }
+}
+
+// -- three-way comparison ---------------------------------------------------
+
+namespace {
+
+struct ThreeWayNode : rbtree_node<> {
+    std::string str;
+
+    explicit ThreeWayNode(std::string str) noexcept : str{std::move(str)} {}
+};
+
+struct get_three_way_key {
+    using key_type = std::string;
+
+    const std::string& operator()(const ThreeWayNode& node) const noexcept
+    {
+        return node.str;
+    }
+};
+
+struct counting_compare3 {
+    using is_transparent = void;
+
+    size_t* calls = nullptr;
+
+    int operator()(std::string_view a, std::string_view b) const noexcept
+    {
+        ++*calls;
+        return a.compare(b);
+    }
+};
+
+struct string_compare3 {
+    int operator()(const std::string& a, const std::string& b) const noexcept
+    {
+        return a.compare(b);
+    }
+};
+
+template <typename Compare, typename = void>
+struct is_transparent : std::false_type {};
+
+template <typename Compare>
+struct is_transparent<Compare, std::void_t<typename Compare::is_transparent>>
+    : std::true_type {};
+
+}
+
+TEST_CASE("rbtree: three-way comparison")
+{
+    static_assert(is_transparent<rbtree_three_way<counting_compare3>>::value);
+    static_assert(!is_transparent<rbtree_three_way<string_compare3>>::value);
+
+    using compare_type = rbtree_three_way<counting_compare3>;
+    using tree_type =
+        rbtree<ThreeWayNode, void, get_three_way_key, compare_type>;
+
+    size_t calls = 0;
+    tree_type tree(
+        get_three_way_key(), compare_type(counting_compare3{&calls}));
+    std::vector<std::unique_ptr<ThreeWayNode>> nodes;
+    std::set<std::string> set;
+    quick_rng rng(20);
+
+    for (int k = 0; k < 2000; k++) {
+        std::string str = random_ascii_string(1, 4, rng);
+        nodes.push_back(std::make_unique<ThreeWayNode>(str));
+        auto rv = tree.insert(*nodes.back());
+        REQUIRE(rv.second == set.insert(str).second);
+    }
+
+    auto it = set.begin();
+    for (const ThreeWayNode& node : tree)
+        REQUIRE(node.str == *it++);
+    REQUIRE(it == set.end());
+
+    // A successful lookup compares the key once per level, also when
+    // batched by `find_many`.
+    size_t depths = 0;
+    for (const std::string& str : set) {
+        calls = 0;
+        auto found = tree.find(str.c_str());
+        REQUIRE(found->str == str);
+
+        size_t depth = 1;
+        rbtree_node<>* x = &*found;
+        while ((x = rbtree_access::parent(x)) != rbtree_access::head(tree))
+            depth++;
+        REQUIRE(calls == depth);
+        depths += depth;
+    }
+
+    calls = 0;
+    std::vector<tree_type::iterator> found;
+    tree.find_many(set.begin(), set.end(), std::back_inserter(found));
+    REQUIRE(found.size() == set.size());
+    REQUIRE(calls == depths);
+
+    for (int k = 0; k < 500; k++) {
+        std::string str = random_ascii_string(1, 4, rng);
+        auto lb = tree.lower_bound(str);
+        auto set_lb = set.lower_bound(str);
+        REQUIRE((lb == tree.end()) == (set_lb == set.end()));
+        if (set_lb != set.end())
+            REQUIRE(lb->str == *set_lb);
+        REQUIRE(tree.contains(str) == (set.count(str) == 1));
+    }
+
+    tree.clear();
+}
+
+// -- update_key -------------------------------------------------------------
+
+TEST_CASE("rbtree: update_key")
+{
+    SECTION("counted nodes") {
+        constexpr int N = 2000;
+        std::vector<std::unique_ptr<CountedNode>> nodes;
+        rbtree<CountedNode, rbtree_counted<>> tree;
+        std::set<int> set;
+        quick_rng rng(22);
+
+        for (int k = 0; k < N; k++) {
+            nodes.push_back(std::make_unique<CountedNode>(k * 10));
+            tree.insert(*nodes.back());
+            set.insert(k * 10);
+        }
+
+        for (int k = 0; k < 5 * N; k++) {
+            auto it = tree.nth(rng.next() % tree.size());
+            int old_key = it->foo;
+            int new_key = rng.next() % 4
+                ? old_key + int(rng.next() % 41) - 20
+                : int(rng.next() % (10 * N));
+
+            auto update = [&](CountedNode& node) { node.foo = new_key; };
+            bool roll_back = rng.next() % 2;
+            auto rv = roll_back
+                ? tree.update_key(it, update, [&](CountedNode& node) {
+                    node.foo = old_key;
+                })
+                : tree.update_key(it, update);
+            set.erase(old_key);
+            if (set.insert(new_key).second) {
+                REQUIRE(rv.second);
+                REQUIRE(rv.first == it);
+            } else if (new_key != old_key) {
+                REQUIRE(!rv.second);
+                REQUIRE(rv.first->foo == new_key);
+                REQUIRE(rv.first != it);
+                if (roll_back) {
+                    // The element is back at its previous position.
+                    set.insert(old_key);
+                    REQUIRE(it->foo == old_key);
+                    REQUIRE(tree.find(CountedNode(old_key)) == it);
+                }
+            }
+        }
+
+        REQUIRE(tree.size() == set.size());
+        auto it = set.begin();
+        for (size_t k = 0; k < tree.size(); k++)
+            REQUIRE(tree.nth(k)->foo == *it++);
+        for (int key : set)
+            REQUIRE(tree.find(CountedNode(key))->foo == key);
+        tree.clear();
+    }
+
+    SECTION("augmented nodes") {
+        std::vector<std::unique_ptr<Span>> spans;
+        interval_rbtree<Span> tree;
+        for (int k = 0; k < 100; k++) {
+            spans.push_back(std::make_unique<Span>(k * 10, k * 10 + 5));
+            tree.insert(*spans.back());
+        }
+
+        // A modification of the augmented data only must update it.
+        auto it = tree.find(500);
+        REQUIRE(tree.update_key(it, [](Span& span) { span.high = 5000; })
+            .second);
+        std::vector<int> found;
+        tree.overlap_search(4000, 4000, [&](Span& span) {
+            found.push_back(span.low);
+        });
+        REQUIRE(found == std::vector<int>{500});
+
+        // Move the interval to the end.
+        REQUIRE(tree.update_key(it, [](Span& span) { span.low = 2000; })
+            .second);
+        found.clear();
+        tree.overlap_search(2500, 2500, [&](Span& span) {
+            found.push_back(span.low);
+        });
+        REQUIRE(found == std::vector<int>{2000});
+        REQUIRE((--tree.end())->low == 2000);
+        tree.clear();
+    }
+}
+
+// -- duplicate keys ---------------------------------------------------------
+
+namespace {
+
+template <typename Tag>
+struct MultiNode : rbtree_node<Tag> {
+    MultiNode(int key, int seq) noexcept : key(key), seq(seq) {}
+
+    int key;
+    int seq;
+};
+
+struct get_multi_key {
+    using key_type = int;
+
+    template <typename Node>
+    const int& operator()(const Node& node) const noexcept
+    {
+        return node.key;
+    }
+};
+
+template <typename Tag>
+void check_insert_equal()
+{
+    using node_type = MultiNode<Tag>;
+    constexpr int N = 3000;
+
+    std::vector<std::unique_ptr<node_type>> nodes;
+    rbtree<node_type, Tag, get_multi_key, std::less<int>> tree;
+    std::multimap<int, int> map;
+    quick_rng rng(23);
+
+    for (int k = 0; k < N; k++) {
+        int key = int(rng.next() % 200);
+        if (rng.next() % 8) {
+            nodes.push_back(std::make_unique<node_type>(key, k));
+            if (k % 2) {
+                REQUIRE(&*tree.insert_equal(*nodes.back())
+                    == nodes.back().get());
+            } else {
+                auto it = tree.insert_equal_for_key(key, [&] {
+                    return nodes.back().get();
+                });
+                REQUIRE(it->seq == k);
+            }
+            map.emplace(key, k);
+        } else {
+            auto range = map.equal_range(key);
+            size_t erased = tree.erase_equal(key, [&](node_type* x) {
+                REQUIRE(x->key == key);
+                REQUIRE(x->seq == range.first->second);
+                ++range.first;
+            });
+            REQUIRE(range.first == range.second);
+            REQUIRE(erased == map.erase(key));
+        }
+        REQUIRE(tree.count(key) == map.count(key));
+    }
+
+    // Equal keys are kept in insertion order.
+    auto it = map.begin();
+    for (node_type& node : tree) {
+        REQUIRE(it != map.end());
+        REQUIRE(node.key == it->first);
+        REQUIRE(node.seq == it->second);
+        ++it;
+    }
+    REQUIRE(it == map.end());
+
+    for (int key = -1; key <= 200; key++) {
+        REQUIRE(tree.count(key) == map.count(key));
+        auto range = tree.equal_range(key);
+        auto map_range = map.equal_range(key);
+        for (; range.first != range.second; ++range.first) {
+            REQUIRE(range.first->seq == map_range.first->second);
+            ++map_range.first;
+        }
+        REQUIRE(map_range.first == map_range.second);
+        REQUIRE(tree.contains(key) == (map.find(key) != map.end()));
+    }
+
+    // `insert` still rejects equal keys.
+    if (!map.empty()) {
+        node_type node(map.begin()->first, N);
+        REQUIRE(!tree.insert(node).second);
+    }
+
+    REQUIRE(tree.erase_equal(-1) == 0);
+    size_t total = 0;
+    for (int key = 0; key < 200; key++)
+        total += tree.erase_equal(key);
+    REQUIRE(total == map.size());
+    REQUIRE(tree.empty());
+}
+
+} // namespace
+
+TEST_CASE("rbtree: insert_equal")
+{
+    check_insert_equal<void>();
+    check_insert_equal<rbtree_counted<>>();
+}
+
+TEST_CASE("rbtree: front/back and erase by iterator")
+{
+    constexpr int N = 1000;
+    std::vector<std::unique_ptr<CountedNode>> nodes;
+    rbtree<CountedNode, rbtree_counted<>> tree;
+    std::set<int> set;
+    quick_rng rng(24);
+
+    REQUIRE(tree.pop_front() == nullptr);
+    REQUIRE(tree.pop_back() == nullptr);
+
+    for (int k = 0; k < N; k++) {
+        nodes.push_back(std::make_unique<CountedNode>(k));
+        tree.insert(*nodes.back());
+        set.insert(k);
+    }
+
+    for (int k = 0; !set.empty(); k++) {
+        REQUIRE(tree.front().foo == *set.begin());
+        REQUIRE(tree.back().foo == *set.rbegin());
+        REQUIRE(&*tree.iterator_to(tree.back()) == &tree.back());
+
+        switch (k % 3) {
+        case 0: {
+            CountedNode* x = tree.pop_front();
+            REQUIRE(x->foo == *set.begin());
+            set.erase(set.begin());
+            break;
+        }
+        case 1: {
+            CountedNode* x = tree.pop_back();
+            REQUIRE(x->foo == *set.rbegin());
+            set.erase(std::prev(set.end()));
+            break;
+        }
+        default: {
+            size_t i = rng.next() % set.size();
+            auto it = tree.erase(tree.nth(i));
+            auto jt = set.erase(std::next(set.begin(), ptrdiff_t(i)));
+            REQUIRE((it == tree.end()) == (jt == set.end()));
+            if (jt != set.end())
+                REQUIRE(it->foo == *jt);
+            break;
+        }
+        }
+        REQUIRE(tree.size() == set.size());
+    }
+    REQUIRE(tree.empty());
+}
+
+// -- stats ------------------------------------------------------------------
+
+namespace {
+
+uint64_t histogram_sum(const rbtree_stats::histogram& histogram)
+{
+    uint64_t sum = 0;
+    for (uint64_t count : histogram)
+        sum += count;
+    return sum;
+}
+
+}
+
+TEST_CASE("rbtree: stats")
+{
+    using tree_type = rbtree<
+        IntNode, void, get_key_for_value<IntNode>, std::less<IntNode>,
+        rbtree_no_augment, rbtree_stats>;
+    constexpr int N = 1000;
+
+    // The default stats take no space.
+    STATIC_REQUIRE(sizeof(rbtree<IntNode>) == sizeof(rbtree_node<>));
+
+    std::vector<std::unique_ptr<IntNode>> nodes;
+    tree_type tree;
+    quick_rng rng(28);
+
+    REQUIRE(tree.height() == 0);
+    REQUIRE(tree.black_height() == 0);
+
+    for (int k = 0; k < N; k++) {
+        nodes.push_back(std::make_unique<IntNode>(int(rng.next() % 100000)));
+        tree.insert(*nodes.back());
+    }
+    const rbtree_stats& stats = tree.stats();
+    REQUIRE(histogram_sum(stats.insert_comparisons) == N);
+    REQUIRE(histogram_sum(stats.insert_fixup_iterations) > 0);
+    REQUIRE(stats.rotations > 0);
+
+    size_t height = tree.height();
+    size_t bh = tree.black_height();
+    REQUIRE(bh <= height);
+    REQUIRE(height <= 2 * bh);
+
+    // A find compares at most once per level.
+    for (auto& node : nodes)
+        REQUIRE(tree.contains(*node));
+    REQUIRE(histogram_sum(stats.find_comparisons) == N);
+    for (size_t k = height + 1; k < rbtree_stats::histogram_size; k++)
+        REQUIRE(stats.find_comparisons[k] == 0);
+    REQUIRE(stats.find_comparisons[0] == 0);
+
+    // So does `find_many`.
+    tree.reset_stats();
+    std::vector<IntNode> keys;
+    for (auto& node : nodes)
+        keys.emplace_back(node->foo);
+    std::vector<tree_type::iterator> found;
+    tree.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+    for (auto it : found)
+        REQUIRE(it != tree.end());
+    REQUIRE(histogram_sum(stats.find_comparisons) == N);
+    for (size_t k = height + 1; k < rbtree_stats::histogram_size; k++)
+        REQUIRE(stats.find_comparisons[k] == 0);
+    REQUIRE(stats.find_comparisons[0] == 0);
+
+    tree.reset_stats();
+    REQUIRE(stats.rotations == 0);
+    REQUIRE(histogram_sum(stats.find_comparisons) == 0);
+
+    // Erase in order, which requires rebalancing.
+    for (auto it = tree.begin(); it != tree.end();)
+        it = tree.erase(it);
+    REQUIRE(histogram_sum(stats.erase_fixup_iterations) > 0);
+    REQUIRE(stats.rotations > 0);
+    REQUIRE(histogram_sum(stats.insert_comparisons) == 0);
+}
+
+// -- validation -------------------------------------------------------------
+
+namespace {
+
+template <typename Node, typename Tag>
+void check_validate()
+{
+    constexpr int N = 2000;
+    std::vector<std::unique_ptr<Node>> nodes;
+    rbtree<Node, Tag> tree;
+    quick_rng rng(29);
+
+    REQUIRE(tree.validate());
+    REQUIRE(tree.validate_path(rng.next()));
+
+    invoker inv(29);
+    inv.add(2, [&] {
+        nodes.push_back(std::make_unique<Node>(int(rng.next() % 5000)));
+        if (!tree.insert(*nodes.back()).second)
+            nodes.pop_back();
+    });
+    inv.add(1, [&] {
+        if (nodes.empty())
+            return;
+        size_t i = rng.next() % nodes.size();
+        tree.erase(*nodes[i]);
+        nodes[i] = std::move(nodes.back());
+        nodes.pop_back();
+    });
+    for (int k = 0; k < N; k++) {
+        inv.next();
+        REQUIRE(tree.validate_path(
+            uint64_t(rng.next()) << 32 | rng.next()));
+        if (k % 100 == 0)
+            REQUIRE(tree.validate());
+    }
+    REQUIRE(tree.validate());
+
+    // Change the key part of the left child of the root in place.
+    auto* x = static_cast<Node*>(
+        rbtree_access::left(rbtree_access::root(tree)));
+    REQUIRE(x);
+    int key = x->foo;
+    x->foo = INT_MAX;
+    REQUIRE(!tree.validate());
+    REQUIRE(!tree.validate_path(0));
+
+    x->foo = key;
+    REQUIRE(tree.validate());
+    tree.clear();
+}
+
+}
+
+TEST_CASE("rbtree: validate")
+{
+    check_validate<IntNode, void>();
+    check_validate<CountedNode, rbtree_counted<>>();
+}
+
+// -- range erase and finger search ------------------------------------------
+
+namespace {
+
+template <typename Node, typename Tag>
+void check_erase_range(bool equal_keys)
+{
+    constexpr int N = 3000;
+    std::vector<std::unique_ptr<Node>> nodes;
+    rbtree<Node, Tag> tree;
+    std::multiset<int> set;
+    quick_rng rng(30);
+
+    for (int k = 0; k < N; k++) {
+        int key = int(rng.next() % (equal_keys ? N / 4 : 100000));
+        nodes.push_back(std::make_unique<Node>(key));
+        if (equal_keys) {
+            tree.insert_equal(*nodes.back());
+            set.insert(key);
+        } else if (tree.insert(*nodes.back()).second) {
+            set.insert(key);
+        }
+    }
+
+    while (!set.empty()) {
+        // Mostly short ranges, some of which span most of the tree.
+        size_t n = set.size();
+        size_t i = rng.next() % n;
+        size_t len = rng.next() % (n - i + 1);
+        if (rng.next() % 4 != 0)
+            len %= 8;
+
+        auto first = std::next(tree.begin(), ptrdiff_t(i));
+        auto last = std::next(first, ptrdiff_t(len));
+        const Node* expected = last == tree.end() ? nullptr : &*last;
+
+        size_t disposed = 0;
+        auto it = tree.erase(first, last, [&](Node* node) {
+            rbtree_node<Tag>* x = node;
+            REQUIRE(!rbtree_access::parent(x));
+            REQUIRE(!rbtree_access::left(x));
+            REQUIRE(!rbtree_access::right(x));
+            disposed++;
+        });
+        REQUIRE(disposed == len);
+        REQUIRE((it == tree.end()) == (expected == nullptr));
+        if (expected)
+            REQUIRE(&*it == expected);
+
+        auto sfirst = std::next(set.begin(), ptrdiff_t(i));
+        set.erase(sfirst, std::next(sfirst, ptrdiff_t(len)));
+
+        REQUIRE(tree.validate());
+        auto sit = set.begin();
+        for (const Node& node : tree)
+            REQUIRE(node.foo == *sit++);
+        REQUIRE(sit == set.end());
+    }
+    REQUIRE(tree.empty());
+}
+
+}
+
+TEST_CASE("rbtree: erase range")
+{
+    check_erase_range<IntNode, void>(false);
+    check_erase_range<IntNode, void>(true);
+    check_erase_range<CountedNode, rbtree_counted<>>(false);
+}
+
+TEST_CASE("rbtree: find_from")
+{
+    constexpr int N = 5000;
+    std::vector<std::unique_ptr<IntNode>> nodes;
+    rbtree<IntNode> tree;
+    std::set<int> set;
+    quick_rng rng(30);
+
+    REQUIRE(tree.find_from(tree.end(), IntNode(0)) == tree.end());
+
+    for (int k = 0; k < N; k++) {
+        nodes.push_back(std::make_unique<IntNode>(int(rng.next() % 20000)));
+        if (tree.insert(*nodes.back()).second)
+            set.insert(nodes.back()->foo);
+    }
+
+    auto hint = tree.begin();
+    for (int k = 0; k < 20000; k++) {
+        // Mostly lookups close to the previous one.
+        int key = k % 4 == 0 ? int(rng.next() % 20010)
+                             : hint == tree.end() ? 0
+                             : hint->foo + int(rng.next() % 21) - 10;
+        auto it = tree.find_from(hint, IntNode(key));
+        REQUIRE(it == tree.find(IntNode(key)));
+        REQUIRE((it != tree.end()) == (set.count(key) > 0));
+        if (it != tree.end())
+            hint = it;
+        else if (k % 3 == 0)
+            hint = tree.end();
+    }
+    tree.clear();
+}
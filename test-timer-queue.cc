@@ -0,0 +1,103 @@
+#include "timer-queue.h"
+#include "test-utils.h"
+#include <catch2/catch_all.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace {
+
+struct Timer : rbtree_node<> {
+    Timer(uint64_t expiry, int id) noexcept : expiry(expiry), id(id) {}
+
+    uint64_t expiry;
+    int id;
+};
+
+struct get_expiry {
+    using key_type = uint64_t;
+
+    const uint64_t& operator()(const Timer& timer) const noexcept
+    {
+        return timer.expiry;
+    }
+};
+
+using queue_type = timer_queue<Timer, void, get_expiry>;
+
+} // namespace
+
+TEST_CASE("timer_queue: pop_expired")
+{
+    constexpr int N = 2000;
+    std::vector<std::unique_ptr<Timer>> timers;
+    queue_type queue;
+    std::multimap<uint64_t, int> model;
+    std::vector<bool> scheduled(N);
+    quick_rng rng(24);
+
+    REQUIRE(queue.next() == nullptr);
+    REQUIRE(queue.pop_expired(uint64_t(0), [](Timer&) {}) == 0);
+
+    for (int k = 0; k < N; k++) {
+        timers.push_back(std::make_unique<Timer>(rng.next() % 500, k));
+        queue.schedule(*timers.back());
+        model.emplace(timers.back()->expiry, k);
+        scheduled[k] = true;
+    }
+
+    // Cancel and reschedule some timers.
+    for (int k = 0; k < N; k += 7) {
+        Timer& timer = *timers[k];
+        auto range = model.equal_range(timer.expiry);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == k) {
+                model.erase(it);
+                break;
+            }
+        }
+        if (k % 2) {
+            queue.cancel(timer);
+            scheduled[k] = false;
+        } else {
+            queue.reschedule(timer, [&](Timer& t) {
+                t.expiry = rng.next() % 500;
+            });
+            model.emplace(timer.expiry, k);
+        }
+    }
+
+    for (uint64_t now = 0; now < 600; now += 1 + rng.next() % 10) {
+        // Bounded batches.
+        size_t popped = queue.pop_expired(now, [&](Timer& timer) {
+            REQUIRE(timer.id == model.begin()->second);
+            model.erase(model.begin());
+        }, 3);
+        REQUIRE(popped <= 3);
+
+        popped = queue.pop_expired(now, [&](Timer& timer) {
+            REQUIRE(timer.expiry <= now);
+            REQUIRE(timer.id == model.begin()->second);
+            model.erase(model.begin());
+
+            // Periodic timers are scheduled again for a later time.
+            if (timer.id % 5 == 0) {
+                timer.expiry = now + 100;
+                queue.schedule(timer);
+                model.emplace(timer.expiry, timer.id);
+            }
+        });
+        REQUIRE(model.begin() == model.upper_bound(now));
+
+        if (model.empty()) {
+            REQUIRE(queue.next() == nullptr);
+        } else {
+            REQUIRE(queue.next()->id == model.begin()->second);
+            REQUIRE(queue.next()->expiry > now);
+        }
+    }
+
+    queue.clear();
+    REQUIRE(queue.empty());
+}
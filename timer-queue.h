@@ -0,0 +1,142 @@
+#pragma once
+
+#include "rbtree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// -- timer queue ------------------------------------------------------------
+
+// A queue of intrusive timers ordered by their expiry, which is the key of
+// the timer as given by `GetExpiry`, e.g.
+//
+//     struct Timer : rbtree_node<> { uint64_t expiry; ... };
+//     timer_queue<Timer, void, get_expiry> timers;
+//
+//     timers.schedule(timer);
+//     ...
+//     timers.pop_expired(now, [](Timer& timer) { ... });
+//
+// Timers with equal expiries expire in the order in which they were
+// scheduled. The next timer is cached by the tree, s.t. checking for and
+// popping expired timers takes amortized O(1) per timer and involves no
+// lookup.
+template <
+    typename T, typename Tag = void,
+    typename GetExpiry = get_key_for_value<T>,
+    typename Compare = std::less<typename GetExpiry::key_type>>
+class timer_queue {
+public:
+    using value_type = T;
+    using key_type = typename GetExpiry::key_type;
+    using tree_type = rbtree<T, Tag, GetExpiry, Compare>;
+
+private:
+    tree_type tree_;
+
+private:
+    template <typename Key0, typename Key1>
+    bool is_less_than(const Key0& key0, const Key1& key1) const noexcept
+    {
+        return static_cast<const Compare&>(tree_)(key0, key1);
+    }
+
+    const key_type& expiry(const value_type& timer) const noexcept
+    {
+        return static_cast<const GetExpiry&>(tree_)(timer);
+    }
+
+public:
+    explicit timer_queue(
+        const GetExpiry& get_expiry = GetExpiry(),
+        const Compare& compare = Compare()) noexcept
+        : tree_(get_expiry, compare)
+    {}
+
+    // The timers in the order of their expiry, e.g., for lookups.
+    const tree_type& timers() const noexcept
+    {
+        return tree_;
+    }
+
+    bool empty() const noexcept
+    {
+        return tree_.empty();
+    }
+
+    // Returns the timer which expires next, or null.
+    value_type* next() noexcept
+    {
+        return tree_.empty() ? nullptr : &tree_.front();
+    }
+
+    const value_type* next() const noexcept
+    {
+        return tree_.empty() ? nullptr : &tree_.front();
+    }
+
+    // Schedules `timer`, which must not be scheduled yet, after all timers
+    // with an earlier or equal expiry.
+    void schedule(value_type& timer) noexcept
+    {
+        tree_.insert_equal(timer);
+    }
+
+    // Cancels `timer`, which must be scheduled, without a lookup.
+    void cancel(value_type& timer) noexcept
+    {
+        tree_.erase(tree_.iterator_to(timer));
+    }
+
+    // Cancels `timer`, changes its expiry by `fn(timer)` and schedules it
+    // again.
+    template <typename Fn>
+    void reschedule(value_type& timer, Fn fn) noexcept
+    {
+        cancel(timer);
+        fn(timer);
+        schedule(timer);
+    }
+
+    // Pops all timers whose expiry is not after `now` in the order of their
+    // expiry, but at most `max_count` of them, and invokes `fn(timer)` on
+    // each of them. Returns the number of popped timers. A timer is popped
+    // before `fn` is invoked on it, s.t. `fn` may schedule it again or
+    // cancel other timers. Note that a timer scheduled by `fn` is popped by
+    // the same call if its expiry is not after `now`; `max_count` bounds
+    // the work of a call in that case.
+    //
+    // The next timer is prefetched before `fn` is invoked, s.t. its cache
+    // miss overlaps with the processing of the current timer.
+    template <typename Key, typename Fn>
+    size_t pop_expired(const Key& now, Fn fn, size_t max_count = SIZE_MAX)
+    {
+        size_t count = 0;
+        while (count < max_count && !tree_.empty()) {
+            value_type& timer = tree_.front();
+            if (is_less_than(now, expiry(timer)))
+                break;
+
+            tree_.pop_front();
+            if (!tree_.empty())
+                rbtree_prefetch(&tree_.front());
+            fn(timer);
+            ++count;
+        }
+        return count;
+    }
+
+    // Cancels all timers.
+    void clear() noexcept
+    {
+        tree_.clear();
+    }
+
+    // Cancels all timers and invokes `disposer` on each of them.
+    template <typename Disposer>
+    void clear_and_dispose(Disposer disposer)
+    {
+        tree_.clear_and_dispose(disposer);
+    }
+};